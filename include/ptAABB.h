@@ -27,6 +27,48 @@ public:
     COMMON_FUNC const Vector3<T>& min() const { return m_min; }
     COMMON_FUNC const Vector3<T>& max() const { return m_max; }
 
+    // Slab test using a precomputed reciprocal ray direction; dirIsNeg[a] is (invDir[a] < 0).
+    COMMON_FUNC bool hit(const Ray<T>& r, const Vector3<T>& invDir, const int dirIsNeg[3], T tmin, T tmax) const
+    {
+        for (int a = 0; a < 3; a++)
+        {
+            const auto t0 = ((dirIsNeg[a] ? m_max[a] : m_min[a]) - r.origin()[a]) * invDir[a];
+            const auto t1 = ((dirIsNeg[a] ? m_min[a] : m_max[a]) - r.origin()[a]) * invDir[a];
+            tmin = t0 > tmin ? t0 : tmin;
+            tmax = t1 < tmax ? t1 : tmax;
+            if (tmax <= tmin) return false;
+        }
+        return true;
+    }
+
+    COMMON_FUNC Vector3<T> centroid() const { return static_cast<T>(0.5) * (m_min + m_max); }
+
+    COMMON_FUNC T surfaceArea() const
+    {
+        const Vector3<T> d = m_max - m_min;
+        return 2 * (d.x() * d.y() + d.x() * d.z() + d.y() * d.z());
+    }
+
+    // Index of the longest axis of the box.
+    COMMON_FUNC int maximumExtent() const
+    {
+        const Vector3<T> d = m_max - m_min;
+        if (d.x() > d.y() && d.x() > d.z())
+            return 0;
+        else if (d.y() > d.z())
+            return 1;
+        return 2;
+    }
+
+    COMMON_FUNC bool contains(const AABB<T>& box) const
+    {
+        for (int a = 0; a < 3; a++)
+        {
+            if (box.m_min[a] < m_min[a] || box.m_max[a] > m_max[a]) return false;
+        }
+        return true;
+    }
+
     COMMON_FUNC bool hit(const Ray<T>& r, T tmin, T tmax) const
     {
         for (int a = 0; a < 3; a++)
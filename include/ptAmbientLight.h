@@ -67,7 +67,7 @@ public:
         if (pStream == nullptr)
             return false;
 
-        bool ok = color.serialize(pStream);
+        bool ok = color.deserialize(pStream);
 
         return ok;
     }
@@ -0,0 +1,134 @@
+/*
+ * CUDA (GPU) Pathtracer based on Peter Shirley's 'Ray Tracing in One Weekend' e-book
+ * series.
+ *
+ * Copyright (C) 2017 by Rick Weyrauch - rpweyrauch@gmail.com
+ *
+ * This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+ */
+
+#ifndef PATHTRACER_ARENA_H
+#define PATHTRACER_ARENA_H
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include "ptCudaCommon.h"
+
+class ArenaObject;
+
+//
+// Bump allocator for the objects of one scene (hitables, materials and textures).
+// While an arena is bound to a thread with SceneArena::Scope, every ArenaObject that
+// thread creates with new is carved out of the arena's chunks, so a scene is laid out
+// contiguously in creation order.  Destroying or releasing the arena runs the
+// destructors of the objects still alive, in reverse order, and frees the chunks at once.
+//
+// Host only: objects created on the device always come from the device heap.
+//
+class SceneArena
+{
+public:
+    explicit SceneArena(size_t chunkSize = 256 * 1024);
+    ~SceneArena();
+
+    SceneArena(const SceneArena&) = delete;
+    SceneArena& operator=(const SceneArena&) = delete;
+
+    // Destroys every object in the arena and frees its memory.  The arena can be reused.
+    void release();
+
+    size_t bytesAllocated() const { return m_bytesAllocated; }
+    size_t bytesReserved() const { return m_bytesReserved; }
+    int objectCount() const { return m_numObjects; }
+
+    // Arena used for new objects on this thread, or nullptr.
+    static SceneArena* current();
+
+    // Binds an arena to the calling thread for its lifetime; the previous binding is
+    // restored on exit.
+    class Scope
+    {
+    public:
+        explicit Scope(SceneArena* arena);
+        ~Scope();
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+    private:
+        SceneArena* m_previous;
+    };
+
+private:
+    friend class ArenaObject;
+
+    // Precedes every ArenaObject.  Objects from the heap have no arena.
+    struct alignas(16) Header
+    {
+        SceneArena* arena;
+        Header* next;       // previously allocated object of the same arena
+        bool destroyed;     // deleted explicitly before the arena was released
+    };
+
+    struct Chunk
+    {
+        Chunk* next;
+        size_t size;
+        size_t used;
+    };
+
+    Header* allocate(size_t size);
+
+    // Host memory of an ArenaObject: from the arena bound to the thread, or else from
+    // ::operator new, which freeObject pairs with ::operator delete.
+    static void* allocateObject(size_t size);
+    static void freeObject(void* p);
+
+    size_t m_chunkSize;
+    Chunk* m_chunks = nullptr;
+    Header* m_objects = nullptr;
+    int m_numObjects = 0;
+    size_t m_bytesAllocated = 0;
+    size_t m_bytesReserved = 0;
+};
+
+//
+// Base of the classes whose instances make up a scene.  new takes the memory from the
+// arena bound to the thread, if any; delete on an object in an arena only runs its
+// destructor, the memory is returned when the arena is released.  It must be the first
+// base class, at offset zero of the object.
+//
+class ArenaObject
+{
+public:
+    COMMON_FUNC ArenaObject() {}
+    COMMON_FUNC virtual ~ArenaObject() {}
+
+    COMMON_FUNC static void* operator new(size_t size)
+    {
+#ifndef __CUDA_ARCH__
+        return SceneArena::allocateObject(size);
+#else
+        SceneArena::Header* header = static_cast<SceneArena::Header*>(malloc(sizeof(SceneArena::Header) + size));
+        if (header == nullptr)
+            return nullptr;
+        header->arena = nullptr;
+        header->next = nullptr;
+        header->destroyed = false;
+        return header + 1;
+#endif
+    }
+
+    COMMON_FUNC static void operator delete(void* p)
+    {
+#ifndef __CUDA_ARCH__
+        SceneArena::freeObject(p);
+#else
+        if (p != nullptr)
+            free(static_cast<SceneArena::Header*>(p) - 1);
+#endif
+    }
+};
+
+#endif //PATHTRACER_ARENA_H
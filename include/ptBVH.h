@@ -10,16 +10,98 @@
 #ifndef PATHTRACER_BVH_H
 #define PATHTRACER_BVH_H
 
+#include <vector>
 #include "ptCudaCommon.h"
 #include "ptHitable.h"
 #include "ptAABB.h"
+#include "ptPrimitive.h"
+
+enum BVHBuildMethod
+{
+    BVHBuildMedian,     // Fast build: split at the centroid median of the widest axis.
+    BVHBuildSAH,        // Binned surface area heuristic over all three axes.
+    BVHBuildLBVH,       // Parallel Morton code (linear BVH) build for very large inputs.
+    BVHBuildLBVHTreelet // LBVH followed by SAH treelet restructuring.
+};
+
+// Relative costs used by the surface area heuristic.
+const float BVH_TRAVERSAL_COST = 0.125f;
+const float BVH_INTERSECT_COST = 1.0f;
+
+// Cost of a leaf whose primitives are intersected packetWidth at a time.
+inline float BVHLeafCost(int numPrims, int packetWidth)
+{
+    return BVH_INTERSECT_COST * ((numPrims + packetWidth - 1) / packetWidth);
+}
+
+struct BVHPrimitiveInfo
+{
+    BVHPrimitiveInfo() {}
+    BVHPrimitiveInfo(int i, const AABB<float>& b) :
+        index(i),
+        bounds(b),
+        centroid(b.centroid()) {}
+
+    int index;
+    AABB<float> bounds;
+    Vector3f centroid;
+};
+
+struct BVHBuildNode
+{
+    AABB<float> bounds;
+    BVHBuildNode* children[2] = { nullptr, nullptr };
+    int splitAxis = 0;
+    int firstPrimOffset = 0;
+    int numPrims = 0;
+};
+
+// Depth-first flattened node.  The first child of an interior node immediately
+// follows its parent, the second child is at secondChildOffset.
+struct LinearBVHNode
+{
+    AABB<float> bounds;
+    union
+    {
+        uint32_t primitivesOffset;  // leaf
+        uint32_t secondChildOffset; // interior
+    };
+    uint16_t numPrims;              // 0 -> interior node
+    uint8_t axis;                   // interior node: split axis
+    uint8_t pad;
+};
+
+// Maximum depth of a flattened tree (size of the traversal stack).
+const int BVH_MAX_DEPTH = 64;
+
+// A refit tree is rebuilt once its SAH cost exceeds the cost after the last build by this factor.
+const float BVH_REFIT_REBUILD_RATIO = 1.5f;
+
+// Builds a tree over the primitive bounds with the given method.  primInfo is reordered
+// into leaf order: leaf primitive i is primInfo[i].index.  Returns the SAH cost.  Leaves
+// are priced as intersecting packetWidth primitives for the cost of one.
+float BuildBVHNodes(std::vector<BVHPrimitiveInfo>& primInfo, BVHBuildMethod method, int maxPrimsInLeaf, std::vector<LinearBVHNode>& nodes,
+                    int packetWidth = 1);
+
+// Parallel LBVH build behind BuildBVHNodes (src/ptLBVH.cu).  Returns false, leaving
+// primInfo untouched, if the tree is deeper than BVH_MAX_DEPTH.
+bool BuildLBVHNodes(std::vector<BVHPrimitiveInfo>& primInfo, bool optimizeTreelets, int maxPrimsInLeaf,
+                    std::vector<LinearBVHNode>& nodes, float* sahCost, int packetWidth = 1);
 
 class BVH : public Hitable
 {
 public:
     COMMON_FUNC BVH() {}
 
-    COMMON_FUNC BVH(Hitable** list, int length, float time0, float time1, RNG& rng);
+    BVH(Hitable** list, int length, float time0, float time1, BVHBuildMethod method = BVHBuildSAH, int maxPrimsInLeaf = 4);
+
+    COMMON_FUNC ~BVH() override
+    {
+        delete[] m_prims;
+        delete[] m_records;
+        if (!m_arraysInStream)
+            delete[] m_nodes;
+    }
 
     COMMON_FUNC bool hit(const Rayf& r, float tmin, float tmax, HitRecord& rec, RNG& rng) const override;
     COMMON_FUNC bool bounds(float t0, float t1, AABB<float>& bbox) const override;
@@ -33,10 +115,40 @@ public:
 
     COMMON_FUNC int typeId() const override { return BVHTypeId; }
 
+    // Expected cost of tracing a ray through the tree, relative to the cost of one
+    // primitive intersection (surface area heuristic).
+    float sahCost() const { return m_sahCost; }
+    float buildSahCost() const { return m_buildSahCost; }
+    int nodeCount() const { return m_numNodes; }
+    const LinearBVHNode* nodes() const { return m_nodes; }
+
+    COMMON_FUNC int primitiveCount() const { return m_numPrims; }
+    COMMON_FUNC Hitable* const* primitives() const { return m_prims; }
+
+    // Recompute the node bounds bottom-up after the primitives moved, keeping the
+    // topology.  When the refit SAH cost exceeds rebuildRatio times the cost of the last
+    // build the tree is rebuilt instead.  Returns true if the tree was rebuilt.
+    bool refit(float time0, float time1, float rebuildRatio = BVH_REFIT_REBUILD_RATIO);
+    void rebuild(float time0, float time1);
+
 private:
-    Hitable* left = nullptr;
-    Hitable* right = nullptr;
-    AABB<float> m_bbox;
+
+    void build(Hitable** list, int length, float time0, float time1);
+
+    BVHBuildMethod m_method = BVHBuildSAH;
+    int m_maxPrimsInLeaf = 4;
+
+    Hitable** m_prims = nullptr;
+    // Tagged copies of m_prims, intersected in the leaves.
+    Primitive* m_records = nullptr;
+    int m_numPrims = 0;
+
+    LinearBVHNode* m_nodes = nullptr;
+    int m_numNodes = 0;
+    // m_nodes is in the buffer of the stream the tree was read from.
+    bool m_arraysInStream = false;
+    float m_sahCost = 0;
+    float m_buildSahCost = 0;
 };
 
 
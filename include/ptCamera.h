@@ -10,7 +10,6 @@
 #ifndef PATHTRACER_CAMERA_H
 #define PATHTRACER_CAMERA_H
 
-#include <math_constants.h>
 #include "ptCudaCommon.h"
 #include "ptMaterial.h"
 #include "ptVector3.h"
@@ -10,7 +10,34 @@
 #ifndef PATHTRACER_CUDACOMMON_H
 #define PATHTRACER_CUDACOMMON_H
 
+#ifdef PT_CPU_ONLY
+
+//
+// Host-only build (no CUDA toolkit).  Provide the small subset of the CUDA
+// definitions used by the renderer.
+//
+#include <cstdlib>
+
+#define COMMON_FUNC
+
+#define CUDART_PI_F 3.141592654f
+
+struct float3
+{
+    float x, y, z;
+};
+
+inline float3 make_float3(float x, float y, float z)
+{
+    float3 v = { x, y, z };
+    return v;
+}
+
+#else
+
 #include <cuda.h>
+#include <math_constants.h>
+#include <math_functions.h>
 
 #ifdef __CUDACC__
 #define COMMON_FUNC __host__ __device__
@@ -18,6 +45,17 @@
 #define COMMON_FUNC
 #endif
 
+#endif // PT_CPU_ONLY
+
+// Width of the primitive packets (triangles, spheres) intersected together in BVH
+// leaves.  CUDA builds keep 4 so that the serialized layout is the same for the host and
+// the device.
+#if defined(__AVX__) && !defined(__CUDACC__)
+const int PRIMITIVE_PACKET_WIDTH = 8;
+#else
+const int PRIMITIVE_PACKET_WIDTH = 4;
+#endif
+
 inline int IDIVUP(int numer, int denom)
 {
     return ((numer) % (denom) != 0) ? ((numer) / (denom) + 1) : ((numer) / (denom));
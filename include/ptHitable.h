@@ -15,6 +15,7 @@
 #include "ptVector2.h"
 #include "ptRay.h"
 #include "ptAABB.h"
+#include "ptArena.h"
 
 class Material;
 class RNG;
@@ -25,7 +26,7 @@ struct HitRecord
     float t;
     Vector3f p;
     Vector3f normal;
-    Material* material;
+    uint32_t material;  // index into the scene's MaterialTable
     Vector2f uv;
 };
 
@@ -45,16 +46,31 @@ enum HitableTypeId
   MediumTypeId, // = MakeFourCC('C','M','E','D'),
   BVHTypeId, // = MakeFourCC('B','V','H',' '),
   TriangleTypeId, // = MakeFourCC('T','R','I',' '),
-  TriMeshTypeId // = MakeFourCC('M','E','S','H')
+  TriMeshTypeId, // = MakeFourCC('M','E','S','H')
+  BVH4TypeId, // = MakeFourCC('B','V','H','4'),
+  BVH8TypeId, // = MakeFourCC('B','V','H','8'),
+  InstanceTypeId, // = MakeFourCC('I','N','S','T'),
+  InstanceBVHTypeId, // = MakeFourCC('T','L','A','S'),
+  MotionBVHTypeId, // = MakeFourCC('M','B','V','H'),
+  SphereSetTypeId // = MakeFourCC('S','S','E','T')
 };
 
-class Hitable
+class Hitable : public ArenaObject
 {
 public:
     COMMON_FUNC Hitable() {}
     COMMON_FUNC virtual ~Hitable() {}
     COMMON_FUNC virtual bool hit(const Rayf& r, float t_min, float t_max, HitRecord& rec, RNG& rng) const = 0;
     COMMON_FUNC virtual bool bounds(float t0, float t1, AABB<float>& bbox) const = 0;
+    // Bounds at t0 and t1 whose linear interpolation encloses the object at every time in
+    // between.  Defaults to the box swept over [t0, t1] at both ends.
+    COMMON_FUNC virtual bool motionBounds(float t0, float t1, AABB<float>& bbox0, AABB<float>& bbox1) const
+    {
+        if (!bounds(t0, t1, bbox0))
+            return false;
+        bbox1 = bbox0;
+        return true;
+    }
     COMMON_FUNC virtual float pdfValue(const Vector3f& o, const Vector3f& v, RNG& rng) const { return 0; }
     COMMON_FUNC virtual Vector3f random(const Vector3f& o, RNG& rng) const { return Vector3f(1, 0, 0); }
     COMMON_FUNC virtual bool serialize(Stream* pStream) const = 0;
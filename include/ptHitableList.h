@@ -14,13 +14,16 @@
 #include "ptHitable.h"
 #include "ptRNG.h"
 
+struct Primitive;
+
 class HitableList : public Hitable {
 public:
     COMMON_FUNC HitableList() {}
 
-    COMMON_FUNC HitableList(int c, Hitable** l) :
-        count(c),
-        list(l) {}
+    // Takes ownership of the array l (but not of the items).
+    COMMON_FUNC HitableList(int c, Hitable** l);
+
+    COMMON_FUNC ~HitableList() override;
 
     COMMON_FUNC bool hit(const Rayf& r, float tmin, float tmax, HitRecord& rec, RNG& rng) const override;
 
@@ -48,9 +51,15 @@ public:
 
     COMMON_FUNC int typeId() const override { return ListTypeId; }
 
+    int size() const { return count; }
+    Hitable* const* items() const { return list; }
+    void setItem(int i, Hitable* item);
+
 private:
     int count = 0;
     Hitable** list = nullptr;
+    // Tagged copies of the items for hit().
+    Primitive* prims = nullptr;
 };
 
 #endif //PATHTRACER_HITABLELIST_H
\ No newline at end of file
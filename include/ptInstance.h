@@ -0,0 +1,128 @@
+/*
+ * CUDA (GPU) Pathtracer based on Peter Shirley's 'Ray Tracing in One Weekend' e-book
+ * series.
+ *
+ * Copyright (C) 2017 by Rick Weyrauch - rpweyrauch@gmail.com
+ *
+ * This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+ */
+
+#ifndef PATHTRACER_INSTANCE_H
+#define PATHTRACER_INSTANCE_H
+
+#include "ptCudaCommon.h"
+#include "ptHitable.h"
+#include "ptBVH.h"
+#include "ptTransform.h"
+
+//
+// A placement of shared geometry (usually a BVH) with an affine transform.  Rays are
+// taken into object space with the cached inverse, so the object-space t is the
+// world-space t and the geometry is never copied.
+//
+class Instance : public Hitable
+{
+public:
+    COMMON_FUNC Instance() {}
+
+    Instance(Hitable* geometry, const Transform& toWorld);
+
+    COMMON_FUNC bool hit(const Rayf& r, float tmin, float tmax, HitRecord& rec, RNG& rng) const override;
+
+    COMMON_FUNC bool bounds(float t0, float t1, AABB<float>& bbox) const override
+    {
+        bbox = m_bbox;
+        return m_hasBox;
+    }
+
+    COMMON_FUNC float pdfValue(const Vector3f& o, const Vector3f& v, RNG& rng) const override;
+    COMMON_FUNC Vector3f random(const Vector3f& o, RNG& rng) const override;
+
+    COMMON_FUNC bool serialize(Stream* pStream) const override;
+    COMMON_FUNC bool deserialize(Stream *pStream) override;
+
+    COMMON_FUNC int typeId() const override { return InstanceTypeId; }
+
+    Hitable* geometry() const { return m_geometry; }
+
+    // Move the instance; the owning InstanceBVH must be refit afterwards.
+    void setTransform(const Transform& toWorld);
+
+    // Instances owned by an InstanceBVH serialize an index into its geometry table
+    // instead of the geometry itself (-1 -> serialize the geometry inline).
+    COMMON_FUNC int geometryIndex() const { return m_geometryIndex; }
+    COMMON_FUNC void bindGeometry(int index, Hitable* geometry)
+    {
+        m_geometryIndex = index;
+        m_geometry = geometry;
+    }
+
+private:
+    Hitable* m_geometry = nullptr;
+    int m_geometryIndex = -1;
+
+    Transform m_toWorld;
+    Transform m_toObject;
+
+    AABB<float> m_bbox;
+    bool m_hasBox = false;
+};
+
+//
+// Two-level acceleration structure: a top-level BVH over instance bounds, with every
+// distinct piece of instanced geometry stored (and serialized) once.
+//
+class InstanceBVH : public Hitable
+{
+public:
+    COMMON_FUNC InstanceBVH() {}
+
+    InstanceBVH(Instance** instances, int numInstances, float time0, float time1, BVHBuildMethod method = BVHBuildSAH);
+
+    COMMON_FUNC ~InstanceBVH() override
+    {
+        delete[] m_geometry;
+    }
+
+    COMMON_FUNC bool hit(const Rayf& r, float tmin, float tmax, HitRecord& rec, RNG& rng) const override
+    {
+        return m_tlas->hit(r, tmin, tmax, rec, rng);
+    }
+
+    COMMON_FUNC bool bounds(float t0, float t1, AABB<float>& bbox) const override
+    {
+        return m_tlas->bounds(t0, t1, bbox);
+    }
+
+    COMMON_FUNC float pdfValue(const Vector3f& o, const Vector3f& v, RNG& rng) const override
+    {
+        return m_tlas->pdfValue(o, v, rng);
+    }
+
+    COMMON_FUNC Vector3f random(const Vector3f& o, RNG& rng) const override
+    {
+        return m_tlas->random(o, rng);
+    }
+
+    COMMON_FUNC bool serialize(Stream* pStream) const override;
+    COMMON_FUNC bool deserialize(Stream *pStream) override;
+
+    COMMON_FUNC int typeId() const override { return InstanceBVHTypeId; }
+
+    // Refit the top-level tree after instances moved (see BVH::refit).
+    bool refit(float time0, float time1, float rebuildRatio = BVH_REFIT_REBUILD_RATIO)
+    {
+        return m_tlas->refit(time0, time1, rebuildRatio);
+    }
+
+    int geometryCount() const { return m_numGeometry; }
+    int instanceCount() const { return m_tlas->primitiveCount(); }
+
+private:
+    Hitable** m_geometry = nullptr;
+    int m_numGeometry = 0;
+
+    BVH* m_tlas = nullptr;
+};
+
+#endif //PATHTRACER_INSTANCE_H
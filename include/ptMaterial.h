@@ -10,7 +10,6 @@
 #ifndef PATHTRACER_MATERIAL_H
 #define PATHTRACER_MATERIAL_H
 
-#include <math_constants.h>
 #include "ptCudaCommon.h"
 #include "ptRNG.h"
 #include "ptVector3.h"
@@ -18,6 +17,7 @@
 #include "ptHitable.h"
 #include "ptTexture.h"
 #include "ptPDF.h"
+#include "ptArena.h"
 
 struct ScatterRecord
 {
@@ -45,7 +45,7 @@ enum MaterialTypeId
   IsotropicTypeId = MakeFourCC('I','S','O','T')
 };
 
-class Material
+class Material : public ArenaObject
 {
 public:
     COMMON_FUNC virtual ~Material() {}
@@ -57,9 +57,25 @@ public:
     COMMON_FUNC virtual bool deserialize(Stream *pStream) = 0;
     COMMON_FUNC virtual int typeId() const = 0;
 
+    // Index in the MaterialTable the material was loaded into, written to hit records.
+    COMMON_FUNC uint32_t index() const { return m_index; }
+    COMMON_FUNC void setIndex(uint32_t index) { m_index = index; }
+
     COMMON_FUNC static Material* Create(Stream* pStream);
+
+private:
+    uint32_t m_index = 0;
 };
 
+// Hit record index of shapes without a material, such as the light shapes that are only
+// sampled for direct lighting.  MaterialTable treats it as a black, non-scattering surface.
+const uint32_t NoMaterialIndex = 0xffffffffu;
+
+COMMON_FUNC inline uint32_t MaterialIndex(const Material* material)
+{
+    return (material != nullptr) ? material->index() : NoMaterialIndex;
+}
+
 class Lambertian : public Material
 {
 public:
@@ -88,6 +104,8 @@ public:
     {
         if (pStream == nullptr)
             return false;
+        if (pStream->writeReference(this))
+            return true;
 
         const int id = typeId();
         bool ok = pStream->write(&id, sizeof(id));
@@ -146,6 +164,8 @@ public:
     {
         if (pStream == nullptr)
             return false;
+        if (pStream->writeReference(this))
+            return true;
 
         const int id = typeId();
         bool ok = pStream->write(&id, sizeof(id));
@@ -227,6 +247,8 @@ public:
     {
         if (pStream == nullptr)
             return false;
+        if (pStream->writeReference(this))
+            return true;
 
         const int id = typeId();
         bool ok = pStream->write(&id, sizeof(id));
@@ -275,6 +297,8 @@ public:
     {
         if (pStream == nullptr)
             return false;
+        if (pStream->writeReference(this))
+            return true;
 
         const int id = typeId();
         bool ok = pStream->write(&id, sizeof(id));
@@ -333,6 +357,8 @@ public:
     {
         if (pStream == nullptr)
             return false;
+        if (pStream->writeReference(this))
+            return true;
 
         const int id = typeId();
         bool ok = pStream->write(&id, sizeof(id));
@@ -0,0 +1,114 @@
+/*
+ * CUDA (GPU) Pathtracer based on Peter Shirley's 'Ray Tracing in One Weekend' e-book
+ * series.
+ *
+ * Copyright (C) 2017 by Rick Weyrauch - rpweyrauch@gmail.com
+ *
+ * This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+ */
+
+#ifndef PATHTRACER_MATERIALTABLE_H
+#define PATHTRACER_MATERIALTABLE_H
+
+#include "ptCudaCommon.h"
+#include "ptMaterial.h"
+
+//
+// Flat table of the materials of a scene, referenced from hit records by index.  The
+// type of every entry is stored next to it so that shading switches on MaterialTypeId
+// and calls the material directly instead of through its vtable.  Once sorted, entries
+// of the same type are adjacent, so work can be ordered by material index.
+//
+// Materials are added as they are deserialized (see Stream::setMaterialTable).  The
+// table does not own them.
+//
+class MaterialTable
+{
+public:
+    COMMON_FUNC MaterialTable() {}
+
+    COMMON_FUNC ~MaterialTable()
+    {
+        delete[] m_materials;
+        delete[] m_types;
+    }
+
+    // Appends material and sets its index.
+    COMMON_FUNC void add(Material* material);
+
+    // Stable sort of the entries by type; every material gets its new index.
+    COMMON_FUNC void sortByType();
+
+    COMMON_FUNC int size() const { return m_count; }
+    COMMON_FUNC const Material* material(uint32_t index) const { return m_materials[index]; }
+    COMMON_FUNC int type(uint32_t index) const { return m_types[index]; }
+
+    COMMON_FUNC bool scatter(const Rayf& r_in, const HitRecord& rec, ScatterRecord& srec, RNG& rng) const
+    {
+        if (rec.material == NoMaterialIndex)
+            return false;
+        const Material* material = m_materials[rec.material];
+        switch (m_types[rec.material])
+        {
+            case LambertianTypeId:
+                return static_cast<const Lambertian*>(material)->Lambertian::scatter(r_in, rec, srec, rng);
+            case MetalTypeId:
+                return static_cast<const Metal*>(material)->Metal::scatter(r_in, rec, srec, rng);
+            case DielectricTypeId:
+                return static_cast<const Dielectric*>(material)->Dielectric::scatter(r_in, rec, srec, rng);
+            case DiffuseLightTypeId:
+                return static_cast<const DiffuseLight*>(material)->DiffuseLight::scatter(r_in, rec, srec, rng);
+            case IsotropicTypeId:
+                return static_cast<const Isotropic*>(material)->Isotropic::scatter(r_in, rec, srec, rng);
+            default:
+                return material->scatter(r_in, rec, srec, rng);
+        }
+    }
+
+    COMMON_FUNC float scatteringPdf(const Rayf& r_in, const HitRecord& rec, const Rayf& scattered) const
+    {
+        if (rec.material == NoMaterialIndex)
+            return 0;
+        const Material* material = m_materials[rec.material];
+        switch (m_types[rec.material])
+        {
+            case LambertianTypeId:
+                return static_cast<const Lambertian*>(material)->Lambertian::scatteringPdf(r_in, rec, scattered);
+            case IsotropicTypeId:
+                return static_cast<const Isotropic*>(material)->Isotropic::scatteringPdf(r_in, rec, scattered);
+            case MetalTypeId:
+            case DielectricTypeId:
+            case DiffuseLightTypeId:
+                return 0;
+            default:
+                return material->scatteringPdf(r_in, rec, scattered);
+        }
+    }
+
+    COMMON_FUNC Vector3f emitted(const Rayf& r_in, const HitRecord& rec, const Vector2f& uv, const Vector3f& p) const
+    {
+        if (rec.material == NoMaterialIndex)
+            return Vector3f(0, 0, 0);
+        const Material* material = m_materials[rec.material];
+        switch (m_types[rec.material])
+        {
+            case DiffuseLightTypeId:
+                return static_cast<const DiffuseLight*>(material)->DiffuseLight::emitted(r_in, rec, uv, p);
+            case LambertianTypeId:
+            case MetalTypeId:
+            case DielectricTypeId:
+            case IsotropicTypeId:
+                return Vector3f(0, 0, 0);
+            default:
+                return material->emitted(r_in, rec, uv, p);
+        }
+    }
+
+private:
+    Material** m_materials = nullptr;
+    int* m_types = nullptr;
+    int m_count = 0;
+    int m_capacity = 0;
+};
+
+#endif //PATHTRACER_MATERIALTABLE_H
@@ -46,7 +46,7 @@ public:
                     rec.t = rec1.t + hitDist / r_in.direction().length();
                     rec.p = r_in.pointAt(rec.t);
                     rec.normal = Vector3f(1, 0, 0);
-                    rec.material = phaseFunction;
+                    rec.material = phaseFunction->index();
                     return true;
                 }
             }
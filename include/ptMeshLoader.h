@@ -0,0 +1,98 @@
+/*
+ * CUDA (GPU) Pathtracer based on Peter Shirley's 'Ray Tracing in One Weekend' e-book
+ * series.
+ *
+ * Copyright (C) 2017 by Rick Weyrauch - rpweyrauch@gmail.com
+ *
+ * This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+ */
+
+#ifndef PATHTRACER_MESHLOADER_H
+#define PATHTRACER_MESHLOADER_H
+
+#include <string>
+#include <vector>
+#include <cstddef>
+#include "ptBVH.h"
+
+class Hitable;
+class TriangleMesh;
+class Material;
+
+//
+// Read-only memory mapping of a whole file (host only).
+//
+class MappedFile
+{
+public:
+    MappedFile() {}
+    ~MappedFile() { close(); }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool open(const std::string& filename);
+    void close();
+
+    const char* data() const { return m_data; }
+    size_t size() const { return m_size; }
+
+private:
+    const char* m_data = nullptr;
+    size_t m_size = 0;
+};
+
+struct MeshLoadStats
+{
+    int numPositions = 0;
+    int numTexCoords = 0;
+    int numNormals = 0;
+    int numFaces = 0;
+    int numVertices = 0;    // unique position/texcoord/normal combinations
+    int numTriangles = 0;
+    int buffersViewed = 0;  // vertex/index buffers used in place in the mapped file
+    int buffersCopied = 0;  // buffers that needed conversion
+    std::vector<std::string> files; // every file the mesh was read from
+};
+
+//
+// Wavefront OBJ importer.  The mapped file is split into chunks at line boundaries that
+// are parsed in parallel; v/vt/vn index triples are deduplicated into mesh vertices and
+// polygons are triangulated as fans.  Only geometry is read (no groups or materials).
+//
+// Returns a completed mesh, or nullptr if the file cannot be read or has no faces.
+//
+TriangleMesh* LoadOBJ(const std::string& filename, Material* material, BVHBuildMethod method = BVHBuildSAH,
+                      MeshLoadStats* stats = nullptr);
+
+//
+// Binary PLY importer (src/ptBinaryMeshLoader.cpp).  The file stays mapped for the life
+// of the mesh: float x/y/z, nx/ny/nz and u/v (or s/t) vertex properties are used in
+// place whatever the vertex stride, as are faces stored as a uchar count of 3 followed
+// by int indices.  Other layouts, polygons and big endian files are converted.
+//
+TriangleMesh* LoadPLY(const std::string& filename, Material* material, BVHBuildMethod method = BVHBuildSAH,
+                      MeshLoadStats* stats = nullptr);
+
+//
+// glTF 2.0 importer for .glb and .gltf files with binary buffers.  Every triangle
+// primitive becomes a mesh; float positions/normals and 32-bit indices are used in place
+// in the mapped buffers, other component types are converted.  Nodes with a transform
+// instance their meshes.  Returns a HitableList, or nullptr if nothing could be loaded.
+//
+Hitable* LoadGLTF(const std::string& filename, Material* material, BVHBuildMethod method = BVHBuildSAH,
+                  MeshLoadStats* stats = nullptr);
+
+// The .glb or .gltf file and the external buffer files LoadGLTF reads for it, found
+// from its JSON alone.
+std::vector<std::string> GltfInputFiles(const std::string& filename);
+
+// Chooses the importer from the file extension (.obj, .ply, .glb or .gltf).
+Hitable* LoadMesh(const std::string& filename, Material* material, BVHBuildMethod method = BVHBuildSAH,
+                  MeshLoadStats* stats = nullptr);
+
+// Every file LoadMesh reads for filename (MeshLoadStats::files) without loading it, for
+// keying anything derived from the mesh.
+std::vector<std::string> MeshInputFiles(const std::string& filename);
+
+#endif //PATHTRACER_MESHLOADER_H
@@ -0,0 +1,143 @@
+/*
+ * CUDA (GPU) Pathtracer based on Peter Shirley's 'Ray Tracing in One Weekend' e-book
+ * series.
+ *
+ * Copyright (C) 2017 by Rick Weyrauch - rpweyrauch@gmail.com
+ *
+ * This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+ */
+
+#ifndef PATHTRACER_MOTIONBVH_H
+#define PATHTRACER_MOTIONBVH_H
+
+#include <vector>
+#include "ptCudaCommon.h"
+#include "ptHitable.h"
+#include "ptAABB.h"
+#include "ptBVH.h"
+
+// Split axis value of a node whose children cover the two halves of its time interval.
+const uint8_t MOTION_BVH_TEMPORAL_SPLIT = 3;
+
+// Default number of temporal splits allowed along any path from the root.
+const int MOTION_BVH_MAX_TEMPORAL_SPLITS = 4;
+
+// Factor by which a motion BVH must lower the SAH cost of the BVH over the shutter
+// bounds to be used instead.  Its nodes are twice the size and interpolated per ray,
+// which the SAH does not price: on the benchmark it is slower at a cost ratio of 2 and
+// faster from about 3.5 on.
+const float MOTION_BVH_MIN_SAH_GAIN = 3.0f;
+
+//
+// Node with bounds at the start and end of its time interval.  A ray tests the box
+// linearly interpolated to its own time.
+//
+struct MotionBVHNode
+{
+    AABB<float> bounds0;
+    AABB<float> bounds1;
+    float time0, time1;
+    union
+    {
+        uint32_t primitivesOffset;  // leaf: into the primitive index array
+        uint32_t secondChildOffset; // interior
+    };
+    uint16_t numPrims;              // 0 -> interior node
+    uint8_t axis;                   // split axis or MOTION_BVH_TEMPORAL_SPLIT
+    uint8_t pad;
+
+    COMMON_FUNC AABB<float> boundsAt(float time) const
+    {
+        float u = (time1 > time0) ? (time - time0) / (time1 - time0) : 0;
+        u = Clamp(u, 0.0f, 1.0f);
+        return AABB<float>((1 - u) * bounds0.min() + u * bounds1.min(), (1 - u) * bounds0.max() + u * bounds1.max());
+    }
+};
+
+class MotionBVH : public Hitable
+{
+public:
+    COMMON_FUNC MotionBVH() {}
+
+    MotionBVH(Hitable** list, int length, float time0, float time1, int maxTemporalSplits = MOTION_BVH_MAX_TEMPORAL_SPLITS,
+              int maxPrimsInLeaf = 4);
+
+    COMMON_FUNC ~MotionBVH() override
+    {
+        delete[] m_prims;
+        delete[] m_records;
+        if (!m_arraysInStream)
+        {
+            delete[] m_primIndices;
+            delete[] m_nodes;
+        }
+    }
+
+    COMMON_FUNC bool hit(const Rayf& r, float tmin, float tmax, HitRecord& rec, RNG& rng) const override;
+    COMMON_FUNC bool bounds(float t0, float t1, AABB<float>& bbox) const override;
+    COMMON_FUNC bool motionBounds(float t0, float t1, AABB<float>& bbox0, AABB<float>& bbox1) const override;
+
+    COMMON_FUNC float pdfValue(const Vector3f& o, const Vector3f& v, RNG& rng) const override;
+    COMMON_FUNC Vector3f random(const Vector3f& o, RNG& rng) const override;
+
+    COMMON_FUNC bool serialize(Stream* pStream) const override;
+    COMMON_FUNC bool deserialize(Stream *pStream) override;
+
+    COMMON_FUNC int typeId() const override { return MotionBVHTypeId; }
+
+    // Time averaged SAH cost of a ray through the bounds swept over the time interval,
+    // relative to the cost of one primitive intersection; compares with BVH::sahCost of
+    // a tree over the same primitives.
+    float sahCost() const { return m_sahCost; }
+    int nodeCount() const { return m_numNodes; }
+    int temporalSplitCount() const { return m_numTemporalSplits; }
+
+private:
+
+    struct PrimitiveInfo
+    {
+        int index;
+        AABB<float> bounds0, bounds1;
+        AABB<float> midBounds;      // bounds at the middle of the node's interval
+        Vector3f centroid;          // of midBounds
+    };
+
+    struct BuildNode
+    {
+        AABB<float> bounds0, bounds1;
+        float time0, time1;
+        BuildNode* children[2] = { nullptr, nullptr };
+        int axis = 0;
+        int firstPrimOffset = 0;
+        int numPrims = 0;
+    };
+
+    void primitiveInfo(Hitable** list, const int* indices, int count, float time0, float time1, std::vector<PrimitiveInfo>& info) const;
+    BuildNode* recursiveBuild(Hitable** list, std::vector<PrimitiveInfo>& info, int start, int end, float time0, float time1,
+                              int depth, int temporalSplitsLeft, std::vector<int>& primIndices);
+    BuildNode* createLeaf(std::vector<PrimitiveInfo>& info, int start, int end, const AABB<float>& bounds0, const AABB<float>& bounds1,
+                          float time0, float time1, std::vector<int>& primIndices);
+    float computeCost(const BuildNode* node) const;
+    uint32_t flattenTree(const BuildNode* node, uint32_t* offset);
+    void deleteTree(BuildNode* node);
+
+    int m_maxPrimsInLeaf = 4;
+
+    // Every primitive once; leaves index them through m_primIndices, since temporal
+    // splits reference the same primitive from both halves.
+    Hitable** m_prims = nullptr;
+    Primitive* m_records = nullptr;
+    int m_numPrims = 0;
+    int* m_primIndices = nullptr;
+    int m_numPrimIndices = 0;
+
+    MotionBVHNode* m_nodes = nullptr;
+    int m_numNodes = 0;
+    // m_primIndices and m_nodes are in the buffer of the stream the tree was read from.
+    bool m_arraysInStream = false;
+
+    float m_sahCost = 0;
+    int m_numTemporalSplits = 0;
+};
+
+#endif //PATHTRACER_MOTIONBVH_H
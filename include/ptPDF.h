@@ -11,7 +11,6 @@
 #define PATHTRACER_PDF_H
 
 #include <cmath>
-#include <math_constants.h>
 #include "ptVector3.h"
 #include "ptONB.h"
 #include "ptRNG.h"
@@ -0,0 +1,100 @@
+/*
+ * CUDA (GPU) Pathtracer based on Peter Shirley's 'Ray Tracing in One Weekend' e-book
+ * series.
+ *
+ * Copyright (C) 2017 by Rick Weyrauch - rpweyrauch@gmail.com
+ *
+ * This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+ */
+
+#ifndef PATHTRACER_PRIMITIVE_H
+#define PATHTRACER_PRIMITIVE_H
+
+#include "ptCudaCommon.h"
+#include "ptHitable.h"
+#include "ptSphere.h"
+#include "ptRectangle.h"
+
+//
+// Tagged copy of a Hitable for the intersection loops of lists and BVH leaves.  Spheres,
+// moving spheres and axis aligned rectangles (optionally inside FlipNormals) are stored
+// inline and intersected through a switch on their HitableTypeId, so a leaf of mixed
+// primitives costs no indirect call.  Anything else keeps the Hitable and goes through
+// its virtual hit().
+//
+// The inline data is a copy: whoever owns the records rebuilds them when the primitives
+// change.
+//
+struct Primitive
+{
+    int type = NullTypeId;
+    bool flipNormals = false;
+    Material* material = nullptr;
+    const Hitable* hitable = nullptr;
+
+    union
+    {
+        struct
+        {
+            float center[3];
+            float radius;
+        } sphere;
+        struct
+        {
+            float center0[3];
+            float center1[3];
+            float time0, time1;
+            float radius;
+        } movingSphere;
+        struct
+        {
+            float a0, a1, b0, b1, k;
+        } rectangle;
+    };
+};
+
+COMMON_FUNC Primitive MakePrimitive(const Hitable* hitable);
+
+// Records for count hitables, allocated with new[].
+COMMON_FUNC Primitive* CreatePrimitives(Hitable* const* list, int count);
+
+COMMON_FUNC inline bool hitPrimitive(const Primitive& prim, const Rayf& r, float tmin, float tmax, HitRecord& rec, RNG& rng)
+{
+    bool hit = false;
+    switch (prim.type)
+    {
+        case SphereTypeId:
+        {
+            const Vector3f center(prim.sphere.center[0], prim.sphere.center[1], prim.sphere.center[2]);
+            hit = hitSphere(center, prim.sphere.radius, prim.material, r, tmin, tmax, rec);
+            break;
+        }
+        case MovingSphereTypeId:
+        {
+            const Vector3f center0(prim.movingSphere.center0[0], prim.movingSphere.center0[1], prim.movingSphere.center0[2]);
+            const Vector3f center1(prim.movingSphere.center1[0], prim.movingSphere.center1[1], prim.movingSphere.center1[2]);
+            const Vector3f center = movingCenter(center0, center1, prim.movingSphere.time0, prim.movingSphere.time1, r.time());
+            hit = hitSphere(center, prim.movingSphere.radius, prim.material, r, tmin, tmax, rec);
+            break;
+        }
+        case XYRectangleTypeId:
+            hit = hitRectangle<0, 1, 2>(prim.rectangle.a0, prim.rectangle.a1, prim.rectangle.b0, prim.rectangle.b1, prim.rectangle.k,
+                                        prim.material, r, tmin, tmax, rec);
+            break;
+        case XZRectangleTypeId:
+            hit = hitRectangle<0, 2, 1>(prim.rectangle.a0, prim.rectangle.a1, prim.rectangle.b0, prim.rectangle.b1, prim.rectangle.k,
+                                        prim.material, r, tmin, tmax, rec);
+            break;
+        case YZRectangleTypeId:
+            hit = hitRectangle<1, 2, 0>(prim.rectangle.a0, prim.rectangle.a1, prim.rectangle.b0, prim.rectangle.b1, prim.rectangle.k,
+                                        prim.material, r, tmin, tmax, rec);
+            break;
+        default:
+            return prim.hitable->hit(r, tmin, tmax, rec, rng);
+    }
+    if (hit && prim.flipNormals)
+        rec.normal = -rec.normal;
+    return hit;
+}
+
+#endif //PATHTRACER_PRIMITIVE_H
@@ -10,8 +10,6 @@
 #define PATHTRACER_RNG_H
 
 #include <cstdlib>
-#include <math_constants.h>
-#include <math_functions.h>
 #include "ptCudaCommon.h"
 #include "ptVector3.h"
 #include "ptStream.h"
@@ -133,6 +131,47 @@ private:
     uint64_t state, inc;
 };
 
+/*!
+ * Counter based random numbers: dimension d of sample s of pixel p is a hash of
+ * (p, s, d), with no state carried between samples.  A sample therefore draws the same
+ * numbers on any thread and in any order, and renders do not depend on scheduling.
+ *
+ * The (pixel, sample) key is scrambled once; each number is the SplitMix64 output for
+ * the key advanced by the dimension.
+ */
+class SampleRng : public RNG
+{
+    const float OneMinusEpsilon = 0.99999994f;
+
+public:
+    COMMON_FUNC SampleRng(uint32_t pixel, uint32_t sample) :
+        key(mix((static_cast<uint64_t>(pixel) << 32) | sample)),
+        dimension(0)
+    {}
+
+    COMMON_FUNC float rand() override
+    {
+        const uint32_t bits = static_cast<uint32_t>(mix(key + (++dimension) * 0x9E3779B97F4A7C15ULL) >> 32);
+        return Min(OneMinusEpsilon, bits * 2.3283064365386963e-10f);
+    }
+
+    COMMON_FUNC bool serialize(Stream* pStream) const override
+    {
+        return false;
+    }
+
+private:
+
+    COMMON_FUNC static uint64_t mix(uint64_t z)
+    {
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+    }
+
+    uint64_t key;
+    uint64_t dimension;
+};
 
 COMMON_FUNC inline Vector3f randomInUnitSphere(RNG& rng)
 {
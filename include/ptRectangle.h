@@ -10,7 +10,6 @@
 #ifndef PATHTRACER_RECTANGLE_H
 #define PATHTRACER_RECTANGLE_H
 
-#include <math_constants.h>
 #include <cfloat>
 #include "ptCudaCommon.h"
 #include "ptHitable.h"
@@ -21,6 +20,31 @@
 
 const float RECT_TOLERANCE = 0.0001f;
 
+//
+// Intersection shared by the axis aligned rectangles and the tagged Primitive dispatch.
+// The rectangle spans [a0, a1] x [b0, b1] on axes A and B at coordinate k on axis K and
+// faces +K.
+//
+template <int A, int B, int K>
+COMMON_FUNC inline bool hitRectangle(float a0, float a1, float b0, float b1, float k, Material* material, const Rayf& r_in,
+                                     float t0, float t1, HitRecord& rec)
+{
+    float t = (k - r_in.origin()[K]) / r_in.direction()[K];
+    if (t < t0 || t > t1) return false;
+    float a = r_in.origin()[A] + t * r_in.direction()[A];
+    float b = r_in.origin()[B] + t * r_in.direction()[B];
+    if (a < a0 || a > a1 || b < b0 || b > b1) return false;
+
+    rec.uv.u() = (a - a0) / (a1 - a0);
+    rec.uv.v() = (b - b0) / (b1 - b0);
+    rec.t = t;
+    rec.material = MaterialIndex(material);
+    rec.p = r_in.pointAt(t);
+    rec.normal = Vector3f(K == 0 ? 1 : 0, K == 1 ? 1 : 0, K == 2 ? 1 : 0);
+
+    return true;
+}
+
 class XYRectangle : public Hitable
 {
 public:
@@ -48,6 +72,16 @@ public:
 
     COMMON_FUNC int typeId() const override { return XYRectangleTypeId; }
 
+    COMMON_FUNC Material* getMaterial() const { return material; }
+    COMMON_FUNC void getExtent(float& X0, float& X1, float& Y0, float& Y1, float& K) const
+    {
+        X0 = x0;
+        X1 = x1;
+        Y0 = y0;
+        Y1 = y1;
+        K = k;
+    }
+
 private:
     Material* material;
     float x0, x1, y0, y1, k;
@@ -100,6 +134,16 @@ public:
 
     COMMON_FUNC int typeId() const override { return XZRectangleTypeId; }
 
+    COMMON_FUNC Material* getMaterial() const { return material; }
+    COMMON_FUNC void getExtent(float& X0, float& X1, float& Z0, float& Z1, float& K) const
+    {
+        X0 = x0;
+        X1 = x1;
+        Z0 = z0;
+        Z1 = z1;
+        K = k;
+    }
+
 private:
     Material* material;
     float x0, x1, z0, z1, k;
@@ -132,6 +176,16 @@ public:
 
     COMMON_FUNC int typeId() const override { return YZRectangleTypeId; }
 
+    COMMON_FUNC Material* getMaterial() const { return material; }
+    COMMON_FUNC void getExtent(float& Y0, float& Y1, float& Z0, float& Z1, float& K) const
+    {
+        Y0 = y0;
+        Y1 = y1;
+        Z0 = z0;
+        Z1 = z1;
+        K = k;
+    }
+
 private:
     Material* material;
     float y0, y1, z0, z1, k;
@@ -187,6 +241,8 @@ public:
 
     COMMON_FUNC int typeId() const override { return FlipNormalsTypeId; }
 
+    COMMON_FUNC Hitable* getHitable() const { return hitable; }
+
 private:
     Hitable* hitable;
 };
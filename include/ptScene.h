@@ -0,0 +1,60 @@
+/*
+ * CUDA (GPU) Pathtracer based on Peter Shirley's 'Ray Tracing in One Weekend' e-book
+ * series.
+ *
+ * Copyright (C) 2017 by Rick Weyrauch - rpweyrauch@gmail.com
+ *
+ * This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+ */
+
+#ifndef PATHTRACER_SCENE_H
+#define PATHTRACER_SCENE_H
+
+#include "ptHitable.h"
+#include "ptBVH.h"
+
+enum SceneAccelType
+{
+    SceneAccelBVH,      // Binary BVH.
+    SceneAccelBVH4,     // 4-wide BVH collapsed from the binary tree.
+    SceneAccelBVH8      // 8-wide BVH collapsed from the binary tree.
+};
+
+struct ScenePrepOptions
+{
+    // Lists with more bounded children than this are replaced by an acceleration
+    // structure.  Zero disables the pass.
+    int listThreshold = 8;
+    SceneAccelType accel = SceneAccelBVH;
+    BVHBuildMethod method = BVHBuildSAH;
+    float time0 = 0;
+    float time1 = 1;
+    // Lists with moving children get a MotionBVH, whose node bounds follow the
+    // shutter time, instead of one bounding the whole motion, when it is expected to
+    // be faster (see MOTION_BVH_MIN_SAH_GAIN).
+    bool motionBVH = true;
+    // The spheres (moving or not) of a promoted list are packed into one SphereSet, whose
+    // leaves test a packet of spheres at once, instead of being separate primitives.
+    bool sphereSets = true;
+};
+
+struct ScenePrepStats
+{
+    int listsPromoted = 0;
+    int primitivesPromoted = 0;
+    int primitivesLinear = 0;
+    int spheresPacked = 0;
+};
+
+//
+// Scene preparation pass, run on the host once the scene builder is done.  Every
+// HitableList (nested lists included) with more than options.listThreshold children is
+// promoted to a BVH.  Children without bounds, or whose bounds enclose all of their
+// siblings (e.g. a ConstantMedium inside a huge sphere), would only bloat the tree and
+// stay in a small linear list next to it.
+//
+// Returns the (possibly new) root; the original list objects are not freed.
+//
+Hitable* PrepareScene(Hitable* world, const ScenePrepOptions& options, ScenePrepStats* stats = nullptr);
+
+#endif //PATHTRACER_SCENE_H
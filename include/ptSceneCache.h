@@ -0,0 +1,49 @@
+/*
+ * CUDA (GPU) Pathtracer based on Peter Shirley's 'Ray Tracing in One Weekend' e-book
+ * series.
+ *
+ * Copyright (C) 2017 by Rick Weyrauch - rpweyrauch@gmail.com
+ *
+ * This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+ */
+
+#ifndef PATHTRACER_SCENECACHE_H
+#define PATHTRACER_SCENECACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+class Stream;
+
+//
+// Hash of everything a prepared scene is built from: the scene and its options, the
+// files it reads, and the program itself.  Prepared scenes are cached on disk under
+// this key and mapped by later runs (host only).
+//
+class SceneCacheKey
+{
+public:
+    void add(const void* pData, size_t size);
+    void add(const std::string& str);
+
+    template <typename T>
+    void addValue(const T& value) { add(&value, sizeof(T)); }
+
+    // Adds the contents of a file, or only the fact that it is missing.
+    void addFile(const std::string& filename);
+
+    uint64_t value() const;
+
+private:
+    uint64_t m_hash = 14695981039346656037ull;
+};
+
+// Name of the cache file for key in directory.
+std::string SceneCachePath(const std::string& directory, uint64_t key);
+
+// Saves a serialized scene to the cache.  The file is written under a temporary name
+// and renamed, so that concurrent runs never map a partial file.
+bool StoreSceneCache(const Stream& stream, const std::string& directory, const std::string& path);
+
+#endif //PATHTRACER_SCENECACHE_H
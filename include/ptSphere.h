@@ -22,11 +22,54 @@
 COMMON_FUNC inline void get_uv(const Vector3f& p, Vector2f& uv)
 {
     float phi = atan2f(p.z(), p.x());
-    float theta = asinf(p.y());
+    float theta = asinf(Clamp(p.y(), -1.0f, 1.0f));
     uv.u() = 1 - (phi + CUDART_PI_F) / (2 * CUDART_PI_F);
     uv.v() = (theta + CUDART_PI_F/2) / CUDART_PI_F;
 }
 
+// Intersection shared by Sphere, MovingSphere and the tagged Primitive dispatch.
+COMMON_FUNC inline bool hitSphere(const Vector3f& center, float radius, Material* material, const Rayf& r, float tmin, float tmax,
+                                  HitRecord& rec)
+{
+    Vector3f oc = r.origin() - center;
+    float a = dot(r.direction(), r.direction());
+    float b = dot(oc, r.direction());
+    // b^2 - ac written as a(r^2 - |f|^2), with f the vector from the center to the
+    // closest point on the ray, which does not cancel catastrophically for distant spheres.
+    Vector3f f = oc - (b / a) * r.direction();
+    float discriminant = a * (radius * radius - dot(f, f));
+    if (discriminant > 0)
+    {
+        float temp = (-b - Sqrt(discriminant)) / a;
+        if (temp < tmax && temp > tmin)
+        {
+            rec.t = temp;
+            rec.p = r.pointAt(rec.t);
+            rec.normal = (rec.p - center) / radius;
+            rec.material = MaterialIndex(material);
+            get_uv(rec.normal, rec.uv);
+            return true;
+        }
+        temp = (-b + Sqrt(discriminant)) / a;
+        if (temp < tmax && temp > tmin)
+        {
+            rec.t = temp;
+            rec.p = r.pointAt(rec.t);
+            rec.normal = (rec.p - center) / radius;
+            rec.material = MaterialIndex(material);
+            get_uv(rec.normal, rec.uv);
+            return true;
+        }
+    }
+    return false;
+}
+
+// Center of a sphere moving linearly from center0 at time0 to center1 at time1.
+COMMON_FUNC inline Vector3f movingCenter(const Vector3f& center0, const Vector3f& center1, float time0, float time1, float time)
+{
+    return center0 + ((time - time0) / (time1 - time0)) * (center1 - center0);
+}
+
 class Sphere : public Hitable
 {
 public:
@@ -72,6 +115,11 @@ public:
 
     COMMON_FUNC int typeId() const override { return SphereTypeId; }
 
+    COMMON_FUNC const Vector3f& getCenter() const { return center; }
+    void setCenter(const Vector3f& c) { center = c; }
+    COMMON_FUNC float getRadius() const { return radius; }
+    COMMON_FUNC Material* getMaterial() const { return material; }
+
 private:
     Vector3f center;
     float radius;
@@ -96,16 +144,25 @@ public:
 
     COMMON_FUNC bool bounds(float t0, float t1, AABB<float>& bbox) const override
     {
-        AABB<float> box0 = AABB<float>(center0 - Vector3f(radius, radius, radius), center0 + Vector3f(radius, radius, radius));
-        AABB<float> box1 = AABB<float>(center1 - Vector3f(radius, radius, radius), center1 + Vector3f(radius, radius, radius));
+        AABB<float> box0, box1;
+        motionBounds(t0, t1, box0, box1);
         bbox = join(box0, box1);
         return true;
     }
 
+    // The motion is linear, so the boxes at t0 and t1 interpolate exactly.
+    COMMON_FUNC bool motionBounds(float t0, float t1, AABB<float>& bbox0, AABB<float>& bbox1) const override
+    {
+        const Vector3f r(radius, radius, radius);
+        bbox0 = AABB<float>(center(t0) - r, center(t0) + r);
+        bbox1 = AABB<float>(center(t1) - r, center(t1) + r);
+        return true;
+    }
+
 
     COMMON_FUNC Vector3<float> center(float time) const
     {
-        return center0 + ((time - time0) / (time1 - time0)) * (center1 - center0);
+        return movingCenter(center0, center1, time0, time1, time);
     }
 
     COMMON_FUNC bool serialize(Stream* pStream) const override;
@@ -114,6 +171,21 @@ public:
 
     COMMON_FUNC int typeId() const override { return MovingSphereTypeId; }
 
+    void setPath(const Vector3f& cen0, const Vector3f& cen1)
+    {
+        center0 = cen0;
+        center1 = cen1;
+    }
+
+    // The center moves by velocity() per unit of time.
+    Vector3f velocity() const { return (center1 - center0) / (time1 - time0); }
+    COMMON_FUNC const Vector3f& getCenter0() const { return center0; }
+    COMMON_FUNC const Vector3f& getCenter1() const { return center1; }
+    COMMON_FUNC float getTime0() const { return time0; }
+    COMMON_FUNC float getTime1() const { return time1; }
+    COMMON_FUNC float getRadius() const { return radius; }
+    COMMON_FUNC Material* getMaterial() const { return material; }
+
 private:
     Vector3f center0, center1;
     float time0, time1;
@@ -0,0 +1,317 @@
+/*
+ * CUDA (GPU) Pathtracer based on Peter Shirley's 'Ray Tracing in One Weekend' e-book
+ * series.
+ *
+ * Copyright (C) 2017 by Rick Weyrauch - rpweyrauch@gmail.com
+ *
+ * This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+ */
+
+#ifndef PATHTRACER_SPHERESET_H
+#define PATHTRACER_SPHERESET_H
+
+#include <cmath>
+#include <cfloat>
+#if !defined(__CUDA_ARCH__) && (defined(__SSE__) || defined(__AVX__))
+#include <immintrin.h>
+#endif
+#include "ptCudaCommon.h"
+#include "ptHitable.h"
+#include "ptBVH.h"
+
+class Sphere;
+
+//
+// N spheres stored structure-of-arrays so that one ray can be tested against all of them
+// at once (SSE for N = 4, AVX for N = 8).  A sphere is at center + time * velocity at the
+// ray's time; static spheres have no velocity.  Unused lanes have a NaN radius and are
+// never hit.
+//
+template <int N>
+struct SpherePacket
+{
+    float center[3][N];
+    float velocity[3][N];
+    float radius[N];
+
+    COMMON_FUNC void set(int lane, const Vector3f& c, const Vector3f& v, float r)
+    {
+        for (int a = 0; a < 3; a++)
+        {
+            center[a][lane] = c[a];
+            velocity[a][lane] = v[a];
+        }
+        radius[lane] = r;
+    }
+
+    COMMON_FUNC void clear(int lane)
+    {
+        for (int a = 0; a < 3; a++)
+        {
+            center[a][lane] = 0;
+            velocity[a][lane] = 0;
+        }
+        radius[lane] = NAN;
+    }
+
+    COMMON_FUNC Vector3f centerAt(int lane, float time) const
+    {
+        return Vector3f(center[0][lane] + time * velocity[0][lane], center[1][lane] + time * velocity[1][lane],
+                        center[2][lane] + time * velocity[2][lane]);
+    }
+};
+
+//
+// Tests one ray against the N spheres of a packet, with the same arithmetic as
+// Sphere::hit.  Returns the lane of the nearest hit in (tmin, tmax), or -1, and on a hit
+// narrows tmax to its distance.  Only the distance is computed; the caller shades the
+// closest sphere.
+//
+template <int N>
+COMMON_FUNC inline int intersectSpheresScalar(const SpherePacket<N>& packet, const Rayf& r, float tmin, float& tmax)
+{
+    const Vector3f& d = r.direction();
+    const float a = dot(d, d);
+
+    int lane = -1;
+    for (int i = 0; i < N; i++)
+    {
+        const Vector3f oc = r.origin() - packet.centerAt(i, r.time());
+        const float b = dot(oc, d);
+        const Vector3f f = oc - (b / a) * d;
+        const float discriminant = a * (packet.radius[i] * packet.radius[i] - dot(f, f));
+        // Written so that the NaNs of an empty lane fail.
+        if (!(discriminant > 0))
+            continue;
+
+        const float root = Sqrt(discriminant);
+        float t = (-b - root) / a;
+        if (!(t < tmax && t > tmin))
+            t = (-b + root) / a;
+        if (t < tmax && t > tmin)
+        {
+            lane = i;
+            tmax = t;
+        }
+    }
+    return lane;
+}
+
+#ifndef __CUDA_ARCH__
+
+inline int intersectSpheresSimd(const SpherePacket<4>& packet, const Rayf& r, float tmin, float& tmax)
+{
+#if defined(__SSE__)
+    const __m128 dx = _mm_set1_ps(r.direction().x());
+    const __m128 dy = _mm_set1_ps(r.direction().y());
+    const __m128 dz = _mm_set1_ps(r.direction().z());
+    const __m128 a = _mm_set1_ps(dot(r.direction(), r.direction()));
+
+    const __m128 time = _mm_set1_ps(r.time());
+    const __m128 cx = _mm_add_ps(_mm_loadu_ps(packet.center[0]), _mm_mul_ps(time, _mm_loadu_ps(packet.velocity[0])));
+    const __m128 cy = _mm_add_ps(_mm_loadu_ps(packet.center[1]), _mm_mul_ps(time, _mm_loadu_ps(packet.velocity[1])));
+    const __m128 cz = _mm_add_ps(_mm_loadu_ps(packet.center[2]), _mm_mul_ps(time, _mm_loadu_ps(packet.velocity[2])));
+    const __m128 ocx = _mm_sub_ps(_mm_set1_ps(r.origin().x()), cx);
+    const __m128 ocy = _mm_sub_ps(_mm_set1_ps(r.origin().y()), cy);
+    const __m128 ocz = _mm_sub_ps(_mm_set1_ps(r.origin().z()), cz);
+    const __m128 radius = _mm_loadu_ps(packet.radius);
+
+    const __m128 b = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ocx, dx), _mm_mul_ps(ocy, dy)), _mm_mul_ps(ocz, dz));
+    const __m128 s = _mm_div_ps(b, a);
+    const __m128 fx = _mm_sub_ps(ocx, _mm_mul_ps(s, dx));
+    const __m128 fy = _mm_sub_ps(ocy, _mm_mul_ps(s, dy));
+    const __m128 fz = _mm_sub_ps(ocz, _mm_mul_ps(s, dz));
+    const __m128 f2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(fx, fx), _mm_mul_ps(fy, fy)), _mm_mul_ps(fz, fz));
+    const __m128 discriminant = _mm_mul_ps(a, _mm_sub_ps(_mm_mul_ps(radius, radius), f2));
+
+    // Ordered compares, so the NaNs of an empty lane fail.
+    const __m128 valid = _mm_cmpgt_ps(discriminant, _mm_setzero_ps());
+    if (_mm_movemask_ps(valid) == 0)
+        return -1;
+
+    const __m128 root = _mm_sqrt_ps(discriminant);
+    const __m128 negB = _mm_sub_ps(_mm_setzero_ps(), b);
+    const __m128 tNear = _mm_div_ps(_mm_sub_ps(negB, root), a);
+    const __m128 tFar = _mm_div_ps(_mm_add_ps(negB, root), a);
+
+    const __m128 lo = _mm_set1_ps(tmin);
+    const __m128 hi = _mm_set1_ps(tmax);
+    const __m128 nearOk = _mm_and_ps(_mm_cmpgt_ps(tNear, lo), _mm_cmplt_ps(tNear, hi));
+    const __m128 farOk = _mm_and_ps(_mm_cmpgt_ps(tFar, lo), _mm_cmplt_ps(tFar, hi));
+    const __m128 mask = _mm_and_ps(valid, _mm_or_ps(nearOk, farOk));
+    const int hits = _mm_movemask_ps(mask);
+    if (hits == 0)
+        return -1;
+
+    // The near root where it is in range, the far one otherwise.
+    const __m128 t = _mm_or_ps(_mm_and_ps(nearOk, tNear), _mm_andnot_ps(nearOk, tFar));
+
+    // Nearest hit: horizontal minimum of the masked distances.
+    const __m128 tHit = _mm_or_ps(_mm_and_ps(mask, t), _mm_andnot_ps(mask, _mm_set1_ps(FLT_MAX)));
+    __m128 tMin = _mm_min_ps(tHit, _mm_shuffle_ps(tHit, tHit, _MM_SHUFFLE(2, 3, 0, 1)));
+    tMin = _mm_min_ps(tMin, _mm_shuffle_ps(tMin, tMin, _MM_SHUFFLE(1, 0, 3, 2)));
+    const int lane = __builtin_ctz(_mm_movemask_ps(_mm_cmpeq_ps(tHit, tMin)) & hits);
+
+    float ts[4];
+    _mm_storeu_ps(ts, t);
+    tmax = ts[lane];
+    return lane;
+#else
+    return intersectSpheresScalar(packet, r, tmin, tmax);
+#endif
+}
+
+inline int intersectSpheresSimd(const SpherePacket<8>& packet, const Rayf& r, float tmin, float& tmax)
+{
+#if defined(__AVX__)
+    const __m256 dx = _mm256_set1_ps(r.direction().x());
+    const __m256 dy = _mm256_set1_ps(r.direction().y());
+    const __m256 dz = _mm256_set1_ps(r.direction().z());
+    const __m256 a = _mm256_set1_ps(dot(r.direction(), r.direction()));
+
+    const __m256 time = _mm256_set1_ps(r.time());
+    const __m256 cx = _mm256_add_ps(_mm256_loadu_ps(packet.center[0]), _mm256_mul_ps(time, _mm256_loadu_ps(packet.velocity[0])));
+    const __m256 cy = _mm256_add_ps(_mm256_loadu_ps(packet.center[1]), _mm256_mul_ps(time, _mm256_loadu_ps(packet.velocity[1])));
+    const __m256 cz = _mm256_add_ps(_mm256_loadu_ps(packet.center[2]), _mm256_mul_ps(time, _mm256_loadu_ps(packet.velocity[2])));
+    const __m256 ocx = _mm256_sub_ps(_mm256_set1_ps(r.origin().x()), cx);
+    const __m256 ocy = _mm256_sub_ps(_mm256_set1_ps(r.origin().y()), cy);
+    const __m256 ocz = _mm256_sub_ps(_mm256_set1_ps(r.origin().z()), cz);
+    const __m256 radius = _mm256_loadu_ps(packet.radius);
+
+    const __m256 b = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ocx, dx), _mm256_mul_ps(ocy, dy)), _mm256_mul_ps(ocz, dz));
+    const __m256 s = _mm256_div_ps(b, a);
+    const __m256 fx = _mm256_sub_ps(ocx, _mm256_mul_ps(s, dx));
+    const __m256 fy = _mm256_sub_ps(ocy, _mm256_mul_ps(s, dy));
+    const __m256 fz = _mm256_sub_ps(ocz, _mm256_mul_ps(s, dz));
+    const __m256 f2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(fx, fx), _mm256_mul_ps(fy, fy)), _mm256_mul_ps(fz, fz));
+    const __m256 discriminant = _mm256_mul_ps(a, _mm256_sub_ps(_mm256_mul_ps(radius, radius), f2));
+
+    // Ordered compares, so the NaNs of an empty lane fail.
+    const __m256 valid = _mm256_cmp_ps(discriminant, _mm256_setzero_ps(), _CMP_GT_OQ);
+    if (_mm256_movemask_ps(valid) == 0)
+        return -1;
+
+    const __m256 root = _mm256_sqrt_ps(discriminant);
+    const __m256 negB = _mm256_sub_ps(_mm256_setzero_ps(), b);
+    const __m256 tNear = _mm256_div_ps(_mm256_sub_ps(negB, root), a);
+    const __m256 tFar = _mm256_div_ps(_mm256_add_ps(negB, root), a);
+
+    const __m256 lo = _mm256_set1_ps(tmin);
+    const __m256 hi = _mm256_set1_ps(tmax);
+    const __m256 nearOk = _mm256_and_ps(_mm256_cmp_ps(tNear, lo, _CMP_GT_OQ), _mm256_cmp_ps(tNear, hi, _CMP_LT_OQ));
+    const __m256 farOk = _mm256_and_ps(_mm256_cmp_ps(tFar, lo, _CMP_GT_OQ), _mm256_cmp_ps(tFar, hi, _CMP_LT_OQ));
+    const __m256 mask = _mm256_and_ps(valid, _mm256_or_ps(nearOk, farOk));
+    const int hits = _mm256_movemask_ps(mask);
+    if (hits == 0)
+        return -1;
+
+    // The near root where it is in range, the far one otherwise.
+    const __m256 t = _mm256_blendv_ps(tFar, tNear, nearOk);
+
+    // Nearest hit: horizontal minimum of the masked distances.
+    const __m256 tHit = _mm256_blendv_ps(_mm256_set1_ps(FLT_MAX), t, mask);
+    __m256 tMin = _mm256_min_ps(tHit, _mm256_permute2f128_ps(tHit, tHit, 1));
+    tMin = _mm256_min_ps(tMin, _mm256_shuffle_ps(tMin, tMin, _MM_SHUFFLE(2, 3, 0, 1)));
+    tMin = _mm256_min_ps(tMin, _mm256_shuffle_ps(tMin, tMin, _MM_SHUFFLE(1, 0, 3, 2)));
+    const int lane = __builtin_ctz(_mm256_movemask_ps(_mm256_cmp_ps(tHit, tMin, _CMP_EQ_OQ)) & hits);
+
+    float ts[8];
+    _mm256_storeu_ps(ts, t);
+    tmax = ts[lane];
+    return lane;
+#else
+    return intersectSpheresScalar(packet, r, tmin, tmax);
+#endif
+}
+
+#endif // __CUDA_ARCH__
+
+template <int N>
+COMMON_FUNC inline int intersectSpheres(const SpherePacket<N>& packet, const Rayf& r, float tmin, float& tmax)
+{
+#ifdef __CUDA_ARCH__
+    return intersectSpheresScalar(packet, r, tmin, tmax);
+#else
+    return intersectSpheresSimd(packet, r, tmin, tmax);
+#endif
+}
+
+//
+// A group of Spheres and MovingSpheres with their own BVH.  Centers, velocities and radii
+// are stored in packets, one per leaf, and materials are shared through an index per
+// sphere, so a leaf costs one vectorized test instead of a virtual hit() per sphere.  The
+// normal, uv and material are only computed for the closest hit.
+//
+// The tree bounds the spheres over the [time0, time1] shutter interval given to the
+// constructor.
+//
+class SphereSet : public Hitable
+{
+public:
+    COMMON_FUNC SphereSet() {}
+
+    // Every entry of list must be a Sphere or a MovingSphere.
+    SphereSet(Hitable* const* list, int count, float time0, float time1, BVHBuildMethod method = BVHBuildSAH);
+
+    COMMON_FUNC ~SphereSet() override
+    {
+        if (!m_arraysInStream)
+        {
+            delete[] m_packets;
+            delete[] m_materialIndices;
+            delete[] m_nodes;
+        }
+        delete[] m_materials;
+    }
+
+    COMMON_FUNC bool hit(const Rayf& r, float tmin, float tmax, HitRecord& rec, RNG& rng) const override;
+    COMMON_FUNC bool bounds(float t0, float t1, AABB<float>& bbox) const override;
+    COMMON_FUNC bool motionBounds(float t0, float t1, AABB<float>& bbox0, AABB<float>& bbox1) const override;
+
+    COMMON_FUNC float pdfValue(const Vector3f& o, const Vector3f& v, RNG& rng) const override;
+    COMMON_FUNC Vector3f random(const Vector3f& o, RNG& rng) const override;
+
+    COMMON_FUNC bool serialize(Stream* pStream) const override;
+    COMMON_FUNC bool deserialize(Stream *pStream) override;
+
+    COMMON_FUNC int typeId() const override { return SphereSetTypeId; }
+
+    int sphereCount() const { return m_numSpheres; }
+    int materialCount() const { return m_numMaterials; }
+    int nodeCount() const { return m_numNodes; }
+
+    // Leaves hold at most this many spheres, intersected as one packet.
+    static const int PacketWidth = PRIMITIVE_PACKET_WIDTH;
+
+private:
+
+    // The static sphere in a lane, as a standalone Sphere for the light sampling functions.
+    COMMON_FUNC Sphere sphere(int lane) const;
+    COMMON_FUNC bool isStatic(int lane) const;
+
+    // Spheres in BVH leaf order, PacketWidth per packet.  A leaf's primitivesOffset is the
+    // index of its packet; m_materialIndices has an entry for every lane (-1 if unused).
+    int m_numSpheres = 0;
+    int m_numPackets = 0;
+    SpherePacket<PacketWidth>* m_packets = nullptr;
+    int* m_materialIndices = nullptr;
+
+    // Each distinct material once.
+    Material** m_materials = nullptr;
+    int m_numMaterials = 0;
+
+    LinearBVHNode* m_nodes = nullptr;
+    int m_numNodes = 0;
+
+    // m_packets, m_materialIndices and m_nodes are in the buffer of the stream the set was
+    // read from.
+    bool m_arraysInStream = false;
+
+    // Bounds of all spheres at the start and end of the shutter interval.
+    float m_time0 = 0;
+    float m_time1 = 1;
+    AABB<float> m_bbox0;
+    AABB<float> m_bbox1;
+};
+
+#endif //PATHTRACER_SPHERESET_H
@@ -11,12 +11,38 @@
 #define PATHTRACER_PTSTREAM_H
 
 #include <cinttypes>
+#include <cstring>
 #include "ptCudaCommon.h"
 
+class MaterialTable;
+
 #define MakeFourCC(ch0, ch1, ch2, ch3) \
    ((uint32_t)(uint8_t)(ch0) | ((uint32_t)(uint8_t)(ch1) << 8) |         \
    ((uint32_t)(uint8_t)(ch2) << 16) | ((uint32_t)(uint8_t)(ch3) << 24 ))
 
+// Written in place of the type id of a shared object that is already in the stream,
+// followed by its handle.
+const int ReferenceTypeId = MakeFourCC('R','E','F','S');
+
+// Version of the scene file layout written by Stream::save; it changes whenever the
+// layout of a serialized object does.
+const uint16_t SCENE_FILE_VERSION = 2;
+
+//
+// Serialized scene.  Objects are written depth first and refer to each other only by
+// their order in the stream, so the bytes hold no pointers and can be copied, saved or
+// mapped at any address.  Bulk arrays (BVH nodes, primitive packets, vertices, image
+// pixels) are written aligned with writeArray; a stream that reads in place hands out
+// pointers into its buffer for them instead of copying, so only the objects themselves
+// are allocated when a scene is read.
+//
+// The buffer is allocated once at its final size: serializing into a measuring stream
+// first gives the exact size, padding and references included.
+//
+// Shared objects (materials and textures) are written once.  Later occurrences are
+// written as a handle, the order in which the object was first written, and resolve to
+// the same instance when read.
+//
 class Stream
 {
 public:
@@ -28,24 +54,110 @@ public:
 
     COMMON_FUNC ~Stream();
 
+    Stream(const Stream&) = delete;
+    Stream& operator=(const Stream&) = delete;
+
     bool create(size_t size);
     bool close();
 
+    // Makes a stream without a buffer measure instead of store: writes advance the size
+    // exactly as they would in a buffer and always succeed.
+    void measure();
+    COMMON_FUNC size_t bytesWritten() const { return writeOffset; }
+
+    // False once a read or write did not fit.  Serializers combine results loosely, so
+    // check this after writing or reading a whole scene.
+    COMMON_FUNC bool good() const { return !failed; }
+
+    // Writes the serialized data to a scene file.
+    bool save(const char* path) const;
+    // Maps a scene file written by save() for reading (on the GPU build it is read into
+    // managed memory).  Fails if the file was written by a build with a different layout.
+    bool open(const char* path);
+
     COMMON_FUNC bool write(const void* pData, size_t size);
     COMMON_FUNC bool writeNull();
 
+    // Writes size bytes at the next multiple of ARRAY_ALIGNMENT in the stream.
+    COMMON_FUNC bool writeArray(const void* pData, size_t size);
+
     COMMON_FUNC bool read(void* pData, size_t size);
 
+    // Reads count elements written by writeArray.  When the stream reads in place pArray
+    // points into the buffer, otherwise it is allocated with new[] and filled.
+    template <typename T>
+    COMMON_FUNC bool readArray(T*& pArray, size_t count)
+    {
+        const void* pData = readArrayData(count * sizeof(T));
+        if (pData == nullptr)
+            return false;
+
+        if (readInPlace)
+        {
+            pArray = static_cast<T*>(const_cast<void*>(pData));
+        }
+        else
+        {
+            pArray = new T[count];
+            memcpy(pArray, pData, count * sizeof(T));
+        }
+        return true;
+    }
+
+    // Called by a shared object before it writes itself.  If it is already in the stream,
+    // writes a reference to it and returns true; the object then writes nothing else.
+    COMMON_FUNC bool writeReference(const void* object);
+
+    // Registers a shared object created while reading, before it reads its contents, so
+    // that handles resolve in the order the objects were written.
+    COMMON_FUNC void addReference(void* object);
+    // Reads the handle following ReferenceTypeId and returns the object.
+    COMMON_FUNC void* readReference();
+
+    // Arrays read from an in place stream belong to its buffer, which must outlive every
+    // object read from it.
+    COMMON_FUNC void setReadInPlace(bool inPlace) { readInPlace = inPlace; }
+    COMMON_FUNC bool readsInPlace() const { return readInPlace; }
+
     COMMON_FUNC void* data() { return pBuffer; }
     COMMON_FUNC size_t size() const { return bufferSize; }
 
+    // Materials read from the stream are added to this table.
+    COMMON_FUNC void setMaterialTable(MaterialTable* table) { materialTable = table; }
+    COMMON_FUNC MaterialTable* getMaterialTable() const { return materialTable; }
+
+    // Alignment of arrays relative to the start of the stream.  Buffers are at least this
+    // aligned, so arrays read in place are too.
+    static const size_t ARRAY_ALIGNMENT = 16;
+
 private:
 
+    COMMON_FUNC const void* readArrayData(size_t size);
+    COMMON_FUNC void growWrittenObjects();
+
+    // Handles of the shared objects written: open addressing on the object address.
+    const void** writtenObjects = nullptr;
+    uint32_t* writtenHandles = nullptr;
+    uint32_t writtenCapacity = 0;
+    uint32_t numWritten = 0;
+
+    // Shared objects read, by handle.
+    void** readObjects = nullptr;
+    uint32_t readCapacity = 0;
+    uint32_t numRead = 0;
+
     void* pBuffer = nullptr;
     size_t bufferSize = 0;
     bool ownBuffer = true;
+    bool measuring = false;
+    bool failed = false;
+    bool readInPlace = false;
+    // The buffer is a mapped scene file; pBuffer points past its header.
+    void* pMapping = nullptr;
+    size_t mappingSize = 0;
     size_t writeOffset = 0;
     size_t readOffset = 0;
+    MaterialTable* materialTable = nullptr;
 };
 
 #endif //PATHTRACER_PTSTREAM_H
@@ -10,11 +10,11 @@
 #ifndef PATHTRACER_TEXTURE_H
 #define PATHTRACER_TEXTURE_H
 
-#include <math_functions.h>
 #include "ptCudaCommon.h"
 #include "ptVector2.h"
 #include "ptVector3.h"
 #include "ptNoise.h"
+#include "ptArena.h"
 
 enum TextureTypeId
 {
@@ -24,7 +24,7 @@ enum TextureTypeId
   ImageTextureTypeId = MakeFourCC('I','M','A','G')
 };
 
-class Texture
+class Texture : public ArenaObject
 {
 public:
     COMMON_FUNC virtual Vector3f value(const Vector2f& uv, const Vector3f& p) const = 0;
@@ -53,6 +53,8 @@ public:
     {
         if (pStream == nullptr)
             return false;
+        if (pStream->writeReference(this))
+            return true;
 
         const int id = typeId();
         bool ok = pStream->write(&id, sizeof(id));
@@ -100,6 +102,8 @@ public:
     {
         if (pStream == nullptr)
             return false;
+        if (pStream->writeReference(this))
+            return true;
 
         const int id = typeId();
         bool ok = pStream->write(&id, sizeof(id));
@@ -149,6 +153,8 @@ public:
     {
         if (pStream == nullptr)
             return false;
+        if (pStream->writeReference(this))
+            return true;
 
         const int id = typeId();
         bool ok = pStream->write(&id, sizeof(id));
@@ -188,10 +194,8 @@ public:
     {
         int i = uv.u() * nx;
         int j = (1 - uv.v()) * ny - 0.001f;
-        i = max(0, i);
-        j = max(0, j);
-        i = min(i, nx-1);
-        j = min(j, ny-1);
+        i = Clamp(i, 0, nx-1);
+        j = Clamp(j, 0, ny-1);
         float r = int(data[3*i + 3*nx*j + 0]) / 255.0f;
         float g = int(data[3*i + 3*nx*j + 1]) / 255.0f;
         float b = int(data[3*i + 3*nx*j + 2]) / 255.0f;
@@ -202,12 +206,14 @@ public:
     {
         if (pStream == nullptr)
             return false;
+        if (pStream->writeReference(this))
+            return true;
 
         const int id = typeId();
         bool ok = pStream->write(&id, sizeof(id));
         ok |= pStream->write(&nx, sizeof(nx));
         ok |= pStream->write(&ny, sizeof(ny));
-        ok |= pStream->write(data, nx * ny * sizeof(unsigned char));
+        ok |= pStream->writeArray(data, 3 * nx * ny * sizeof(unsigned char));
 
         return ok;
     }
@@ -221,8 +227,8 @@ public:
         ok |= pStream->read(&ny, sizeof(ny));
 
         delete[] data;
-        data = new unsigned char[nx * ny];
-        ok |= pStream->read(data, nx * ny * sizeof(unsigned char));
+        data = nullptr;
+        ok |= pStream->readArray(data, 3 * nx * ny);
 
         return ok;
     }
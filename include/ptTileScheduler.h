@@ -0,0 +1,74 @@
+/*
+ * CUDA (GPU) Pathtracer based on Peter Shirley's 'Ray Tracing in One Weekend' e-book
+ * series.
+ *
+ * Copyright (C) 2017 by Rick Weyrauch - rpweyrauch@gmail.com
+ *
+ * This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+ */
+
+#ifndef PATHTRACER_TILESCHEDULER_H
+#define PATHTRACER_TILESCHEDULER_H
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+// Pixels [x0, x1) x [y0, y1) of the image.
+struct ImageTile
+{
+    int x0, y0;
+    int x1, y1;
+};
+
+// Tiles of at most tileSize x tileSize pixels covering an nx by ny image, in Morton (Z)
+// order of their position, so that tiles close in the list are close in the image.
+std::vector<ImageTile> MortonOrderedTiles(int nx, int ny, int tileSize);
+
+//
+// Renders a list of tiles on a set of threads (host only).  Each thread starts with a
+// contiguous run of the list in its own deque and works through it from the front.  A
+// thread that runs dry steals the back half of another thread's deque, so expensive
+// parts of the image are shared out while every thread stays on nearby tiles.
+//
+class TileScheduler
+{
+public:
+    struct ThreadStats
+    {
+        double busySeconds = 0;     // inside renderTile
+        int tiles = 0;
+        int tilesStolen = 0;
+    };
+
+    // numThreads <= 0 uses one thread per hardware thread.
+    explicit TileScheduler(int numThreads = 0);
+
+    int threadCount() const { return m_numThreads; }
+
+    // Calls renderTile(tile, thread) once for every tile, thread being in
+    // [0, threadCount()), and returns when all tiles are done.  The calling thread is
+    // thread 0.
+    void run(const std::vector<ImageTile>& tiles, const std::function<void(const ImageTile&, int)>& renderTile);
+
+    // Statistics of the last run.
+    const std::vector<ThreadStats>& threadStats() const { return m_stats; }
+    double wallSeconds() const { return m_wallSeconds; }
+
+private:
+    struct WorkQueue
+    {
+        std::mutex lock;
+        std::deque<int> tiles;
+    };
+
+    int steal(std::vector<WorkQueue>& queues, int thread, uint32_t& victimSeed);
+
+    int m_numThreads = 1;
+    std::vector<ThreadStats> m_stats;
+    double m_wallSeconds = 0;
+};
+
+#endif //PATHTRACER_TILESCHEDULER_H
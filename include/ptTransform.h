@@ -0,0 +1,186 @@
+/*
+ * CUDA (GPU) Pathtracer based on Peter Shirley's 'Ray Tracing in One Weekend' e-book
+ * series.
+ *
+ * Copyright (C) 2017 by Rick Weyrauch - rpweyrauch@gmail.com
+ *
+ * This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+ */
+
+#ifndef PATHTRACER_TRANSFORM_H
+#define PATHTRACER_TRANSFORM_H
+
+#include "ptCudaCommon.h"
+#include "ptMath.h"
+#include "ptVector3.h"
+#include "ptAABB.h"
+#include "ptStream.h"
+
+//
+// Affine transform stored as the top three rows of a 4x4 matrix (the bottom row is
+// always 0 0 0 1).  Points are column vectors: p' = M * p.
+//
+class Transform
+{
+public:
+    COMMON_FUNC Transform()
+    {
+        for (int r = 0; r < 3; r++)
+            for (int c = 0; c < 4; c++)
+                m[r][c] = (r == c) ? 1.0f : 0.0f;
+    }
+
+    COMMON_FUNC Transform(float m00, float m01, float m02, float m03,
+                          float m10, float m11, float m12, float m13,
+                          float m20, float m21, float m22, float m23)
+    {
+        m[0][0] = m00; m[0][1] = m01; m[0][2] = m02; m[0][3] = m03;
+        m[1][0] = m10; m[1][1] = m11; m[1][2] = m12; m[1][3] = m13;
+        m[2][0] = m20; m[2][1] = m21; m[2][2] = m22; m[2][3] = m23;
+    }
+
+    COMMON_FUNC static Transform Translate(const Vector3f& d)
+    {
+        return Transform(1, 0, 0, d.x(),
+                         0, 1, 0, d.y(),
+                         0, 0, 1, d.z());
+    }
+
+    COMMON_FUNC static Transform Scale(const Vector3f& s)
+    {
+        return Transform(s.x(), 0, 0, 0,
+                         0, s.y(), 0, 0,
+                         0, 0, s.z(), 0);
+    }
+
+    // Rotations by an angle in degrees, matching RotateY.
+    COMMON_FUNC static Transform RotateX(float angle)
+    {
+        const float radians = (CUDART_PI_F / 180) * angle;
+        const float s = Sin(radians), c = Cos(radians);
+        return Transform(1, 0, 0, 0,
+                         0, c, -s, 0,
+                         0, s, c, 0);
+    }
+
+    COMMON_FUNC static Transform RotateY(float angle)
+    {
+        const float radians = (CUDART_PI_F / 180) * angle;
+        const float s = Sin(radians), c = Cos(radians);
+        return Transform(c, 0, s, 0,
+                         0, 1, 0, 0,
+                         -s, 0, c, 0);
+    }
+
+    COMMON_FUNC static Transform RotateZ(float angle)
+    {
+        const float radians = (CUDART_PI_F / 180) * angle;
+        const float s = Sin(radians), c = Cos(radians);
+        return Transform(c, -s, 0, 0,
+                         s, c, 0, 0,
+                         0, 0, 1, 0);
+    }
+
+    COMMON_FUNC Vector3f point(const Vector3f& p) const
+    {
+        return Vector3f(m[0][0] * p.x() + m[0][1] * p.y() + m[0][2] * p.z() + m[0][3],
+                        m[1][0] * p.x() + m[1][1] * p.y() + m[1][2] * p.z() + m[1][3],
+                        m[2][0] * p.x() + m[2][1] * p.y() + m[2][2] * p.z() + m[2][3]);
+    }
+
+    COMMON_FUNC Vector3f vector(const Vector3f& v) const
+    {
+        return Vector3f(m[0][0] * v.x() + m[0][1] * v.y() + m[0][2] * v.z(),
+                        m[1][0] * v.x() + m[1][1] * v.y() + m[1][2] * v.z(),
+                        m[2][0] * v.x() + m[2][1] * v.y() + m[2][2] * v.z());
+    }
+
+    // Multiply by the transpose of the linear part.  Applied to the inverse transform
+    // this maps normals from object to world space.
+    COMMON_FUNC Vector3f transposeVector(const Vector3f& v) const
+    {
+        return Vector3f(m[0][0] * v.x() + m[1][0] * v.y() + m[2][0] * v.z(),
+                        m[0][1] * v.x() + m[1][1] * v.y() + m[2][1] * v.z(),
+                        m[0][2] * v.x() + m[1][2] * v.y() + m[2][2] * v.z());
+    }
+
+    // Bounds of the transformed box (Arvo's method).
+    COMMON_FUNC AABB<float> bounds(const AABB<float>& box) const
+    {
+        Vector3f lo(m[0][3], m[1][3], m[2][3]);
+        Vector3f hi = lo;
+        for (int r = 0; r < 3; r++)
+        {
+            for (int c = 0; c < 3; c++)
+            {
+                const float a = m[r][c] * box.min()[c];
+                const float b = m[r][c] * box.max()[c];
+                lo[r] += (a < b) ? a : b;
+                hi[r] += (a < b) ? b : a;
+            }
+        }
+        return AABB<float>(lo, hi);
+    }
+
+    COMMON_FUNC Transform operator*(const Transform& t) const
+    {
+        Transform result;
+        for (int r = 0; r < 3; r++)
+        {
+            for (int c = 0; c < 4; c++)
+            {
+                result.m[r][c] = m[r][0] * t.m[0][c] + m[r][1] * t.m[1][c] + m[r][2] * t.m[2][c];
+            }
+            result.m[r][3] += m[r][3];
+        }
+        return result;
+    }
+
+    COMMON_FUNC Transform inverse() const
+    {
+        // Inverse of the 3x3 linear part from its cofactors, then the translation.
+        const float c00 = m[1][1] * m[2][2] - m[1][2] * m[2][1];
+        const float c01 = m[1][2] * m[2][0] - m[1][0] * m[2][2];
+        const float c02 = m[1][0] * m[2][1] - m[1][1] * m[2][0];
+        const float det = m[0][0] * c00 + m[0][1] * c01 + m[0][2] * c02;
+        const float invDet = 1 / det;
+
+        Transform result;
+        result.m[0][0] = c00 * invDet;
+        result.m[1][0] = c01 * invDet;
+        result.m[2][0] = c02 * invDet;
+        result.m[0][1] = (m[0][2] * m[2][1] - m[0][1] * m[2][2]) * invDet;
+        result.m[1][1] = (m[0][0] * m[2][2] - m[0][2] * m[2][0]) * invDet;
+        result.m[2][1] = (m[0][1] * m[2][0] - m[0][0] * m[2][1]) * invDet;
+        result.m[0][2] = (m[0][1] * m[1][2] - m[0][2] * m[1][1]) * invDet;
+        result.m[1][2] = (m[0][2] * m[1][0] - m[0][0] * m[1][2]) * invDet;
+        result.m[2][2] = (m[0][0] * m[1][1] - m[0][1] * m[1][0]) * invDet;
+
+        const Vector3f t = result.vector(Vector3f(m[0][3], m[1][3], m[2][3]));
+        result.m[0][3] = -t.x();
+        result.m[1][3] = -t.y();
+        result.m[2][3] = -t.z();
+        return result;
+    }
+
+    COMMON_FUNC bool serialize(Stream* pStream) const
+    {
+        if (pStream == nullptr)
+            return false;
+
+        return pStream->write(m, sizeof(m));
+    }
+
+    COMMON_FUNC bool deserialize(Stream *pStream)
+    {
+        if (pStream == nullptr)
+            return false;
+
+        return pStream->read(m, sizeof(m));
+    }
+
+private:
+    float m[3][4];
+};
+
+#endif //PATHTRACER_TRANSFORM_H
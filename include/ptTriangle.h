@@ -10,11 +10,15 @@
 #ifndef PATHTRACER_TRIANGLE_H
 #define PATHTRACER_TRIANGLE_H
 
+#include <cstring>
+#include <memory>
 #include <vector>
 #include "ptHitable.h"
 #include "ptTexture.h"
 #include "ptVector2.h"
 #include "ptAABB.h"
+#include "ptBVH.h"
+#include "ptTrianglePacket.h"
 
 class Triangle : public Hitable
 {
@@ -58,6 +62,38 @@ struct TriIndex
     unsigned int i0, i1, i2;
 };
 
+//
+// Array of T at an arbitrary byte stride and alignment in memory owned elsewhere, e.g.
+// one attribute of an interleaved vertex buffer in a mapped file.
+//
+template <typename T>
+struct StridedView
+{
+    COMMON_FUNC StridedView() {}
+    COMMON_FUNC StridedView(const void* p, size_t byteStride = sizeof(T)) :
+        data(static_cast<const unsigned char*>(p)),
+        stride(byteStride) {}
+
+    COMMON_FUNC T operator[](size_t i) const
+    {
+        T value;
+        memcpy(&value, data + i * stride, sizeof(T));
+        return value;
+    }
+
+    COMMON_FUNC bool valid() const { return data != nullptr; }
+    COMMON_FUNC bool packed() const { return stride == sizeof(T); }
+
+    const unsigned char* data = nullptr;
+    size_t stride = sizeof(T);
+};
+
+//
+// Indexed triangle mesh with its own BVH over the triangles.  Each leaf is one
+// TrianglePacket of up to PacketWidth triangles, which a ray tests all at once with
+// the two sided Moller-Trumbore test; the shading normal and texture coordinates of
+// the closest hit are interpolated from the vertex attributes.
+//
 class TriangleMesh : public Hitable
 {
 public:
@@ -65,6 +101,18 @@ public:
     COMMON_FUNC explicit TriangleMesh(Material* mtl) :
         material(mtl) { }
 
+    COMMON_FUNC ~TriangleMesh() override
+    {
+        if (arraysInStream)
+            return;
+        delete[] packets;
+        delete[] triIndices;
+        delete[] vertPositions;
+        delete[] vertNormals;
+        delete[] vertTexCoords;
+        delete[] nodes;
+    }
+
     COMMON_FUNC bool hit(const Rayf& r, float t_min, float t_max, HitRecord& rec, RNG& rng) const override;
 
     COMMON_FUNC bool bounds(float t0, float t1, AABB<float>& bbox) const override;
@@ -73,6 +121,7 @@ public:
     COMMON_FUNC bool deserialize(Stream *pStream) override;
     COMMON_FUNC int typeId() const override { return TriMeshTypeId; }
 
+    // A zero normal selects the geometric normal of the triangles using the vertex.
     void addVertex(const Vector3f& p, const Vector3f& n, const Vector2f& tex);
 
     void addTriangle(const TriIndex& tri)
@@ -80,10 +129,27 @@ public:
         triangles.push_back(tri);
     }
 
-    void complete();
+    // Bulk versions for importers.  normals and texCoords may be null.
+    void reserve(int numVertices, int numTriangles);
+    void addVertices(const Vector3f* p, const Vector3f* n, const Vector2f* tex, int numVertices);
+    void addTriangles(const TriIndex* tris, int numTriangles);
 
-private:
+    // Zero-copy alternative for importers: the vertex attributes and 32-bit index buffer
+    // are used in place, and owner keeps their memory alive for the mesh's lifetime.  An
+    // invalid normal or texture coordinate view means the attribute is absent.
+    void setVertexViews(const StridedView<Vector3f>& p, const StridedView<Vector3f>& n, const StridedView<Vector2f>& tex,
+                        int numVertices, std::shared_ptr<const void> owner);
+    void setIndexView(const StridedView<TriIndex>& tris, int numTriangles);
+
+    // Moves the added vertices and triangles into the flattened arrays (unless views were
+    // set) and builds the BVH.  Degenerate triangles are dropped.
+    void complete(BVHBuildMethod method = BVHBuildSAH);
 
+    int triangleCount() const { return count; }
+    int vertexCount() const { return numVerts; }
+    int nodeCount() const { return numNodes; }
+
+    // Single triangle projection test (Wald), the scalar alternative to the packets.
     struct TriangleFast
     {
         COMMON_FUNC TriangleFast() {}
@@ -97,15 +163,44 @@ private:
         float  m_cnu, m_cnv;
     };
 
-    COMMON_FUNC bool hit(const Rayf& r, const TriangleFast& accel, float& t, Vector3f& bary) const;
+    COMMON_FUNC static bool hit(const Rayf& r, const TriangleFast& accel, float t_min, float t_max, float& t, Vector3f& bary);
+
+    // Leaves hold at most this many triangles, intersected as one packet.
+    static const int PacketWidth = PRIMITIVE_PACKET_WIDTH;
+
+private:
 
+    // Build input, released by complete().
     std::vector<Vector3f> verts;
     std::vector<Vector3f> normals;
     std::vector<Vector2f> texCoords;
     std::vector<TriIndex> triangles;
+    StridedView<TriIndex> indexView;
+    int numIndexViewTriangles = 0;
 
+    // Triangles in BVH leaf order, PacketWidth per packet.  A leaf's primitivesOffset is
+    // the index of its packet; triIndices has an entry for every lane.
     int count = 0;
-    TriangleFast* triAccel = nullptr;
+    int numPackets = 0;
+    TrianglePacket<PacketWidth>* packets = nullptr;
+    TriIndex* triIndices = nullptr;
+
+    // Vertex attributes, in the owned arrays or in memory kept alive by owner.
+    int numVerts = 0;
+    StridedView<Vector3f> positionView;
+    StridedView<Vector3f> normalView;
+    StridedView<Vector2f> texCoordView;
+    Vector3f* vertPositions = nullptr;
+    Vector3f* vertNormals = nullptr;
+    Vector2f* vertTexCoords = nullptr;
+    std::shared_ptr<const void> owner;
+
+    LinearBVHNode* nodes = nullptr;
+    int numNodes = 0;
+
+    // The packets, vertex attributes and nodes are in the buffer of the stream the mesh
+    // was read from.
+    bool arraysInStream = false;
 
     Material* material = nullptr;
 
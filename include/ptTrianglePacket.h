@@ -0,0 +1,224 @@
+/*
+ * CUDA (GPU) Pathtracer based on Peter Shirley's 'Ray Tracing in One Weekend' e-book
+ * series.
+ *
+ * Copyright (C) 2017 by Rick Weyrauch - rpweyrauch@gmail.com
+ *
+ * This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+ */
+
+#ifndef PATHTRACER_TRIANGLEPACKET_H
+#define PATHTRACER_TRIANGLEPACKET_H
+
+#include <cfloat>
+#if !defined(__CUDA_ARCH__) && (defined(__SSE__) || defined(__AVX__))
+#include <immintrin.h>
+#endif
+#include "ptCudaCommon.h"
+#include "ptVector3.h"
+#include "ptRay.h"
+
+//
+// N triangles stored structure-of-arrays (first vertex and the two edges leaving it) so
+// that one ray can be tested against all of them at once (SSE for N = 4, AVX for N = 8).
+// Unused lanes have zero edges and are never hit.
+//
+template <int N>
+struct TrianglePacket
+{
+    float v0[3][N];
+    float e1[3][N];
+    float e2[3][N];
+
+    COMMON_FUNC void set(int lane, const Vector3f& p0, const Vector3f& p1, const Vector3f& p2)
+    {
+        for (int a = 0; a < 3; a++)
+        {
+            v0[a][lane] = p0[a];
+            e1[a][lane] = p1[a] - p0[a];
+            e2[a][lane] = p2[a] - p0[a];
+        }
+    }
+
+    COMMON_FUNC void clear(int lane)
+    {
+        for (int a = 0; a < 3; a++)
+        {
+            v0[a][lane] = 0;
+            e1[a][lane] = 0;
+            e2[a][lane] = 0;
+        }
+    }
+};
+
+//
+// Two sided Moller-Trumbore test of one ray against the N triangles of a packet.
+// Returns the lane of the nearest hit in (tmin, tmax), or -1, and on a hit narrows tmax
+// to its distance and sets the barycentric coordinates of the second and third vertex.
+//
+template <int N>
+COMMON_FUNC inline int intersectTrianglesScalar(const TrianglePacket<N>& packet, const Rayf& r, float tmin, float& tmax,
+                                                float& u, float& v)
+{
+    const Vector3f& o = r.origin();
+    const Vector3f& d = r.direction();
+
+    int lane = -1;
+    for (int i = 0; i < N; i++)
+    {
+        const Vector3f e1(packet.e1[0][i], packet.e1[1][i], packet.e1[2][i]);
+        const Vector3f e2(packet.e2[0][i], packet.e2[1][i], packet.e2[2][i]);
+        const Vector3f pvec = cross(d, e2);
+        const float invDet = 1 / dot(e1, pvec);
+
+        const Vector3f tvec(o.x() - packet.v0[0][i], o.y() - packet.v0[1][i], o.z() - packet.v0[2][i]);
+        const float b1 = dot(tvec, pvec) * invDet;
+        const Vector3f qvec = cross(tvec, e1);
+        const float b2 = dot(d, qvec) * invDet;
+        const float t = dot(e2, qvec) * invDet;
+
+        // Written so that the NaNs of an empty lane fail.
+        if (b1 >= 0 && b2 >= 0 && b1 + b2 <= 1 && t > tmin && t < tmax)
+        {
+            lane = i;
+            tmax = t;
+            u = b1;
+            v = b2;
+        }
+    }
+    return lane;
+}
+
+#ifndef __CUDA_ARCH__
+
+inline int intersectTrianglesSimd(const TrianglePacket<4>& packet, const Rayf& r, float tmin, float& tmax, float& u, float& v)
+{
+#if defined(__SSE__)
+    const __m128 dx = _mm_set1_ps(r.direction().x());
+    const __m128 dy = _mm_set1_ps(r.direction().y());
+    const __m128 dz = _mm_set1_ps(r.direction().z());
+    const __m128 e1x = _mm_loadu_ps(packet.e1[0]);
+    const __m128 e1y = _mm_loadu_ps(packet.e1[1]);
+    const __m128 e1z = _mm_loadu_ps(packet.e1[2]);
+    const __m128 e2x = _mm_loadu_ps(packet.e2[0]);
+    const __m128 e2y = _mm_loadu_ps(packet.e2[1]);
+    const __m128 e2z = _mm_loadu_ps(packet.e2[2]);
+
+    const __m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+    const __m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+    const __m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+    const __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+    const __m128 invDet = _mm_div_ps(_mm_set1_ps(1.0f), det);
+
+    const __m128 tx = _mm_sub_ps(_mm_set1_ps(r.origin().x()), _mm_loadu_ps(packet.v0[0]));
+    const __m128 ty = _mm_sub_ps(_mm_set1_ps(r.origin().y()), _mm_loadu_ps(packet.v0[1]));
+    const __m128 tz = _mm_sub_ps(_mm_set1_ps(r.origin().z()), _mm_loadu_ps(packet.v0[2]));
+    const __m128 b1 = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(tx, px), _mm_mul_ps(ty, py)), _mm_mul_ps(tz, pz)), invDet);
+
+    const __m128 qx = _mm_sub_ps(_mm_mul_ps(ty, e1z), _mm_mul_ps(tz, e1y));
+    const __m128 qy = _mm_sub_ps(_mm_mul_ps(tz, e1x), _mm_mul_ps(tx, e1z));
+    const __m128 qz = _mm_sub_ps(_mm_mul_ps(tx, e1y), _mm_mul_ps(ty, e1x));
+    const __m128 b2 = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), invDet);
+    const __m128 t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), invDet);
+
+    // Ordered compares, so the NaNs of an empty lane fail.
+    const __m128 zero = _mm_setzero_ps();
+    __m128 mask = _mm_and_ps(_mm_cmpge_ps(b1, zero), _mm_cmpge_ps(b2, zero));
+    mask = _mm_and_ps(mask, _mm_cmple_ps(_mm_add_ps(b1, b2), _mm_set1_ps(1.0f)));
+    mask = _mm_and_ps(mask, _mm_and_ps(_mm_cmpgt_ps(t, _mm_set1_ps(tmin)), _mm_cmplt_ps(t, _mm_set1_ps(tmax))));
+    const int hits = _mm_movemask_ps(mask);
+    if (hits == 0)
+        return -1;
+
+    // Nearest hit: horizontal minimum of the masked distances.
+    const __m128 tHit = _mm_or_ps(_mm_and_ps(mask, t), _mm_andnot_ps(mask, _mm_set1_ps(FLT_MAX)));
+    __m128 tMin = _mm_min_ps(tHit, _mm_shuffle_ps(tHit, tHit, _MM_SHUFFLE(2, 3, 0, 1)));
+    tMin = _mm_min_ps(tMin, _mm_shuffle_ps(tMin, tMin, _MM_SHUFFLE(1, 0, 3, 2)));
+    const int lane = __builtin_ctz(_mm_movemask_ps(_mm_cmpeq_ps(tHit, tMin)) & hits);
+
+    float ts[4], b1s[4], b2s[4];
+    _mm_storeu_ps(ts, t);
+    _mm_storeu_ps(b1s, b1);
+    _mm_storeu_ps(b2s, b2);
+    tmax = ts[lane];
+    u = b1s[lane];
+    v = b2s[lane];
+    return lane;
+#else
+    return intersectTrianglesScalar(packet, r, tmin, tmax, u, v);
+#endif
+}
+
+inline int intersectTrianglesSimd(const TrianglePacket<8>& packet, const Rayf& r, float tmin, float& tmax, float& u, float& v)
+{
+#if defined(__AVX__)
+    const __m256 dx = _mm256_set1_ps(r.direction().x());
+    const __m256 dy = _mm256_set1_ps(r.direction().y());
+    const __m256 dz = _mm256_set1_ps(r.direction().z());
+    const __m256 e1x = _mm256_loadu_ps(packet.e1[0]);
+    const __m256 e1y = _mm256_loadu_ps(packet.e1[1]);
+    const __m256 e1z = _mm256_loadu_ps(packet.e1[2]);
+    const __m256 e2x = _mm256_loadu_ps(packet.e2[0]);
+    const __m256 e2y = _mm256_loadu_ps(packet.e2[1]);
+    const __m256 e2z = _mm256_loadu_ps(packet.e2[2]);
+
+    const __m256 px = _mm256_sub_ps(_mm256_mul_ps(dy, e2z), _mm256_mul_ps(dz, e2y));
+    const __m256 py = _mm256_sub_ps(_mm256_mul_ps(dz, e2x), _mm256_mul_ps(dx, e2z));
+    const __m256 pz = _mm256_sub_ps(_mm256_mul_ps(dx, e2y), _mm256_mul_ps(dy, e2x));
+    const __m256 det = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e1x, px), _mm256_mul_ps(e1y, py)), _mm256_mul_ps(e1z, pz));
+    const __m256 invDet = _mm256_div_ps(_mm256_set1_ps(1.0f), det);
+
+    const __m256 tx = _mm256_sub_ps(_mm256_set1_ps(r.origin().x()), _mm256_loadu_ps(packet.v0[0]));
+    const __m256 ty = _mm256_sub_ps(_mm256_set1_ps(r.origin().y()), _mm256_loadu_ps(packet.v0[1]));
+    const __m256 tz = _mm256_sub_ps(_mm256_set1_ps(r.origin().z()), _mm256_loadu_ps(packet.v0[2]));
+    const __m256 b1 = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(tx, px), _mm256_mul_ps(ty, py)), _mm256_mul_ps(tz, pz)), invDet);
+
+    const __m256 qx = _mm256_sub_ps(_mm256_mul_ps(ty, e1z), _mm256_mul_ps(tz, e1y));
+    const __m256 qy = _mm256_sub_ps(_mm256_mul_ps(tz, e1x), _mm256_mul_ps(tx, e1z));
+    const __m256 qz = _mm256_sub_ps(_mm256_mul_ps(tx, e1y), _mm256_mul_ps(ty, e1x));
+    const __m256 b2 = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, qx), _mm256_mul_ps(dy, qy)), _mm256_mul_ps(dz, qz)), invDet);
+    const __m256 t = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e2x, qx), _mm256_mul_ps(e2y, qy)), _mm256_mul_ps(e2z, qz)), invDet);
+
+    // Ordered compares, so the NaNs of an empty lane fail.
+    const __m256 zero = _mm256_setzero_ps();
+    __m256 mask = _mm256_and_ps(_mm256_cmp_ps(b1, zero, _CMP_GE_OQ), _mm256_cmp_ps(b2, zero, _CMP_GE_OQ));
+    mask = _mm256_and_ps(mask, _mm256_cmp_ps(_mm256_add_ps(b1, b2), _mm256_set1_ps(1.0f), _CMP_LE_OQ));
+    mask = _mm256_and_ps(mask, _mm256_and_ps(_mm256_cmp_ps(t, _mm256_set1_ps(tmin), _CMP_GT_OQ),
+                                             _mm256_cmp_ps(t, _mm256_set1_ps(tmax), _CMP_LT_OQ)));
+    const int hits = _mm256_movemask_ps(mask);
+    if (hits == 0)
+        return -1;
+
+    // Nearest hit: horizontal minimum of the masked distances.
+    const __m256 tHit = _mm256_blendv_ps(_mm256_set1_ps(FLT_MAX), t, mask);
+    __m256 tMin = _mm256_min_ps(tHit, _mm256_permute2f128_ps(tHit, tHit, 1));
+    tMin = _mm256_min_ps(tMin, _mm256_shuffle_ps(tMin, tMin, _MM_SHUFFLE(2, 3, 0, 1)));
+    tMin = _mm256_min_ps(tMin, _mm256_shuffle_ps(tMin, tMin, _MM_SHUFFLE(1, 0, 3, 2)));
+    const int lane = __builtin_ctz(_mm256_movemask_ps(_mm256_cmp_ps(tHit, tMin, _CMP_EQ_OQ)) & hits);
+
+    float ts[8], b1s[8], b2s[8];
+    _mm256_storeu_ps(ts, t);
+    _mm256_storeu_ps(b1s, b1);
+    _mm256_storeu_ps(b2s, b2);
+    tmax = ts[lane];
+    u = b1s[lane];
+    v = b2s[lane];
+    return lane;
+#else
+    return intersectTrianglesScalar(packet, r, tmin, tmax, u, v);
+#endif
+}
+
+#endif // __CUDA_ARCH__
+
+template <int N>
+COMMON_FUNC inline int intersectTriangles(const TrianglePacket<N>& packet, const Rayf& r, float tmin, float& tmax, float& u, float& v)
+{
+#ifdef __CUDA_ARCH__
+    return intersectTrianglesScalar(packet, r, tmin, tmax, u, v);
+#else
+    return intersectTrianglesSimd(packet, r, tmin, tmax, u, v);
+#endif
+}
+
+#endif //PATHTRACER_TRIANGLEPACKET_H
@@ -0,0 +1,86 @@
+/*
+ * CUDA (GPU) Pathtracer based on Peter Shirley's 'Ray Tracing in One Weekend' e-book
+ * series.
+ *
+ * Copyright (C) 2017 by Rick Weyrauch - rpweyrauch@gmail.com
+ *
+ * This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+ */
+
+#ifndef PATHTRACER_WIDEBVH_H
+#define PATHTRACER_WIDEBVH_H
+
+#include <vector>
+#include "ptCudaCommon.h"
+#include "ptHitable.h"
+#include "ptAABB.h"
+#include "ptBVH.h"
+
+//
+// N-wide BVH node.  Child bounds are stored structure-of-arrays so that the
+// slab test can be run on all N children at once (SSE for N = 4, AVX for N = 8).
+//
+// Each child slot is one of:
+//   interior: numPrims == 0, child = index of the child node
+//   leaf:     numPrims  > 0, child = offset of the first primitive
+//   empty:    numPrims == 0, child = -1 (inverted bounds, never hit)
+//
+template <int N>
+struct WideBVHNode
+{
+    float bmin[3][N];
+    float bmax[3][N];
+    int32_t child[N];
+    uint16_t numPrims[N];
+};
+
+template <int N>
+class WideBVH : public Hitable
+{
+public:
+    COMMON_FUNC WideBVH() {}
+
+    // Collapse a binary BVH.  The primitives are shared with the source tree.
+    explicit WideBVH(const BVH& bvh);
+
+    COMMON_FUNC ~WideBVH() override
+    {
+        delete[] m_prims;
+        delete[] m_records;
+        if (!m_arraysInStream)
+            delete[] m_nodes;
+    }
+
+    COMMON_FUNC bool hit(const Rayf& r, float tmin, float tmax, HitRecord& rec, RNG& rng) const override;
+    COMMON_FUNC bool bounds(float t0, float t1, AABB<float>& bbox) const override;
+
+    COMMON_FUNC float pdfValue(const Vector3f& o, const Vector3f& v, RNG& rng) const override;
+    COMMON_FUNC Vector3f random(const Vector3f& o, RNG& rng) const override;
+
+    COMMON_FUNC bool serialize(Stream* pStream) const override;
+    COMMON_FUNC bool deserialize(Stream *pStream) override;
+
+    COMMON_FUNC int typeId() const override { return (N == 4) ? BVH4TypeId : BVH8TypeId; }
+
+    int nodeCount() const { return m_numNodes; }
+
+private:
+
+    int collapse(const LinearBVHNode* binaryNodes, uint32_t index, std::vector<WideBVHNode<N>>& wideNodes);
+
+    Hitable** m_prims = nullptr;
+    Primitive* m_records = nullptr;
+    int m_numPrims = 0;
+
+    WideBVHNode<N>* m_nodes = nullptr;
+    int m_numNodes = 0;
+    // m_nodes is in the buffer of the stream the tree was read from.
+    bool m_arraysInStream = false;
+
+    AABB<float> m_bbox;
+};
+
+typedef WideBVH<4> BVH4;
+typedef WideBVH<8> BVH8;
+
+#endif //PATHTRACER_WIDEBVH_H
@@ -0,0 +1,122 @@
+/*
+ * CUDA (GPU) Pathtracer based on Peter Shirley's 'Ray Tracing in One Weekend' e-book
+ * series.
+ *
+ * Copyright (C) 2017 by Rick Weyrauch - rpweyrauch@gmail.com
+ *
+ * This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+ */
+
+#include <algorithm>
+#include "ptArena.h"
+
+static thread_local SceneArena* s_currentArena = nullptr;
+
+// Chunk headers are padded so that allocations after them stay 16 byte aligned.
+static const size_t CHUNK_HEADER_SIZE = 32;
+
+static size_t alignUp(size_t size, size_t alignment)
+{
+    return (size + alignment - 1) & ~(alignment - 1);
+}
+
+SceneArena::SceneArena(size_t chunkSize) :
+    m_chunkSize(std::max<size_t>(chunkSize, 4096))
+{
+    static_assert(sizeof(Chunk) <= CHUNK_HEADER_SIZE, "Chunk header does not fit");
+}
+
+SceneArena::~SceneArena()
+{
+    release();
+}
+
+SceneArena* SceneArena::current()
+{
+    return s_currentArena;
+}
+
+SceneArena::Scope::Scope(SceneArena* arena) :
+    m_previous(s_currentArena)
+{
+    s_currentArena = arena;
+}
+
+SceneArena::Scope::~Scope()
+{
+    s_currentArena = m_previous;
+}
+
+SceneArena::Header* SceneArena::allocate(size_t size)
+{
+    const size_t bytes = alignUp(sizeof(Header) + size, alignof(Header));
+
+    if (m_chunks == nullptr || m_chunks->used + bytes > m_chunks->size)
+    {
+        // Oversized objects get a chunk of their own.
+        const size_t chunkSize = std::max(m_chunkSize, CHUNK_HEADER_SIZE + bytes);
+        Chunk* chunk = static_cast<Chunk*>(::operator new(chunkSize));
+        chunk->next = m_chunks;
+        chunk->size = chunkSize;
+        chunk->used = CHUNK_HEADER_SIZE;
+        m_chunks = chunk;
+        m_bytesReserved += chunkSize;
+    }
+
+    Header* header = reinterpret_cast<Header*>(reinterpret_cast<char*>(m_chunks) + m_chunks->used);
+    m_chunks->used += bytes;
+    m_bytesAllocated += bytes;
+
+    header->arena = this;
+    header->next = m_objects;
+    header->destroyed = false;
+    m_objects = header;
+    m_numObjects++;
+    return header;
+}
+
+void* SceneArena::allocateObject(size_t size)
+{
+    if (s_currentArena != nullptr)
+        return s_currentArena->allocate(size) + 1;
+
+    Header* header = static_cast<Header*>(::operator new(sizeof(Header) + size));
+    header->arena = nullptr;
+    header->next = nullptr;
+    header->destroyed = false;
+    return header + 1;
+}
+
+void SceneArena::freeObject(void* p)
+{
+    if (p == nullptr)
+        return;
+    Header* header = static_cast<Header*>(p) - 1;
+    if (header->arena != nullptr)
+    {
+        header->destroyed = true;
+        return;
+    }
+    ::operator delete(header);
+}
+
+void SceneArena::release()
+{
+    // Newest first, so objects go before anything they were built from.
+    for (Header* header = m_objects; header != nullptr; header = header->next)
+    {
+        if (!header->destroyed)
+            reinterpret_cast<ArenaObject*>(header + 1)->~ArenaObject();
+    }
+    m_objects = nullptr;
+    m_numObjects = 0;
+
+    while (m_chunks != nullptr)
+    {
+        Chunk* next = m_chunks->next;
+        ::operator delete(m_chunks);
+        m_chunks = next;
+    }
+    m_bytesAllocated = 0;
+    m_bytesReserved = 0;
+}
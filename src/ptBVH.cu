@@ -7,123 +7,524 @@
  * This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
  */
 
-#include "ptQuickSort.h"
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <cfloat>
 #include "ptRNG.h"
 #include "ptBVH.h"
 #include "ptHitable.h"
 
-BVH::BVH(Hitable** list, int length, float time0, float time1, RNG& rng)
+static const int NUM_SAH_BUCKETS = 12;
+
+BVH::BVH(Hitable** list, int length, float time0, float time1, BVHBuildMethod method, int maxPrimsInLeaf) :
+    m_method(method),
+    m_maxPrimsInLeaf(std::max(1, maxPrimsInLeaf))
+{
+    build(list, length, time0, time1);
+}
+
+void BVH::build(Hitable** list, int length, float time0, float time1)
 {
-    int axis = int(3 * rng.rand());
-    quickSort(list, 0, length-1, axis);
-    const auto n = length;
-    if (n == 1)
+    if (length <= 0)
+        return;
+
+    std::vector<BVHPrimitiveInfo> primInfo(length);
+#pragma omp parallel for schedule(static)
+    for (int i = 0; i < length; i++)
     {
-        left = right = list[0];
+        AABB<float> box;
+        list[i]->bounds(time0, time1, box);
+        primInfo[i] = BVHPrimitiveInfo(i, box);
     }
-    else if (n == 2)
+
+    // The primitives are stored in leaf order; the caller's list is left untouched.
+    std::vector<LinearBVHNode> nodes;
+    m_sahCost = BuildBVHNodes(primInfo, m_method, m_maxPrimsInLeaf, nodes);
+    m_buildSahCost = m_sahCost;
+
+    m_numPrims = length;
+    m_prims = new Hitable*[length];
+    for (int i = 0; i < length; i++)
+        m_prims[i] = list[primInfo[i].index];
+
+    // Group the primitives of each leaf by type, so that consecutive tests in hit() take
+    // the same branch of the dispatch.
+    for (const LinearBVHNode& node : nodes)
     {
-        left = list[0];
-        right = list[1];
+        if (node.numPrims > 1)
+        {
+            std::stable_sort(m_prims + node.primitivesOffset, m_prims + node.primitivesOffset + node.numPrims,
+                             [](const Hitable* a, const Hitable* b) { return MakePrimitive(a).type < MakePrimitive(b).type; });
+        }
     }
-    else
+    m_records = CreatePrimitives(m_prims, m_numPrims);
+
+    m_numNodes = static_cast<int>(nodes.size());
+    m_nodes = new LinearBVHNode[m_numNodes];
+    std::copy(nodes.begin(), nodes.end(), m_nodes);
+}
+
+void BVH::rebuild(float time0, float time1)
+{
+    std::vector<Hitable*> list(m_prims, m_prims + m_numPrims);
+    delete[] m_prims;
+    delete[] m_records;
+    if (!m_arraysInStream)
+        delete[] m_nodes;
+    m_prims = nullptr;
+    m_records = nullptr;
+    m_nodes = nullptr;
+    m_arraysInStream = false;
+    build(list.data(), static_cast<int>(list.size()), time0, time1);
+}
+
+bool BVH::refit(float time0, float time1, float rebuildRatio)
+{
+    if (m_nodes == nullptr)
+        return false;
+
+    const int numNodes = m_numNodes;
+
+    // Parents from the depth-first layout: the first child follows its parent.
+    std::vector<int> parent(numNodes);
+    parent[0] = -1;
+#pragma omp parallel for schedule(static)
+    for (int i = 0; i < numNodes; i++)
+    {
+        if (m_nodes[i].numPrims == 0)
+        {
+            parent[i + 1] = i;
+            parent[m_nodes[i].secondChildOffset] = i;
+        }
+    }
+
+    std::vector<float> cost(numNodes);
+    std::unique_ptr<std::atomic<int>[]> visits(new std::atomic<int>[numNodes]);
+    for (int i = 0; i < numNodes; i++)
+        visits[i].store(0, std::memory_order_relaxed);
+
+    // Every leaf refits its own bounds and walks up; the second child to arrive at a
+    // node finishes it.
+#pragma omp parallel for schedule(dynamic, 256)
+    for (int i = 0; i < numNodes; i++)
+    {
+        LinearBVHNode& leaf = m_nodes[i];
+        if (leaf.numPrims == 0)
+            continue;
+
+        AABB<float> bounds;
+        m_prims[leaf.primitivesOffset]->bounds(time0, time1, bounds);
+        for (int p = 1; p < leaf.numPrims; p++)
+        {
+            AABB<float> box;
+            m_prims[leaf.primitivesOffset + p]->bounds(time0, time1, box);
+            bounds = join(bounds, box);
+        }
+        leaf.bounds = bounds;
+        cost[i] = BVH_INTERSECT_COST * leaf.numPrims * bounds.surfaceArea();
+
+        int node = parent[i];
+        while (node >= 0)
+        {
+            if (visits[node].fetch_add(1, std::memory_order_acq_rel) == 0)
+                break;
+
+            LinearBVHNode& interior = m_nodes[node];
+            const uint32_t c0 = node + 1;
+            const uint32_t c1 = interior.secondChildOffset;
+            interior.bounds = join(m_nodes[c0].bounds, m_nodes[c1].bounds);
+            cost[node] = BVH_TRAVERSAL_COST * interior.bounds.surfaceArea() + cost[c0] + cost[c1];
+            node = parent[node];
+        }
+    }
+
+    // The inline copies of moved primitives are stale.
+#pragma omp parallel for schedule(static)
+    for (int i = 0; i < m_numPrims; i++)
+        m_records[i] = MakePrimitive(m_prims[i]);
+
+    m_sahCost = cost[0] / m_nodes[0].bounds.surfaceArea();
+    if (m_buildSahCost <= 0)
+        m_buildSahCost = m_sahCost;
+
+    // The topology no longer fits the primitives well enough; start over.
+    if (m_sahCost > rebuildRatio * m_buildSahCost)
     {
-        auto leftNodes = &list[0];
-        int leftLen = n/2;
-        left = new BVH(leftNodes, leftLen, time0, time1, rng);
-        auto rightNodes = &list[n/2];
-        int rightLen = length - n / 2;
-        right = new BVH(rightNodes, rightLen, time0, time1, rng);
+        rebuild(time0, time1);
+        return true;
     }
-    AABB<float> boxLeft, boxRight;
-    left->bounds(time0, time1, boxLeft);
-    right->bounds(time0, time1, boxRight);
+    return false;
+}
+
+//
+// Top-down (median or binned SAH) build over primitive bounds.  The primitive info is
+// partitioned in place, so on return it is in leaf order.
+//
+struct TopDownBuilder
+{
+    TopDownBuilder(std::vector<BVHPrimitiveInfo>& info, BVHBuildMethod buildMethod, int maxPrims, int width) :
+        primInfo(info),
+        method(buildMethod),
+        maxPrimsInLeaf(maxPrims),
+        packetWidth(width) {}
+
+    BVHBuildNode* recursiveBuild(int start, int end, int depth);
+    BVHBuildNode* createLeaf(int start, int end, const AABB<float>& bounds);
+    float computeCost(const BVHBuildNode* node) const;
+    uint32_t flatten(const BVHBuildNode* node, LinearBVHNode* nodes, uint32_t* offset);
+    void deleteTree(BVHBuildNode* node);
 
-    m_bbox = join<float>(boxLeft, boxRight);
+    std::vector<BVHPrimitiveInfo>& primInfo;
+    BVHBuildMethod method;
+    int maxPrimsInLeaf;
+    int packetWidth;
+    int numNodes = 0;
+};
+
+BVHBuildNode* TopDownBuilder::createLeaf(int start, int end, const AABB<float>& bounds)
+{
+    auto node = new BVHBuildNode();
+    node->bounds = bounds;
+    node->numPrims = end - start;
+    node->firstPrimOffset = start;
+    numNodes++;
+    return node;
 }
 
-bool BVH::hit(const Rayf &r, float tmin, float tmax, HitRecord &rec, RNG& rng) const
+BVHBuildNode* TopDownBuilder::recursiveBuild(int start, int end, int depth)
 {
-    if (m_bbox.hit(r, tmin, tmax))
+    AABB<float> bounds = primInfo[start].bounds;
+    AABB<float> centroidBounds(primInfo[start].centroid, primInfo[start].centroid);
+    for (int i = start + 1; i < end; i++)
+    {
+        bounds = join(bounds, primInfo[i].bounds);
+        centroidBounds = join(centroidBounds, AABB<float>(primInfo[i].centroid, primInfo[i].centroid));
+    }
+
+    const int numPrims = end - start;
+    if (numPrims == 1)
+    {
+        return createLeaf(start, end, bounds);
+    }
+
+    int axis = centroidBounds.maximumExtent();
+    int mid = (start + end) / 2;
+
+    if (centroidBounds.max()[axis] == centroidBounds.min()[axis])
+    {
+        // All centroids coincide; no split can separate the primitives.
+        if (numPrims <= maxPrimsInLeaf)
+            return createLeaf(start, end, bounds);
+    }
+    else if (method == BVHBuildMedian || depth >= BVH_MAX_DEPTH / 2)
     {
-        HitRecord leftRec, rightRec;
-        bool hitLeft = left->hit(r, tmin, tmax, leftRec, rng);
-        bool hitRight = right->hit(r, tmin, tmax, rightRec, rng);
-        if (hitLeft && hitRight)
+        // Median splits keep the remaining subtree balanced, bounding the tree depth.
+        if (numPrims <= maxPrimsInLeaf)
+            return createLeaf(start, end, bounds);
+
+        std::nth_element(&primInfo[start], &primInfo[mid], &primInfo[end-1]+1,
+                         [axis](const BVHPrimitiveInfo& a, const BVHPrimitiveInfo& b) {
+                             return a.centroid[axis] < b.centroid[axis];
+                         });
+    }
+    else
+    {
+        // Binned SAH: evaluate every bucket boundary along all three axes.
+        struct Bucket
         {
-            if (leftRec.t < rightRec.t)
-                rec = leftRec;
-            else
-                rec = rightRec;
-            return true;
+            int count = 0;
+            AABB<float> bounds;
+        };
+
+        float bestCost = FLT_MAX;
+        int bestAxis = -1;
+        int bestSplit = -1;
+
+        for (int dim = 0; dim < 3; dim++)
+        {
+            const float cmin = centroidBounds.min()[dim];
+            const float extent = centroidBounds.max()[dim] - cmin;
+            if (extent <= 0)
+                continue;
+
+            Bucket buckets[NUM_SAH_BUCKETS];
+            for (int i = start; i < end; i++)
+            {
+                int b = int(NUM_SAH_BUCKETS * ((primInfo[i].centroid[dim] - cmin) / extent));
+                b = Clamp(b, 0, NUM_SAH_BUCKETS - 1);
+                if (buckets[b].count == 0)
+                    buckets[b].bounds = primInfo[i].bounds;
+                else
+                    buckets[b].bounds = join(buckets[b].bounds, primInfo[i].bounds);
+                buckets[b].count++;
+            }
+
+            // Sweep from the right to get the area/count of everything above each split.
+            float areaAbove[NUM_SAH_BUCKETS];
+            int countAbove[NUM_SAH_BUCKETS];
+            AABB<float> accum;
+            int accumCount = 0;
+            for (int b = NUM_SAH_BUCKETS - 1; b > 0; b--)
+            {
+                if (buckets[b].count > 0)
+                {
+                    accum = (accumCount == 0) ? buckets[b].bounds : join(accum, buckets[b].bounds);
+                    accumCount += buckets[b].count;
+                }
+                areaAbove[b] = (accumCount > 0) ? accum.surfaceArea() : 0;
+                countAbove[b] = accumCount;
+            }
+
+            accumCount = 0;
+            for (int b = 0; b < NUM_SAH_BUCKETS - 1; b++)
+            {
+                if (buckets[b].count > 0)
+                {
+                    accum = (accumCount == 0) ? buckets[b].bounds : join(accum, buckets[b].bounds);
+                    accumCount += buckets[b].count;
+                }
+                if (accumCount == 0 || countAbove[b+1] == 0)
+                    continue;
+
+                const float cost = accumCount * accum.surfaceArea() + countAbove[b+1] * areaAbove[b+1];
+                if (cost < bestCost)
+                {
+                    bestCost = cost;
+                    bestAxis = dim;
+                    bestSplit = b;
+                }
+            }
+        }
+
+        const float leafCost = BVHLeafCost(numPrims, packetWidth);
+        bestCost = BVH_TRAVERSAL_COST + BVH_INTERSECT_COST * bestCost / bounds.surfaceArea();
+
+        if (bestAxis < 0 || (numPrims <= maxPrimsInLeaf && leafCost <= bestCost))
+        {
+            if (numPrims <= maxPrimsInLeaf)
+                return createLeaf(start, end, bounds);
         }
-        else if (hitLeft)
+        else
         {
-            rec = leftRec;
-            return true;
+            const float cmin = centroidBounds.min()[bestAxis];
+            const float extent = centroidBounds.max()[bestAxis] - cmin;
+            BVHPrimitiveInfo* pmid = std::partition(&primInfo[start], &primInfo[end-1]+1,
+                [=](const BVHPrimitiveInfo& pi) {
+                    int b = int(NUM_SAH_BUCKETS * ((pi.centroid[bestAxis] - cmin) / extent));
+                    b = Clamp(b, 0, NUM_SAH_BUCKETS - 1);
+                    return b <= bestSplit;
+                });
+            mid = int(pmid - &primInfo[0]);
+            axis = bestAxis;
+            if (mid == start || mid == end)
+                mid = (start + end) / 2;
         }
-        else if (hitRight)
+    }
+
+    auto node = new BVHBuildNode();
+    numNodes++;
+    node->bounds = bounds;
+    node->splitAxis = axis;
+    node->children[0] = recursiveBuild(start, mid, depth + 1);
+    node->children[1] = recursiveBuild(mid, end, depth + 1);
+    return node;
+}
+
+float TopDownBuilder::computeCost(const BVHBuildNode* node) const
+{
+    if (node->numPrims > 0)
+        return BVHLeafCost(node->numPrims, packetWidth) * node->bounds.surfaceArea();
+
+    return BVH_TRAVERSAL_COST * node->bounds.surfaceArea() +
+           computeCost(node->children[0]) + computeCost(node->children[1]);
+}
+
+uint32_t TopDownBuilder::flatten(const BVHBuildNode* node, LinearBVHNode* nodes, uint32_t* offset)
+{
+    LinearBVHNode* linearNode = &nodes[*offset];
+    linearNode->bounds = node->bounds;
+    linearNode->pad = 0;
+    const uint32_t myOffset = (*offset)++;
+    if (node->numPrims > 0)
+    {
+        linearNode->primitivesOffset = static_cast<uint32_t>(node->firstPrimOffset);
+        linearNode->numPrims = static_cast<uint16_t>(node->numPrims);
+        linearNode->axis = 0;
+    }
+    else
+    {
+        linearNode->axis = static_cast<uint8_t>(node->splitAxis);
+        linearNode->numPrims = 0;
+        flatten(node->children[0], nodes, offset);
+        linearNode->secondChildOffset = flatten(node->children[1], nodes, offset);
+    }
+    return myOffset;
+}
+
+void TopDownBuilder::deleteTree(BVHBuildNode* node)
+{
+    if (node == nullptr)
+        return;
+    deleteTree(node->children[0]);
+    deleteTree(node->children[1]);
+    delete node;
+}
+
+float BuildBVHNodes(std::vector<BVHPrimitiveInfo>& primInfo, BVHBuildMethod method, int maxPrimsInLeaf, std::vector<LinearBVHNode>& nodes,
+                    int packetWidth)
+{
+    nodes.clear();
+    if (primInfo.empty())
+        return 0;
+
+    maxPrimsInLeaf = std::max(1, maxPrimsInLeaf);
+    packetWidth = std::max(1, packetWidth);
+    if (method == BVHBuildLBVH || method == BVHBuildLBVHTreelet)
+    {
+        float sahCost = 0;
+        if (BuildLBVHNodes(primInfo, method == BVHBuildLBVHTreelet, maxPrimsInLeaf, nodes, &sahCost, packetWidth))
+            return sahCost;
+
+        // Heavily clustered input can produce a radix tree deeper than the traversal
+        // stack; the top-down (SAH) build bounds the depth.
+        nodes.clear();
+        method = BVHBuildSAH;
+    }
+
+    TopDownBuilder builder(primInfo, method, maxPrimsInLeaf, packetWidth);
+    BVHBuildNode* root = builder.recursiveBuild(0, static_cast<int>(primInfo.size()), 0);
+    const float sahCost = builder.computeCost(root) / root->bounds.surfaceArea();
+
+    nodes.resize(builder.numNodes);
+    uint32_t offset = 0;
+    builder.flatten(root, nodes.data(), &offset);
+    builder.deleteTree(root);
+    return sahCost;
+}
+
+bool BVH::hit(const Rayf &r, float tmin, float tmax, HitRecord &rec, RNG& rng) const
+{
+    if (m_nodes == nullptr)
+        return false;
+
+    const Vector3f invDir(1 / r.direction().x(), 1 / r.direction().y(), 1 / r.direction().z());
+    const int dirIsNeg[3] = { invDir.x() < 0, invDir.y() < 0, invDir.z() < 0 };
+
+    bool hitAnything = false;
+    int toVisitOffset = 0;
+    uint32_t currentNodeIndex = 0;
+    uint32_t nodesToVisit[BVH_MAX_DEPTH];
+    while (true)
+    {
+        const LinearBVHNode* node = &m_nodes[currentNodeIndex];
+        if (node->bounds.hit(r, invDir, dirIsNeg, tmin, tmax))
         {
-            rec = rightRec;
-            return true;
+            if (node->numPrims > 0)
+            {
+                for (int i = 0; i < node->numPrims; i++)
+                {
+                    if (hitPrimitive(m_records[node->primitivesOffset + i], r, tmin, tmax, rec, rng))
+                    {
+                        hitAnything = true;
+                        tmax = rec.t;
+                    }
+                }
+                if (toVisitOffset == 0) break;
+                currentNodeIndex = nodesToVisit[--toVisitOffset];
+            }
+            else
+            {
+                // Visit the near child first, defer the far one.
+                if (dirIsNeg[node->axis])
+                {
+                    nodesToVisit[toVisitOffset++] = currentNodeIndex + 1;
+                    currentNodeIndex = node->secondChildOffset;
+                }
+                else
+                {
+                    nodesToVisit[toVisitOffset++] = node->secondChildOffset;
+                    currentNodeIndex = currentNodeIndex + 1;
+                }
+            }
         }
         else
-            return false;
+        {
+            if (toVisitOffset == 0) break;
+            currentNodeIndex = nodesToVisit[--toVisitOffset];
+        }
     }
-    return false;
+    return hitAnything;
 }
 
 bool BVH::bounds(float t0, float t1, AABB<float> &bbox) const
 {
-    bbox = m_bbox;
+    if (m_nodes == nullptr)
+        return false;
+
+    bbox = m_nodes[0].bounds;
     return true;
 }
 
 float BVH::pdfValue(const Vector3f& o, const Vector3f& v, RNG& rng) const
 {
-    float weight = 0.5f;
-    float sum = weight * left->pdfValue(o, v, rng) + weight * right->pdfValue(o, v, rng);
+    float weight = 1 / (float)m_numPrims;
+    float sum = 0;
+    for (int i = 0; i < m_numPrims; i++)
+    {
+        sum += weight * m_prims[i]->pdfValue(o, v, rng);
+    }
     return sum;
 }
 
 Vector3f BVH::random(const Vector3f& o, RNG& rng) const
 {
-    if (rng.rand() < 0.5f)
-        return left->random(o, rng);
-    else
-        return right->random(o, rng);
+    auto index = Clamp(int(rng.rand() * m_numPrims), 0, m_numPrims - 1);
+    return m_prims[index]->random(o, rng);
 }
 
 bool BVH::serialize(Stream *pStream) const
 {
-    if (pStream != nullptr)
+    if (pStream == nullptr)
         return false;
 
-    bool ok = true;
-    if (left != nullptr)
-        ok |= left->serialize(pStream);
-    else
-        ok |= pStream->writeNull();
-
-    if (right != nullptr)
-        ok |= right->serialize(pStream);
-    else
-        ok |= pStream->writeNull();
+    const int id = typeId();
+    bool ok = pStream->write(&id, sizeof(id));
+    ok &= pStream->write(&m_numPrims, sizeof(m_numPrims));
+    for (int i = 0; i < m_numPrims; i++)
+    {
+        ok &= m_prims[i]->serialize(pStream);
+    }
 
-    ok |= m_bbox.serialize(pStream);
+    ok &= pStream->write(&m_numNodes, sizeof(m_numNodes));
+    if (m_numNodes > 0)
+        ok &= pStream->writeArray(m_nodes, m_numNodes * sizeof(LinearBVHNode));
 
     return ok;
 }
 
 bool BVH::deserialize(Stream *pStream)
 {
-    if (pStream != nullptr)
+    if (pStream == nullptr)
         return false;
 
-    bool ok = true;
-    left = Hitable::Create(pStream);
-    right = Hitable::Create(pStream);
-    ok |= m_bbox.deserialize(pStream);
+    bool ok = pStream->read(&m_numPrims, sizeof(m_numPrims));
+    if (ok && (m_numPrims > 0))
+    {
+        m_prims = new Hitable*[m_numPrims];
+        for (int i = 0; i < m_numPrims; i++)
+        {
+            m_prims[i] = Hitable::Create(pStream);
+        }
+        m_records = CreatePrimitives(m_prims, m_numPrims);
+    }
+
+    ok &= pStream->read(&m_numNodes, sizeof(m_numNodes));
+    if (ok && (m_numNodes > 0))
+    {
+        ok &= pStream->readArray(m_nodes, m_numNodes);
+        m_arraysInStream = pStream->readsInPlace();
+    }
 
     return ok;
 }
@@ -0,0 +1,430 @@
+/*
+ * CUDA (GPU) Pathtracer based on Peter Shirley's 'Ray Tracing in One Weekend' e-book
+ * series.
+ *
+ * Copyright (C) 2017 by Rick Weyrauch - rpweyrauch@gmail.com
+ *
+ * This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+ */
+
+//
+// Ray tracing throughput benchmark for the acceleration structures (CPU only).
+//
+
+#include <iostream>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+#include <random>
+#include <cfloat>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "cxxopts.hpp"
+#include "ptRNG.h"
+#include "ptSphere.h"
+#include "ptSphereSet.h"
+#include "ptRectangle.h"
+#include "ptPrimitive.h"
+#include "ptMaterial.h"
+#include "ptBVH.h"
+#include "ptWideBVH.h"
+#include "ptMotionBVH.h"
+#include "ptTriangle.h"
+#include "ptTrianglePacket.h"
+
+struct TraceResult
+{
+    double seconds = 0;
+    int numHits = 0;
+    std::vector<float> t;
+};
+
+static TraceResult traceRays(const Hitable* world, const std::vector<Rayf>& rays, int numPasses)
+{
+    TraceResult result;
+    result.t.resize(rays.size(), FLT_MAX);
+
+    SimpleRng rng(3, 7);
+    const auto start = std::chrono::steady_clock::now();
+    for (int pass = 0; pass < numPasses; pass++)
+    {
+        for (size_t i = 0; i < rays.size(); i++)
+        {
+            HitRecord rec;
+            if (world->hit(rays[i], 0.001f, FLT_MAX, rec, rng))
+                result.t[i] = rec.t;
+        }
+    }
+    const auto end = std::chrono::steady_clock::now();
+    result.seconds = std::chrono::duration<double>(end - start).count();
+
+    for (auto t : result.t)
+    {
+        if (t < FLT_MAX) result.numHits++;
+    }
+    return result;
+}
+
+// Nearest hit of every ray against all triangles; closest(ray) returns FLT_MAX on a miss.
+template <typename Closest>
+static TraceResult intersectRays(const std::vector<Rayf>& rays, int numPasses, Closest closest)
+{
+    TraceResult result;
+    result.t.resize(rays.size(), FLT_MAX);
+
+    const auto start = std::chrono::steady_clock::now();
+    for (int pass = 0; pass < numPasses; pass++)
+    {
+        for (size_t i = 0; i < rays.size(); i++)
+            result.t[i] = closest(rays[i]);
+    }
+    const auto end = std::chrono::steady_clock::now();
+    result.seconds = std::chrono::duration<double>(end - start).count();
+
+    for (auto t : result.t)
+    {
+        if (t < FLT_MAX) result.numHits++;
+    }
+    return result;
+}
+
+// Distances further apart than tolerance (relative, absolute below 1) count as mismatches.
+static int countMismatches(const TraceResult& reference, const TraceResult& result, float tolerance = 0)
+{
+    int mismatches = 0;
+    for (size_t i = 0; i < reference.t.size(); i++)
+    {
+        if (fabsf(reference.t[i] - result.t[i]) > tolerance * std::max(reference.t[i], 1.0f)) mismatches++;
+    }
+    return mismatches;
+}
+
+static void reportTriangles(const char* name, const TraceResult& result, double numTests, const TraceResult& reference)
+{
+    // The algorithms round differently, so distances only have to agree closely.
+    const int mismatches = countMismatches(reference, result, 1e-4f);
+    std::cout << "  " << name << ": " << result.seconds << " s, " << numTests / result.seconds * 1e-6 << " M tests/s, "
+              << result.numHits << " hits, " << mismatches << " mismatches" << std::endl;
+}
+
+static void report(const char* name, int nodeCount, const TraceResult& result, size_t numRays, int numPasses, const TraceResult& reference,
+                   float tolerance = 0)
+{
+    const double mrays = (double)numRays * numPasses / result.seconds * 1e-6;
+    std::cout << "  " << name << ": " << nodeCount << " nodes, " << result.seconds << " s, "
+              << mrays << " Mrays/s, " << result.numHits << " hits, "
+              << countMismatches(reference, result, tolerance) << " mismatches" << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+    cxxopts::Options options("ptbenchmark", "Ray tracing throughput of the BVH variants.");
+    options.add_options()
+        ("p,primitives", "Number of spheres.", cxxopts::value<int>())
+        ("r,rays", "Number of rays per pass.", cxxopts::value<int>())
+        ("n,passes", "Number of passes over the rays.", cxxopts::value<int>())
+        ("t,threads", "Number of build threads.", cxxopts::value<int>())
+        ("f,frames", "Number of animation frames for the refit test.", cxxopts::value<int>())
+        ("j,jitter", "Distance the spheres move per animation frame.", cxxopts::value<float>())
+        ("m,motion", "Distance the spheres move during the shutter interval in the motion blur test.", cxxopts::value<float>())
+        ("b,bvh", "BVH build method used for tracing (sah, median, lbvh or treelet).", cxxopts::value<std::string>())
+        ("triangles", "Number of triangles in the intersection test.", cxxopts::value<int>())
+        ("mixed", "Number of mixed primitives in the dispatch test.", cxxopts::value<int>());
+
+    options.parse(argc, argv);
+
+    int numPrims = 100000;
+    int numRays = 1000000;
+    int numPasses = 1;
+    int numFrames = 4;
+    float jitter = 0.25f;
+    float motion = 5.0f;
+    int numTriangles = 1024;
+    int numMixed = 1024;
+    BVHBuildMethod method = BVHBuildSAH;
+
+    if (options.count("primitives"))
+        numPrims = options["primitives"].as<int>();
+    if (options.count("rays"))
+        numRays = options["rays"].as<int>();
+    if (options.count("passes"))
+        numPasses = options["passes"].as<int>();
+    if (options.count("frames"))
+        numFrames = options["frames"].as<int>();
+    if (options.count("jitter"))
+        jitter = options["jitter"].as<float>();
+    if (options.count("motion"))
+        motion = options["motion"].as<float>();
+    if (options.count("triangles"))
+        numTriangles = std::max(1, options["triangles"].as<int>());
+    if (options.count("mixed"))
+        numMixed = std::max(1, options["mixed"].as<int>());
+#ifdef _OPENMP
+    if (options.count("threads"))
+        omp_set_num_threads(options["threads"].as<int>());
+#endif
+    if (options.count("bvh"))
+    {
+        const std::string name = options["bvh"].as<std::string>();
+        if (name == "median")
+            method = BVHBuildMedian;
+        else if (name == "lbvh")
+            method = BVHBuildLBVH;
+        else if (name == "treelet")
+            method = BVHBuildLBVHTreelet;
+        else if (name != "sah")
+        {
+            std::cerr << "Unknown BVH build method: " << name << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    // Random spheres in a cube, rays from random points inside the cube in random directions.
+    const float extent = 100;
+    PcgRng rng(42);
+    Material* material = new Lambertian(new ConstantTexture(Vector3f(0.5f, 0.5f, 0.5f)));
+    Hitable** list = new Hitable*[numPrims];
+    for (int i = 0; i < numPrims; i++)
+    {
+        const Vector3f center(rng.rand() * extent, rng.rand() * extent, rng.rand() * extent);
+        list[i] = new Sphere(center, 0.05f + 0.45f * rng.rand(), material);
+    }
+
+    std::vector<Rayf> rays(numRays);
+    for (int i = 0; i < numRays; i++)
+    {
+        const Vector3f origin(rng.rand() * extent, rng.rand() * extent, rng.rand() * extent);
+        rays[i] = Rayf(origin, randomInUnitSphere(rng));
+    }
+
+    std::cout << "Building BVHs over " << numPrims << " spheres:" << std::endl;
+    const BVHBuildMethod methods[] = { BVHBuildMedian, BVHBuildSAH, BVHBuildLBVH, BVHBuildLBVHTreelet };
+    const char* methodNames[] = { "median", "sah", "lbvh", "treelet" };
+    for (int m = 0; m < 4; m++)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        const BVH built(list, numPrims, 0, 1, methods[m]);
+        const auto end = std::chrono::steady_clock::now();
+        std::cout << "  " << methodNames[m] << ": " << std::chrono::duration<double>(end - start).count() << " s, "
+                  << built.nodeCount() << " nodes, SAH cost " << built.sahCost() << std::endl;
+    }
+
+    const BVH bvh(list, numPrims, 0, 1, method);
+
+    const auto start = std::chrono::steady_clock::now();
+    BVH4 bvh4(bvh);
+    BVH8 bvh8(bvh);
+    const auto end = std::chrono::steady_clock::now();
+    std::cout << "Wide BVH collapse: " << std::chrono::duration<double>(end - start).count() << " s" << std::endl;
+
+    std::cout << "Tracing " << numRays << " rays x " << numPasses << " passes against " << numPrims << " spheres:" << std::endl;
+    const TraceResult reference = traceRays(&bvh, rays, numPasses);
+    report("BVH2", bvh.nodeCount(), reference, rays.size(), numPasses, reference);
+    report("BVH4", bvh4.nodeCount(), traceRays(&bvh4, rays, numPasses), rays.size(), numPasses, reference);
+    report("BVH8", bvh8.nodeCount(), traceRays(&bvh8, rays, numPasses), rays.size(), numPasses, reference);
+
+    const SphereSet sphereSet(list, numPrims, 0, 1, method);
+    // The packet test is not contracted into fused multiply-adds like Sphere::hit.
+    report("SphereSet", sphereSet.nodeCount(), traceRays(&sphereSet, rays, numPasses), rays.size(), numPasses, reference, 1e-4f);
+
+    // Animation: move every sphere a little each frame and refit instead of rebuilding.
+    std::cout << "Animating " << numFrames << " frames, spheres move up to " << jitter << " per frame:" << std::endl;
+    const std::vector<Rayf> frameRays(rays.begin(), rays.begin() + std::min<size_t>(rays.size(), 100000));
+    BVH animated(list, numPrims, 0, 1, method);
+    for (int frame = 1; frame <= numFrames; frame++)
+    {
+        for (int i = 0; i < numPrims; i++)
+        {
+            Sphere* sphere = static_cast<Sphere*>(list[i]);
+            sphere->setCenter(sphere->getCenter() + jitter * randomInUnitSphere(rng));
+        }
+
+        auto frameStart = std::chrono::steady_clock::now();
+        const bool refitRebuilt = animated.refit(0, 1);
+        const double refitTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - frameStart).count();
+
+        frameStart = std::chrono::steady_clock::now();
+        const BVH rebuilt(list, numPrims, 0, 1, method);
+        const double rebuildTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - frameStart).count();
+
+        const TraceResult rebuiltResult = traceRays(&rebuilt, frameRays, 1);
+        const TraceResult refitResult = traceRays(&animated, frameRays, 1);
+        std::cout << "  frame " << frame << ": " << (refitRebuilt ? "refit+rebuild " : "refit ") << refitTime << " s (SAH cost " << animated.sahCost()
+                  << ", " << animated.sahCost() / animated.buildSahCost() << "x build), rebuild " << rebuildTime
+                  << " s (SAH cost " << rebuilt.sahCost() << "), trace refit " << refitResult.seconds << " s vs rebuilt "
+                  << rebuiltResult.seconds << " s, " << countMismatches(rebuiltResult, refitResult) << " mismatches" << std::endl;
+    }
+
+    // Motion blur: moving spheres and rays at random shutter times.
+    std::cout << "Motion blur, spheres move up to " << motion << " during the shutter:" << std::endl;
+    Hitable** movingList = new Hitable*[numPrims];
+    for (int i = 0; i < numPrims; i++)
+    {
+        const Vector3f center = static_cast<Sphere*>(list[i])->getCenter();
+        movingList[i] = new MovingSphere(center, center + motion * randomInUnitSphere(rng), 0, 1, 0.05f + 0.45f * rng.rand(), material);
+    }
+    std::vector<Rayf> timedRays(frameRays.size());
+    for (size_t i = 0; i < timedRays.size(); i++)
+        timedRays[i] = Rayf(frameRays[i].origin(), frameRays[i].direction(), rng.rand());
+
+    auto motionStart = std::chrono::steady_clock::now();
+    const BVH staticBvh(movingList, numPrims, 0, 1, method);
+    const double staticBuild = std::chrono::duration<double>(std::chrono::steady_clock::now() - motionStart).count();
+    motionStart = std::chrono::steady_clock::now();
+    const MotionBVH motionBvh(movingList, numPrims, 0, 1);
+    const double motionBuild = std::chrono::duration<double>(std::chrono::steady_clock::now() - motionStart).count();
+    const MotionBVH motionBvhNoSplits(movingList, numPrims, 0, 1, 0);
+
+    std::cout << "  builds: BVH " << staticBuild << " s (SAH cost " << staticBvh.sahCost() << "), motion BVH " << motionBuild << " s ("
+              << motionBvh.temporalSplitCount() << " temporal splits, SAH cost " << motionBvh.sahCost() << ")" << std::endl;
+    const TraceResult motionReference = traceRays(&staticBvh, timedRays, numPasses);
+    report("BVH (shutter bounds)", staticBvh.nodeCount(), motionReference, timedRays.size(), numPasses, motionReference);
+    report("motion BVH, no temporal splits", motionBvhNoSplits.nodeCount(), traceRays(&motionBvhNoSplits, timedRays, numPasses),
+           timedRays.size(), numPasses, motionReference);
+    report("motion BVH", motionBvh.nodeCount(), traceRays(&motionBvh, timedRays, numPasses), timedRays.size(), numPasses, motionReference);
+
+    // Triangle intersection: every ray against every triangle, one triangle at a time or
+    // in packets.  Triangle::hit culls back faces, so it is checked against a one sided
+    // reference; the others are two sided.
+    const std::vector<Rayf> triangleRays(rays.begin(), rays.begin() + std::min<size_t>(rays.size(), 10000));
+    std::vector<Hitable*> triangles(numTriangles);
+    std::vector<TriangleMesh::TriangleFast> fastTriangles(numTriangles);
+    std::vector<Vector3f> triangleNormals(numTriangles);
+    std::vector<TrianglePacket<4>> packets4((numTriangles + 3) / 4);
+    std::vector<TrianglePacket<8>> packets8((numTriangles + 7) / 8);
+    for (int i = 0; i < numTriangles; i++)
+    {
+        const Vector3f v0(rng.rand() * extent, rng.rand() * extent, rng.rand() * extent);
+        const Vector3f v1 = v0 + 20.0f * randomInUnitSphere(rng);
+        const Vector3f v2 = v0 + 20.0f * randomInUnitSphere(rng);
+        triangles[i] = new Triangle(v0, Vector2f(0, 0), v1, Vector2f(1, 0), v2, Vector2f(0, 1), material);
+        fastTriangles[i] = TriangleMesh::TriangleFast(v0, v1, v2);
+        triangleNormals[i] = cross(v1 - v0, v2 - v0);
+        packets4[i / 4].set(i % 4, v0, v1, v2);
+        packets8[i / 8].set(i % 8, v0, v1, v2);
+    }
+    for (int i = numTriangles; i < (int)packets4.size() * 4; i++)
+        packets4[i / 4].clear(i % 4);
+    for (int i = numTriangles; i < (int)packets8.size() * 8; i++)
+        packets8[i / 8].clear(i % 8);
+
+    const double numTests = (double)triangleRays.size() * numTriangles * numPasses;
+    std::cout << "Intersecting " << triangleRays.size() << " rays x " << numPasses << " passes with " << numTriangles
+              << " triangles:" << std::endl;
+    SimpleRng triangleRng(3, 7);
+    const TraceResult triangleReference = intersectRays(triangleRays, numPasses, [&](const Rayf& r) {
+        float tmax = FLT_MAX;
+        for (const auto& tri : fastTriangles)
+        {
+            float t;
+            Vector3f bary;
+            if (TriangleMesh::hit(r, tri, 0.001f, tmax, t, bary))
+                tmax = t;
+        }
+        return tmax;
+    });
+    reportTriangles("TriangleMesh::TriangleFast", triangleReference, numTests, triangleReference);
+    const TraceResult frontFaceReference = intersectRays(triangleRays, numPasses, [&](const Rayf& r) {
+        float tmax = FLT_MAX;
+        for (int i = 0; i < numTriangles; i++)
+        {
+            float t;
+            Vector3f bary;
+            if (dot(r.direction(), triangleNormals[i]) < 0 && TriangleMesh::hit(r, fastTriangles[i], 0.001f, tmax, t, bary))
+                tmax = t;
+        }
+        return tmax;
+    });
+    reportTriangles("Triangle::hit, one sided", intersectRays(triangleRays, numPasses, [&](const Rayf& r) {
+        float tmax = FLT_MAX;
+        for (const Hitable* tri : triangles)
+        {
+            HitRecord rec;
+            if (tri->hit(r, 0.001f, tmax, rec, triangleRng))
+                tmax = rec.t;
+        }
+        return tmax;
+    }), numTests, frontFaceReference);
+    reportTriangles("4 wide packets, scalar", intersectRays(triangleRays, numPasses, [&](const Rayf& r) {
+        float tmax = FLT_MAX, u, v;
+        for (const auto& packet : packets4)
+            intersectTrianglesScalar(packet, r, 0.001f, tmax, u, v);
+        return tmax;
+    }), numTests, triangleReference);
+    reportTriangles("4 wide packets", intersectRays(triangleRays, numPasses, [&](const Rayf& r) {
+        float tmax = FLT_MAX, u, v;
+        for (const auto& packet : packets4)
+            intersectTriangles(packet, r, 0.001f, tmax, u, v);
+        return tmax;
+    }), numTests, triangleReference);
+    reportTriangles("8 wide packets", intersectRays(triangleRays, numPasses, [&](const Rayf& r) {
+        float tmax = FLT_MAX, u, v;
+        for (const auto& packet : packets8)
+            intersectTriangles(packet, r, 0.001f, tmax, u, v);
+        return tmax;
+    }), numTests, triangleReference);
+
+    // Dispatch: every ray against a shuffled mix of spheres, moving spheres and (flipped)
+    // rectangles, through the virtual hit() or the switch over the tagged records.
+    std::vector<Hitable*> mixed(numMixed);
+    for (int i = 0; i < numMixed; i++)
+    {
+        const Vector3f p(rng.rand() * extent, rng.rand() * extent, rng.rand() * extent);
+        const float size = 1 + 4 * rng.rand();
+        switch (i % 6)
+        {
+            case 0: mixed[i] = new Sphere(p, size, material); break;
+            case 1: mixed[i] = new MovingSphere(p, p + randomInUnitSphere(rng), 0, 1, size, material); break;
+            case 2: mixed[i] = new XYRectangle(p.x(), p.x() + size, p.y(), p.y() + size, p.z(), material); break;
+            case 3: mixed[i] = new XZRectangle(p.x(), p.x() + size, p.z(), p.z() + size, p.y(), material); break;
+            case 4: mixed[i] = new FlipNormals(new YZRectangle(p.y(), p.y() + size, p.z(), p.z() + size, p.x(), material)); break;
+            default: mixed[i] = new Translate(new Sphere(Vector3f(0, 0, 0), size, material), p); break;
+        }
+    }
+    std::shuffle(mixed.begin(), mixed.end(), std::mt19937(7));
+    Primitive* mixedRecords = CreatePrimitives(mixed.data(), numMixed);
+
+    const double numMixedTests = (double)triangleRays.size() * numMixed * numPasses;
+    std::cout << "Intersecting " << triangleRays.size() << " rays x " << numPasses << " passes with " << numMixed
+              << " mixed primitives:" << std::endl;
+    SimpleRng mixedRng(3, 7);
+    const TraceResult mixedReference = intersectRays(triangleRays, numPasses, [&](const Rayf& r) {
+        float tmax = FLT_MAX;
+        for (const Hitable* prim : mixed)
+        {
+            HitRecord rec;
+            if (prim->hit(r, 0.001f, tmax, rec, mixedRng))
+                tmax = rec.t;
+        }
+        return tmax;
+    });
+    reportTriangles("virtual hit()", mixedReference, numMixedTests, mixedReference);
+    reportTriangles("tagged dispatch", intersectRays(triangleRays, numPasses, [&](const Rayf& r) {
+        float tmax = FLT_MAX;
+        for (int i = 0; i < numMixed; i++)
+        {
+            HitRecord rec;
+            if (hitPrimitive(mixedRecords[i], r, 0.001f, tmax, rec, mixedRng))
+                tmax = rec.t;
+        }
+        return tmax;
+    }), numMixedTests, mixedReference);
+
+    // As in BVH leaves, which keep their primitives grouped by type.
+    std::vector<Primitive> groupedRecords(mixedRecords, mixedRecords + numMixed);
+    std::stable_sort(groupedRecords.begin(), groupedRecords.end(), [](const Primitive& a, const Primitive& b) { return a.type < b.type; });
+    reportTriangles("tagged dispatch, grouped by type", intersectRays(triangleRays, numPasses, [&](const Rayf& r) {
+        float tmax = FLT_MAX;
+        for (const Primitive& prim : groupedRecords)
+        {
+            HitRecord rec;
+            if (hitPrimitive(prim, r, 0.001f, tmax, rec, mixedRng))
+                tmax = rec.t;
+        }
+        return tmax;
+    }), numMixedTests, mixedReference);
+    delete[] mixedRecords;
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,1209 @@
+/*
+ * CUDA (GPU) Pathtracer based on Peter Shirley's 'Ray Tracing in One Weekend' e-book
+ * series.
+ *
+ * Copyright (C) 2017 by Rick Weyrauch - rpweyrauch@gmail.com
+ *
+ * This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <sstream>
+#include <vector>
+#include "ptMeshLoader.h"
+#include "ptTriangle.h"
+#include "ptHitableList.h"
+#include "ptInstance.h"
+#include "ptTransform.h"
+
+namespace
+{
+
+// Memory referenced by the views of one mesh: the mapped files and converted attributes.
+struct MeshBuffers
+{
+    std::vector<std::shared_ptr<MappedFile>> files;
+    std::vector<Vector3f> positions;
+    std::vector<Vector3f> normals;
+    std::vector<Vector2f> texCoords;
+};
+
+bool hostIsLittleEndian()
+{
+    const uint16_t one = 1;
+    uint8_t first;
+    memcpy(&first, &one, 1);
+    return first == 1;
+}
+
+template <typename T>
+T loadScalar(const char* p, bool swap)
+{
+    unsigned char bytes[sizeof(T)];
+    memcpy(bytes, p, sizeof(T));
+    if (swap)
+        std::reverse(bytes, bytes + sizeof(T));
+    T value;
+    memcpy(&value, bytes, sizeof(T));
+    return value;
+}
+
+// Builds the views of a mesh and its BVH.  The index view is only read by complete().
+TriangleMesh* completeMesh(Material* material, const std::shared_ptr<MeshBuffers>& buffers, int numVertices,
+                           const StridedView<Vector3f>& p, const StridedView<Vector3f>& n, const StridedView<Vector2f>& tex,
+                           const StridedView<TriIndex>& tris, int numTriangles, BVHBuildMethod method, MeshLoadStats* stats)
+{
+    TriangleMesh* mesh = new TriangleMesh(material);
+    mesh->setVertexViews(p, n, tex, numVertices, buffers);
+    mesh->setIndexView(tris, numTriangles);
+    mesh->complete(method);
+
+    AABB<float> bbox;
+    if (!mesh->bounds(0, 1, bbox))
+    {
+        delete mesh;
+        return nullptr;
+    }
+
+    if (stats != nullptr)
+        stats->numTriangles += mesh->triangleCount();
+    return mesh;
+}
+
+//
+// PLY
+//
+
+enum PlyType
+{
+    PlyInvalid,
+    PlyInt8,
+    PlyUInt8,
+    PlyInt16,
+    PlyUInt16,
+    PlyInt32,
+    PlyUInt32,
+    PlyFloat32,
+    PlyFloat64
+};
+
+PlyType plyType(const std::string& name)
+{
+    if (name == "char" || name == "int8") return PlyInt8;
+    if (name == "uchar" || name == "uint8") return PlyUInt8;
+    if (name == "short" || name == "int16") return PlyInt16;
+    if (name == "ushort" || name == "uint16") return PlyUInt16;
+    if (name == "int" || name == "int32") return PlyInt32;
+    if (name == "uint" || name == "uint32") return PlyUInt32;
+    if (name == "float" || name == "float32") return PlyFloat32;
+    if (name == "double" || name == "float64") return PlyFloat64;
+    return PlyInvalid;
+}
+
+size_t plyTypeSize(PlyType type)
+{
+    switch (type)
+    {
+        case PlyInt8:
+        case PlyUInt8: return 1;
+        case PlyInt16:
+        case PlyUInt16: return 2;
+        case PlyInt32:
+        case PlyUInt32:
+        case PlyFloat32: return 4;
+        case PlyFloat64: return 8;
+        default: return 0;
+    }
+}
+
+double plyScalar(const char* p, PlyType type, bool swap)
+{
+    switch (type)
+    {
+        case PlyInt8: return static_cast<int8_t>(*p);
+        case PlyUInt8: return static_cast<uint8_t>(*p);
+        case PlyInt16: return loadScalar<int16_t>(p, swap);
+        case PlyUInt16: return loadScalar<uint16_t>(p, swap);
+        case PlyInt32: return loadScalar<int32_t>(p, swap);
+        case PlyUInt32: return loadScalar<uint32_t>(p, swap);
+        case PlyFloat32: return loadScalar<float>(p, swap);
+        case PlyFloat64: return loadScalar<double>(p, swap);
+        default: return 0;
+    }
+}
+
+struct PlyProperty
+{
+    std::string name;
+    PlyType type = PlyInvalid;
+    PlyType countType = PlyInvalid;     // list properties only
+    bool isList = false;
+    size_t offset = 0;                  // within the record, fixed size elements only
+};
+
+struct PlyElement
+{
+    std::string name;
+    int64_t count = 0;
+    std::vector<PlyProperty> properties;
+    bool fixedSize = true;
+    size_t stride = 0;                  // fixed size elements only
+    size_t start = 0;
+    size_t size = 0;
+
+    int find(const char* propertyName) const
+    {
+        for (size_t i = 0; i < properties.size(); i++)
+        {
+            if (properties[i].name == propertyName)
+                return static_cast<int>(i);
+        }
+        return -1;
+    }
+};
+
+// Advances past one property value; nullptr if it would run past end.
+const char* skipPlyProperty(const PlyProperty& prop, const char* p, const char* end, bool swap)
+{
+    if (p == nullptr)
+        return nullptr;
+
+    if (prop.isList)
+    {
+        const size_t countSize = plyTypeSize(prop.countType);
+        if (static_cast<size_t>(end - p) < countSize)
+            return nullptr;
+        const double count = plyScalar(p, prop.countType, swap);
+        p += countSize;
+        if (count < 0 || count * plyTypeSize(prop.type) > static_cast<double>(end - p))
+            return nullptr;
+        return p + static_cast<size_t>(count) * plyTypeSize(prop.type);
+    }
+
+    if (static_cast<size_t>(end - p) < plyTypeSize(prop.type))
+        return nullptr;
+    return p + plyTypeSize(prop.type);
+}
+
+const char* skipPlyRecord(const PlyElement& element, const char* p, const char* end, bool swap)
+{
+    for (const PlyProperty& prop : element.properties)
+        p = skipPlyProperty(prop, p, end, swap);
+    return p;
+}
+
+bool parsePlyHeader(const MappedFile& file, std::vector<PlyElement>& elements, bool& bigEndian, size_t& dataStart)
+{
+    const char* data = file.data();
+    const size_t size = file.size();
+    if (size < 4 || memcmp(data, "ply", 3) != 0)
+        return false;
+
+    bool haveFormat = false;
+    size_t pos = 0;
+    while (pos < size)
+    {
+        const char* lineEnd = static_cast<const char*>(memchr(data + pos, '\n', size - pos));
+        if (lineEnd == nullptr)
+            return false;
+        std::string line(data + pos, lineEnd);
+        pos = static_cast<size_t>(lineEnd - data) + 1;
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+
+        std::istringstream tokens(line);
+        std::string keyword;
+        tokens >> keyword;
+        if (keyword == "format")
+        {
+            std::string format;
+            tokens >> format;
+            if (format == "binary_little_endian")
+                bigEndian = false;
+            else if (format == "binary_big_endian")
+                bigEndian = true;
+            else
+                return false;   // ascii
+            haveFormat = true;
+        }
+        else if (keyword == "element")
+        {
+            PlyElement element;
+            tokens >> element.name >> element.count;
+            if (tokens.fail() || element.count < 0)
+                return false;
+            elements.push_back(element);
+        }
+        else if (keyword == "property")
+        {
+            if (elements.empty())
+                return false;
+            PlyElement& element = elements.back();
+            PlyProperty prop;
+            std::string type;
+            tokens >> type;
+            if (type == "list")
+            {
+                std::string countType;
+                tokens >> countType >> type;
+                prop.isList = true;
+                prop.countType = plyType(countType);
+                if (prop.countType == PlyInvalid || prop.countType == PlyFloat32 || prop.countType == PlyFloat64)
+                    return false;
+                element.fixedSize = false;
+            }
+            prop.type = plyType(type);
+            tokens >> prop.name;
+            if (prop.type == PlyInvalid || tokens.fail())
+                return false;
+            prop.offset = element.stride;
+            element.stride += plyTypeSize(prop.type);
+            element.properties.push_back(prop);
+        }
+        else if (keyword == "end_header")
+        {
+            dataStart = pos;
+            return haveFormat;
+        }
+        // ply, comment and obj_info lines are skipped.
+    }
+    return false;
+}
+
+// Locates every element in the body.  Elements with list properties are walked.
+bool layoutPlyElements(const MappedFile& file, std::vector<PlyElement>& elements, size_t dataStart, bool swap)
+{
+    const char* end = file.data() + file.size();
+    size_t pos = dataStart;
+    for (PlyElement& element : elements)
+    {
+        element.start = pos;
+        if (element.fixedSize)
+        {
+            if (element.stride == 0 || element.count > static_cast<int64_t>((file.size() - pos) / element.stride))
+                return false;
+            element.size = static_cast<size_t>(element.count) * element.stride;
+        }
+        else
+        {
+            const char* p = file.data() + pos;
+            for (int64_t i = 0; i < element.count; i++)
+            {
+                p = skipPlyRecord(element, p, end, swap);
+                if (p == nullptr)
+                    return false;
+            }
+            element.size = static_cast<size_t>(p - (file.data() + pos));
+        }
+        pos += element.size;
+    }
+    return true;
+}
+
+// Views the named float properties of a fixed size element in place when they are
+// adjacent floats in file byte order, otherwise converts them into copy.  Returns false
+// if a property is missing.
+template <typename T, int N>
+bool plyAttribute(const MappedFile& file, const PlyElement& element, const char* const (&names)[N], bool swap,
+                  StridedView<T>& view, std::vector<T>& copy, MeshLoadStats* stats)
+{
+    static_assert(sizeof(T) == N * sizeof(float), "attribute must be N packed floats");
+
+    int props[N];
+    bool inPlace = !swap;
+    for (int k = 0; k < N; k++)
+    {
+        props[k] = element.find(names[k]);
+        if (props[k] < 0 || element.properties[props[k]].isList)
+            return false;
+        const PlyProperty& prop = element.properties[props[k]];
+        inPlace = inPlace && (prop.type == PlyFloat32) &&
+                  (prop.offset == element.properties[props[0]].offset + k * sizeof(float));
+    }
+
+    const char* records = file.data() + element.start;
+    if (inPlace)
+    {
+        view = StridedView<T>(records + element.properties[props[0]].offset, element.stride);
+        if (stats != nullptr)
+            stats->buffersViewed++;
+        return true;
+    }
+
+    const size_t count = static_cast<size_t>(element.count);
+    copy.resize(count);
+#pragma omp parallel for schedule(static)
+    for (int64_t i = 0; i < static_cast<int64_t>(count); i++)
+    {
+        float values[N];
+        for (int k = 0; k < N; k++)
+        {
+            const PlyProperty& prop = element.properties[props[k]];
+            values[k] = static_cast<float>(plyScalar(records + i * element.stride + prop.offset, prop.type, swap));
+        }
+        memcpy(&copy[i], values, sizeof(T));
+    }
+    view = StridedView<T>(copy.data());
+    if (stats != nullptr)
+        stats->buffersCopied++;
+    return true;
+}
+
+//
+// glTF
+//
+
+// Minimal JSON document tree, enough for the glTF scene description.
+struct JsonValue
+{
+    enum Type { Null, Bool, Number, String, Array, Object };
+
+    Type type = Null;
+    bool boolean = false;
+    double number = 0;
+    std::string string;
+    std::vector<JsonValue> items;       // array elements or object values
+    std::vector<std::string> keys;      // object keys, parallel to items
+
+    const JsonValue* get(const char* key) const
+    {
+        if (type != Object)
+            return nullptr;
+        for (size_t i = 0; i < keys.size(); i++)
+        {
+            if (keys[i] == key)
+                return &items[i];
+        }
+        return nullptr;
+    }
+
+    const JsonValue* at(size_t i) const
+    {
+        return (type == Array && i < items.size()) ? &items[i] : nullptr;
+    }
+
+    size_t size() const { return (type == Array) ? items.size() : 0; }
+
+    double getNumber(const char* key, double defaultValue) const
+    {
+        const JsonValue* value = get(key);
+        return (value != nullptr && value->type == Number) ? value->number : defaultValue;
+    }
+
+    int getInt(const char* key, int defaultValue) const
+    {
+        return static_cast<int>(getNumber(key, defaultValue));
+    }
+};
+
+class JsonParser
+{
+public:
+    JsonParser(const char* begin, const char* end) :
+        m_p(begin),
+        m_end(end) {}
+
+    bool parse(JsonValue& value)
+    {
+        return parseValue(value, 0);
+    }
+
+private:
+    static const int MaxDepth = 128;
+
+    void skipSpace()
+    {
+        while (m_p < m_end && (*m_p == ' ' || *m_p == '\t' || *m_p == '\n' || *m_p == '\r'))
+            m_p++;
+    }
+
+    bool consume(char c)
+    {
+        skipSpace();
+        if (m_p < m_end && *m_p == c)
+        {
+            m_p++;
+            return true;
+        }
+        return false;
+    }
+
+    static bool isNumberChar(char c)
+    {
+        return (c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.' || c == 'e' || c == 'E';
+    }
+
+    bool literal(const char* text)
+    {
+        const size_t n = strlen(text);
+        if (static_cast<size_t>(m_end - m_p) < n || memcmp(m_p, text, n) != 0)
+            return false;
+        m_p += n;
+        return true;
+    }
+
+    bool parseString(std::string& out)
+    {
+        if (!consume('"'))
+            return false;
+        while (m_p < m_end && *m_p != '"')
+        {
+            char c = *m_p++;
+            if (c == '\\')
+            {
+                if (m_p >= m_end)
+                    return false;
+                c = *m_p++;
+                switch (c)
+                {
+                    case 'b': c = '\b'; break;
+                    case 'f': c = '\f'; break;
+                    case 'n': c = '\n'; break;
+                    case 'r': c = '\r'; break;
+                    case 't': c = '\t'; break;
+                    case 'u':
+                        // Names used by the importer are ASCII; other code points are replaced.
+                        if (m_end - m_p < 4)
+                            return false;
+                        m_p += 4;
+                        c = '?';
+                        break;
+                    default: break;     // \" \\ \/
+                }
+            }
+            out.push_back(c);
+        }
+        return consume('"');
+    }
+
+    bool parseValue(JsonValue& value, int depth)
+    {
+        if (depth > MaxDepth)
+            return false;
+
+        skipSpace();
+        if (m_p >= m_end)
+            return false;
+
+        switch (*m_p)
+        {
+            case '{':
+            {
+                m_p++;
+                value.type = JsonValue::Object;
+                if (consume('}'))
+                    return true;
+                do
+                {
+                    value.keys.emplace_back();
+                    value.items.emplace_back();
+                    if (!parseString(value.keys.back()) || !consume(':') || !parseValue(value.items.back(), depth + 1))
+                        return false;
+                } while (consume(','));
+                return consume('}');
+            }
+            case '[':
+            {
+                m_p++;
+                value.type = JsonValue::Array;
+                if (consume(']'))
+                    return true;
+                do
+                {
+                    value.items.emplace_back();
+                    if (!parseValue(value.items.back(), depth + 1))
+                        return false;
+                } while (consume(','));
+                return consume(']');
+            }
+            case '"':
+                value.type = JsonValue::String;
+                return parseString(value.string);
+            case 't':
+                value.type = JsonValue::Bool;
+                value.boolean = true;
+                return literal("true");
+            case 'f':
+                value.type = JsonValue::Bool;
+                return literal("false");
+            case 'n':
+                return literal("null");
+            default:
+            {
+                // strtod needs a terminated string; numbers are short.
+                char text[64];
+                size_t n = 0;
+                while (m_p + n < m_end && n + 1 < sizeof(text) && isNumberChar(m_p[n]))
+                {
+                    text[n] = m_p[n];
+                    n++;
+                }
+                text[n] = '\0';
+                char* numberEnd = nullptr;
+                value.type = JsonValue::Number;
+                value.number = strtod(text, &numberEnd);
+                if (n == 0 || numberEnd != text + n)
+                    return false;
+                m_p += n;
+                return true;
+            }
+        }
+    }
+
+    const char* m_p;
+    const char* m_end;
+};
+
+const uint32_t GLB_MAGIC = 0x46546C67;        // "glTF"
+const uint32_t GLB_CHUNK_JSON = 0x4E4F534A;   // "JSON"
+const uint32_t GLB_CHUNK_BIN = 0x004E4942;    // "BIN\0"
+
+enum GltfComponentType
+{
+    GltfByte = 5120,
+    GltfUnsignedByte = 5121,
+    GltfShort = 5122,
+    GltfUnsignedShort = 5123,
+    GltfUnsignedInt = 5125,
+    GltfFloat = 5126
+};
+
+const int GLTF_MODE_TRIANGLES = 4;
+
+struct GltfBuffer
+{
+    const char* data = nullptr;
+    size_t size = 0;
+    std::shared_ptr<MappedFile> file;
+};
+
+// Element i of an accessor starts at data + i * stride.
+struct GltfAccessor
+{
+    const char* data = nullptr;
+    size_t stride = 0;
+    size_t count = 0;
+    int componentType = 0;
+    int numComponents = 0;
+    bool normalized = false;
+    std::shared_ptr<MappedFile> file;
+};
+
+size_t gltfComponentSize(int componentType)
+{
+    switch (componentType)
+    {
+        case GltfByte:
+        case GltfUnsignedByte: return 1;
+        case GltfShort:
+        case GltfUnsignedShort: return 2;
+        case GltfUnsignedInt:
+        case GltfFloat: return 4;
+        default: return 0;
+    }
+}
+
+int gltfNumComponents(const std::string& type)
+{
+    if (type == "SCALAR") return 1;
+    if (type == "VEC2") return 2;
+    if (type == "VEC3") return 3;
+    if (type == "VEC4") return 4;
+    return 0;
+}
+
+// Component c of element i as a float, applying the normalization of integer types.
+float gltfComponent(const GltfAccessor& accessor, size_t i, int c)
+{
+    const char* p = accessor.data + i * accessor.stride + c * gltfComponentSize(accessor.componentType);
+    switch (accessor.componentType)
+    {
+        case GltfByte:
+        {
+            const float v = static_cast<int8_t>(*p);
+            return accessor.normalized ? Max(v / 127.0f, -1.0f) : v;
+        }
+        case GltfUnsignedByte:
+        {
+            const float v = static_cast<uint8_t>(*p);
+            return accessor.normalized ? v / 255.0f : v;
+        }
+        case GltfShort:
+        {
+            const float v = loadScalar<int16_t>(p, false);
+            return accessor.normalized ? Max(v / 32767.0f, -1.0f) : v;
+        }
+        case GltfUnsignedShort:
+        {
+            const float v = loadScalar<uint16_t>(p, false);
+            return accessor.normalized ? v / 65535.0f : v;
+        }
+        case GltfUnsignedInt: return static_cast<float>(loadScalar<uint32_t>(p, false));
+        case GltfFloat: return loadScalar<float>(p, false);
+        default: return 0;
+    }
+}
+
+bool resolveGltfAccessor(const JsonValue& doc, const std::vector<GltfBuffer>& buffers, int index, GltfAccessor& accessor)
+{
+    const JsonValue* accessors = doc.get("accessors");
+    const JsonValue* bufferViews = doc.get("bufferViews");
+    const JsonValue* acc = (accessors != nullptr) ? accessors->at(index) : nullptr;
+    if (acc == nullptr || bufferViews == nullptr || acc->get("sparse") != nullptr)
+        return false;
+
+    const JsonValue* view = bufferViews->at(acc->getInt("bufferView", -1));
+    const JsonValue* type = acc->get("type");
+    if (view == nullptr || type == nullptr || type->type != JsonValue::String)
+        return false;
+
+    const int bufferIndex = view->getInt("buffer", -1);
+    if (bufferIndex < 0 || bufferIndex >= static_cast<int>(buffers.size()) || buffers[bufferIndex].data == nullptr)
+        return false;
+    const GltfBuffer& buffer = buffers[bufferIndex];
+
+    accessor.componentType = acc->getInt("componentType", 0);
+    accessor.numComponents = gltfNumComponents(type->string);
+    const double count = acc->getNumber("count", 0);
+    const size_t elementSize = gltfComponentSize(accessor.componentType) * accessor.numComponents;
+    if (elementSize == 0 || count <= 0 || count > 2147483647.0)
+        return false;
+    accessor.count = static_cast<size_t>(count);
+    const JsonValue* normalized = acc->get("normalized");
+    accessor.normalized = (normalized != nullptr) && normalized->boolean;
+
+    const double viewOffset = view->getNumber("byteOffset", 0);
+    const double viewLength = view->getNumber("byteLength", 0);
+    const double accessorOffset = acc->getNumber("byteOffset", 0);
+    const double stride = view->getNumber("byteStride", static_cast<double>(elementSize));
+    if (viewOffset < 0 || viewLength < 0 || accessorOffset < 0 || stride < elementSize ||
+        viewOffset + viewLength > static_cast<double>(buffer.size) ||
+        accessorOffset + (count - 1) * stride + elementSize > viewLength)
+        return false;
+
+    accessor.data = buffer.data + static_cast<size_t>(viewOffset + accessorOffset);
+    accessor.stride = static_cast<size_t>(stride);
+    accessor.file = buffer.file;
+    return true;
+}
+
+// Views a float accessor with N components in place, otherwise converts it.
+template <typename T, int N>
+bool gltfAttribute(const GltfAccessor& accessor, size_t numVertices, MeshBuffers& buffers, StridedView<T>& view,
+                   std::vector<T>& copy, MeshLoadStats* stats)
+{
+    static_assert(sizeof(T) == N * sizeof(float), "attribute must be N packed floats");
+
+    if (accessor.numComponents != N || accessor.count != numVertices)
+        return false;
+
+    if (accessor.componentType == GltfFloat)
+    {
+        view = StridedView<T>(accessor.data, accessor.stride);
+        buffers.files.push_back(accessor.file);
+        if (stats != nullptr)
+            stats->buffersViewed++;
+        return true;
+    }
+
+    copy.resize(numVertices);
+    for (size_t i = 0; i < numVertices; i++)
+    {
+        float values[N];
+        for (int k = 0; k < N; k++)
+            values[k] = gltfComponent(accessor, i, k);
+        memcpy(&copy[i], values, sizeof(T));
+    }
+    view = StridedView<T>(copy.data());
+    if (stats != nullptr)
+        stats->buffersCopied++;
+    return true;
+}
+
+TriangleMesh* loadGltfPrimitive(const JsonValue& doc, const std::vector<GltfBuffer>& buffers, const JsonValue& primitive,
+                                Material* material, BVHBuildMethod method, MeshLoadStats* stats)
+{
+    const JsonValue* attributes = primitive.get("attributes");
+    if (attributes == nullptr || primitive.getInt("mode", GLTF_MODE_TRIANGLES) != GLTF_MODE_TRIANGLES)
+        return nullptr;
+
+    GltfAccessor positions;
+    if (!resolveGltfAccessor(doc, buffers, attributes->getInt("POSITION", -1), positions))
+        return nullptr;
+    const size_t numVertices = positions.count;
+
+    auto meshBuffers = std::make_shared<MeshBuffers>();
+    StridedView<Vector3f> p, n;
+    StridedView<Vector2f> tex;
+    if (!gltfAttribute<Vector3f, 3>(positions, numVertices, *meshBuffers, p, meshBuffers->positions, stats))
+        return nullptr;
+
+    GltfAccessor normals;
+    if (resolveGltfAccessor(doc, buffers, attributes->getInt("NORMAL", -1), normals))
+        gltfAttribute<Vector3f, 3>(normals, numVertices, *meshBuffers, n, meshBuffers->normals, stats);
+
+    // glTF puts the texture origin at the top left, so v is always flipped into a copy.
+    GltfAccessor texCoords;
+    if (resolveGltfAccessor(doc, buffers, attributes->getInt("TEXCOORD_0", -1), texCoords) &&
+        texCoords.numComponents == 2 && texCoords.count == numVertices)
+    {
+        meshBuffers->texCoords.resize(numVertices);
+        for (size_t i = 0; i < numVertices; i++)
+            meshBuffers->texCoords[i] = Vector2f(gltfComponent(texCoords, i, 0), 1 - gltfComponent(texCoords, i, 1));
+        tex = StridedView<Vector2f>(meshBuffers->texCoords.data());
+        if (stats != nullptr)
+            stats->buffersCopied++;
+    }
+
+    // 32-bit indices are read in place; out of range ones are dropped by complete().
+    StridedView<TriIndex> tris;
+    std::vector<TriIndex> triCopy;
+    size_t numTriangles = 0;
+    GltfAccessor indices;
+    if (primitive.get("indices") != nullptr)
+    {
+        if (!resolveGltfAccessor(doc, buffers, primitive.getInt("indices", -1), indices) || indices.numComponents != 1)
+            return nullptr;
+        numTriangles = indices.count / 3;
+        if (indices.componentType == GltfUnsignedInt && indices.stride == sizeof(uint32_t))
+        {
+            tris = StridedView<TriIndex>(indices.data);
+            if (stats != nullptr)
+                stats->buffersViewed++;
+        }
+        else
+        {
+            triCopy.resize(numTriangles);
+            for (size_t t = 0; t < numTriangles; t++)
+            {
+                triCopy[t] = { static_cast<unsigned int>(gltfComponent(indices, 3 * t, 0)),
+                               static_cast<unsigned int>(gltfComponent(indices, 3 * t + 1, 0)),
+                               static_cast<unsigned int>(gltfComponent(indices, 3 * t + 2, 0)) };
+            }
+            tris = StridedView<TriIndex>(triCopy.data());
+            if (stats != nullptr)
+                stats->buffersCopied++;
+        }
+    }
+    else
+    {
+        numTriangles = numVertices / 3;
+        triCopy.resize(numTriangles);
+        for (size_t t = 0; t < numTriangles; t++)
+            triCopy[t] = { static_cast<unsigned int>(3 * t), static_cast<unsigned int>(3 * t + 1), static_cast<unsigned int>(3 * t + 2) };
+        tris = StridedView<TriIndex>(triCopy.data());
+    }
+
+    if (stats != nullptr)
+    {
+        stats->numPositions += static_cast<int>(numVertices);
+        stats->numNormals += n.valid() ? static_cast<int>(numVertices) : 0;
+        stats->numTexCoords += tex.valid() ? static_cast<int>(numVertices) : 0;
+        stats->numVertices += static_cast<int>(numVertices);
+        stats->numFaces += static_cast<int>(numTriangles);
+    }
+
+    return completeMesh(material, meshBuffers, static_cast<int>(numVertices), p, n, tex, tris,
+                        static_cast<int>(numTriangles), method, stats);
+}
+
+// Local transform of a node from its matrix or translation/rotation/scale.  Returns
+// false for the identity.
+bool gltfNodeTransform(const JsonValue& node, Transform& transform)
+{
+    const JsonValue* matrix = node.get("matrix");
+    if (matrix != nullptr && matrix->size() == 16)
+    {
+        // Column major.
+        float m[16];
+        for (int i = 0; i < 16; i++)
+            m[i] = static_cast<float>(matrix->at(i)->number);
+        transform = Transform(m[0], m[4], m[8], m[12],
+                              m[1], m[5], m[9], m[13],
+                              m[2], m[6], m[10], m[14]);
+        static const float identity[16] = { 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1 };
+        return memcmp(m, identity, sizeof(m)) != 0;
+    }
+
+    float t[3] = { 0, 0, 0 };
+    float q[4] = { 0, 0, 0, 1 };
+    float s[3] = { 1, 1, 1 };
+    bool hasTransform = false;
+    const JsonValue* translation = node.get("translation");
+    const JsonValue* rotation = node.get("rotation");
+    const JsonValue* scale = node.get("scale");
+    if (translation != nullptr && translation->size() == 3)
+    {
+        for (int i = 0; i < 3; i++)
+            t[i] = static_cast<float>(translation->at(i)->number);
+        hasTransform = true;
+    }
+    if (rotation != nullptr && rotation->size() == 4)
+    {
+        for (int i = 0; i < 4; i++)
+            q[i] = static_cast<float>(rotation->at(i)->number);
+        hasTransform = true;
+    }
+    if (scale != nullptr && scale->size() == 3)
+    {
+        for (int i = 0; i < 3; i++)
+            s[i] = static_cast<float>(scale->at(i)->number);
+        hasTransform = true;
+    }
+
+    // T * R * S with R from the unit quaternion (x, y, z, w).
+    const float x = q[0], y = q[1], z = q[2], w = q[3];
+    transform = Transform((1 - 2 * (y * y + z * z)) * s[0], 2 * (x * y - z * w) * s[1], 2 * (x * z + y * w) * s[2], t[0],
+                          2 * (x * y + z * w) * s[0], (1 - 2 * (x * x + z * z)) * s[1], 2 * (y * z - x * w) * s[2], t[1],
+                          2 * (x * z - y * w) * s[0], 2 * (y * z + x * w) * s[1], (1 - 2 * (x * x + y * y)) * s[2], t[2]);
+    return hasTransform;
+}
+
+struct GltfScene
+{
+    const JsonValue* doc = nullptr;
+    const std::vector<GltfBuffer>* buffers = nullptr;
+    Material* material = nullptr;
+    BVHBuildMethod method = BVHBuildSAH;
+    MeshLoadStats* stats = nullptr;
+
+    // Meshes are loaded on first use and shared by all nodes that reference them.
+    std::vector<std::vector<TriangleMesh*>> meshes;
+    std::vector<char> meshLoaded;
+    std::vector<Hitable*> hitables;
+
+    const std::vector<TriangleMesh*>& mesh(int index)
+    {
+        if (!meshLoaded[index])
+        {
+            meshLoaded[index] = 1;
+            const JsonValue* primitives = doc->get("meshes")->at(index)->get("primitives");
+            for (size_t i = 0; primitives != nullptr && i < primitives->size(); i++)
+            {
+                TriangleMesh* triMesh = loadGltfPrimitive(*doc, *buffers, *primitives->at(i), material, method, stats);
+                if (triMesh != nullptr)
+                    meshes[index].push_back(triMesh);
+            }
+        }
+        return meshes[index];
+    }
+
+    void addNode(int index, const Transform& parent, bool parentIsIdentity, int depth)
+    {
+        const JsonValue* nodes = doc->get("nodes");
+        const JsonValue* node = (nodes != nullptr) ? nodes->at(index) : nullptr;
+        if (node == nullptr || depth > BVH_MAX_DEPTH)
+            return;
+
+        Transform local;
+        const bool hasLocal = gltfNodeTransform(*node, local);
+        const Transform toWorld = hasLocal ? parent * local : parent;
+        const bool isIdentity = parentIsIdentity && !hasLocal;
+
+        const int meshIndex = node->getInt("mesh", -1);
+        if (meshIndex >= 0 && meshIndex < static_cast<int>(meshes.size()))
+        {
+            for (TriangleMesh* triMesh : mesh(meshIndex))
+                hitables.push_back(isIdentity ? static_cast<Hitable*>(triMesh) : new Instance(triMesh, toWorld));
+        }
+
+        const JsonValue* children = node->get("children");
+        for (size_t i = 0; children != nullptr && i < children->size(); i++)
+            addNode(static_cast<int>(children->at(i)->number), toWorld, isIdentity, depth + 1);
+    }
+};
+
+std::string directoryOf(const std::string& filename)
+{
+    const size_t slash = filename.find_last_of('/');
+    return (slash == std::string::npos) ? std::string() : filename.substr(0, slash + 1);
+}
+
+// Parses the JSON of a mapped .glb or .gltf; bin is the binary chunk of a .glb, if any.
+bool parseGltf(const MappedFile& file, JsonValue& doc, const char*& bin, size_t& binSize)
+{
+    // A .glb is a 12 byte header followed by a JSON chunk and an optional binary chunk,
+    // a .gltf is just the JSON.
+    const char* json = file.data();
+    size_t jsonSize = file.size();
+    bin = nullptr;
+    binSize = 0;
+    if (file.size() >= 12 && loadScalar<uint32_t>(file.data(), false) == GLB_MAGIC)
+    {
+        const size_t length = std::min(static_cast<size_t>(loadScalar<uint32_t>(file.data() + 8, false)), file.size());
+        size_t pos = 12;
+        json = nullptr;
+        while (pos + 8 <= length)
+        {
+            const size_t chunkLength = loadScalar<uint32_t>(file.data() + pos, false);
+            const uint32_t chunkType = loadScalar<uint32_t>(file.data() + pos + 4, false);
+            pos += 8;
+            if (chunkLength > length - pos)
+                return false;
+            if (chunkType == GLB_CHUNK_JSON && json == nullptr)
+            {
+                json = file.data() + pos;
+                jsonSize = chunkLength;
+            }
+            else if (chunkType == GLB_CHUNK_BIN && bin == nullptr)
+            {
+                bin = file.data() + pos;
+                binSize = chunkLength;
+            }
+            pos += (chunkLength + 3) & ~size_t(3);
+        }
+        if (json == nullptr)
+            return false;
+    }
+
+    JsonParser parser(json, json + jsonSize);
+    return parser.parse(doc) && doc.type == JsonValue::Object;
+}
+
+// Path of the file holding a buffer with a relative uri, which is mapped from the
+// directory of the glTF file, or empty for the binary chunk and data uris (not supported).
+std::string gltfBufferFile(const std::string& filename, const JsonValue* buffer)
+{
+    const JsonValue* uri = buffer->get("uri");
+    if (uri == nullptr || uri->type != JsonValue::String || uri->string.compare(0, 5, "data:") == 0)
+        return std::string();
+    return directoryOf(filename) + uri->string;
+}
+
+} // namespace
+
+TriangleMesh* LoadPLY(const std::string& filename, Material* material, BVHBuildMethod method, MeshLoadStats* stats)
+{
+    auto file = std::make_shared<MappedFile>();
+    if (!file->open(filename))
+        return nullptr;
+
+    std::vector<PlyElement> elements;
+    bool bigEndian = false;
+    size_t dataStart = 0;
+    if (!parsePlyHeader(*file, elements, bigEndian, dataStart))
+        return nullptr;
+    const bool swap = (bigEndian == hostIsLittleEndian());
+    if (!layoutPlyElements(*file, elements, dataStart, swap))
+        return nullptr;
+
+    const PlyElement* vertices = nullptr;
+    const PlyElement* faces = nullptr;
+    for (const PlyElement& element : elements)
+    {
+        if (element.name == "vertex")
+            vertices = &element;
+        else if (element.name == "face")
+            faces = &element;
+    }
+    if (vertices == nullptr || faces == nullptr || !vertices->fixedSize || vertices->count > 2147483647)
+        return nullptr;
+
+    int indexProp = faces->find("vertex_indices");
+    if (indexProp < 0)
+        indexProp = faces->find("vertex_index");
+    if (indexProp < 0 || !faces->properties[indexProp].isList)
+        return nullptr;
+    const PlyProperty& indexList = faces->properties[indexProp];
+
+    auto buffers = std::make_shared<MeshBuffers>();
+    buffers->files.push_back(file);
+    if (stats != nullptr)
+        *stats = MeshLoadStats();
+
+    StridedView<Vector3f> p, n;
+    StridedView<Vector2f> tex;
+    static const char* const positionNames[] = { "x", "y", "z" };
+    static const char* const normalNames[] = { "nx", "ny", "nz" };
+    static const char* const texCoordNames[][2] = { { "u", "v" }, { "s", "t" }, { "texture_u", "texture_v" }, { "texture_s", "texture_t" } };
+    if (!plyAttribute(*file, *vertices, positionNames, swap, p, buffers->positions, stats))
+        return nullptr;
+    plyAttribute(*file, *vertices, normalNames, swap, n, buffers->normals, stats);
+    for (const auto& names : texCoordNames)
+    {
+        if (plyAttribute(*file, *vertices, names, swap, tex, buffers->texCoords, stats))
+            break;
+    }
+
+    // Faces that are all triangles with 32-bit indices and nothing else are read in place.
+    const char* faceData = file->data() + faces->start;
+    const size_t triangleStride = 1 + sizeof(TriIndex);
+    bool inPlace = !swap && (faces->properties.size() == 1) && (plyTypeSize(indexList.countType) == 1) &&
+                   (indexList.type == PlyInt32 || indexList.type == PlyUInt32) &&
+                   (faces->size == static_cast<size_t>(faces->count) * triangleStride);
+    for (int64_t i = 0; inPlace && i < faces->count; i++)
+        inPlace = (faceData[i * triangleStride] == 3);
+
+    StridedView<TriIndex> tris;
+    std::vector<TriIndex> triCopy;
+    int64_t numTriangles = 0;
+    if (inPlace)
+    {
+        tris = StridedView<TriIndex>(faceData + 1, triangleStride);
+        numTriangles = faces->count;
+        if (stats != nullptr)
+            stats->buffersViewed++;
+    }
+    else
+    {
+        // Walk the records and triangulate the polygons as fans.
+        const char* rec = faceData;
+        const char* end = faceData + faces->size;
+        triCopy.reserve(static_cast<size_t>(faces->count));
+        for (int64_t f = 0; f < faces->count; f++)
+        {
+            for (size_t k = 0; k < faces->properties.size(); k++)
+            {
+                const PlyProperty& prop = faces->properties[k];
+                if (static_cast<int>(k) == indexProp)
+                {
+                    const size_t itemSize = plyTypeSize(prop.type);
+                    const int count = static_cast<int>(plyScalar(rec, prop.countType, swap));
+                    const char* items = rec + plyTypeSize(prop.countType);
+                    const unsigned int i0 = static_cast<unsigned int>(static_cast<int64_t>(plyScalar(items, prop.type, swap)));
+                    for (int c = 1; c + 1 < count; c++)
+                    {
+                        triCopy.push_back({ i0,
+                                            static_cast<unsigned int>(static_cast<int64_t>(plyScalar(items + c * itemSize, prop.type, swap))),
+                                            static_cast<unsigned int>(static_cast<int64_t>(plyScalar(items + (c + 1) * itemSize, prop.type, swap))) });
+                    }
+                }
+                rec = skipPlyProperty(prop, rec, end, swap);
+            }
+        }
+        tris = StridedView<TriIndex>(triCopy.data());
+        numTriangles = static_cast<int64_t>(triCopy.size());
+        if (stats != nullptr)
+            stats->buffersCopied++;
+    }
+    if (numTriangles > 2147483647)
+        return nullptr;
+
+    const int numVertices = static_cast<int>(vertices->count);
+    if (stats != nullptr)
+    {
+        stats->files.assign(1, filename);
+        stats->numPositions = numVertices;
+        stats->numNormals = n.valid() ? numVertices : 0;
+        stats->numTexCoords = tex.valid() ? numVertices : 0;
+        stats->numVertices = numVertices;
+        stats->numFaces = static_cast<int>(faces->count);
+    }
+
+    TriangleMesh* mesh = completeMesh(material, buffers, numVertices, p, n, tex, tris, static_cast<int>(numTriangles), method, stats);
+
+    // Unmap the file if only the index buffer, which complete() copied, referenced it.
+    const unsigned char* begin = reinterpret_cast<const unsigned char*>(file->data());
+    const unsigned char* end = begin + file->size();
+    auto inFile = [&](const unsigned char* ptr) { return ptr >= begin && ptr < end; };
+    if (!inFile(p.data) && !inFile(n.data) && !inFile(tex.data))
+        buffers->files.clear();
+
+    return mesh;
+}
+
+Hitable* LoadGLTF(const std::string& filename, Material* material, BVHBuildMethod method, MeshLoadStats* stats)
+{
+    auto file = std::make_shared<MappedFile>();
+    if (!file->open(filename))
+        return nullptr;
+
+    JsonValue doc;
+    const char* bin = nullptr;
+    size_t binSize = 0;
+    if (!parseGltf(*file, doc, bin, binSize))
+        return nullptr;
+
+    if (stats != nullptr)
+    {
+        *stats = MeshLoadStats();
+        stats->files.push_back(filename);
+    }
+
+    // The binary chunk is the first buffer of a .glb, the others are external files.
+    std::vector<GltfBuffer> buffers;
+    const JsonValue* bufferList = doc.get("buffers");
+    for (size_t i = 0; bufferList != nullptr && i < bufferList->size(); i++)
+    {
+        GltfBuffer buffer;
+        const std::string bufferFile = gltfBufferFile(filename, bufferList->at(i));
+        if (bufferFile.empty() && i == 0 && bin != nullptr)
+        {
+            buffer.data = bin;
+            buffer.size = binSize;
+            buffer.file = file;
+        }
+        else if (!bufferFile.empty())
+        {
+            buffer.file = std::make_shared<MappedFile>();
+            if (buffer.file->open(bufferFile))
+            {
+                buffer.data = buffer.file->data();
+                buffer.size = buffer.file->size();
+            }
+            if (stats != nullptr)
+                stats->files.push_back(bufferFile);
+        }
+        buffers.push_back(buffer);
+    }
+
+    GltfScene scene;
+    scene.doc = &doc;
+    scene.buffers = &buffers;
+    scene.material = material;
+    scene.method = method;
+    scene.stats = stats;
+    const JsonValue* meshes = doc.get("meshes");
+    scene.meshes.resize((meshes != nullptr) ? meshes->size() : 0);
+    scene.meshLoaded.resize(scene.meshes.size(), 0);
+
+    // Root nodes of the default scene, or every mesh untransformed if there is no scene.
+    const JsonValue* scenes = doc.get("scenes");
+    const JsonValue* sceneDesc = (scenes != nullptr) ? scenes->at(doc.getInt("scene", 0)) : nullptr;
+    const JsonValue* roots = (sceneDesc != nullptr) ? sceneDesc->get("nodes") : nullptr;
+    if (roots != nullptr)
+    {
+        for (size_t i = 0; i < roots->size(); i++)
+            scene.addNode(static_cast<int>(roots->at(i)->number), Transform(), true, 0);
+    }
+    else
+    {
+        for (size_t m = 0; m < scene.meshes.size(); m++)
+        {
+            for (TriangleMesh* triMesh : scene.mesh(static_cast<int>(m)))
+                scene.hitables.push_back(triMesh);
+        }
+    }
+
+    if (scene.hitables.empty())
+        return nullptr;
+
+    Hitable** list = new Hitable*[scene.hitables.size()];
+    std::copy(scene.hitables.begin(), scene.hitables.end(), list);
+    return new HitableList(static_cast<int>(scene.hitables.size()), list);
+}
+
+std::vector<std::string> GltfInputFiles(const std::string& filename)
+{
+    std::vector<std::string> files(1, filename);
+
+    MappedFile file;
+    JsonValue doc;
+    const char* bin = nullptr;
+    size_t binSize = 0;
+    if (!file.open(filename) || !parseGltf(file, doc, bin, binSize))
+        return files;
+
+    const JsonValue* bufferList = doc.get("buffers");
+    for (size_t i = 0; bufferList != nullptr && i < bufferList->size(); i++)
+    {
+        const std::string bufferFile = gltfBufferFile(filename, bufferList->at(i));
+        if (!bufferFile.empty())
+            files.push_back(bufferFile);
+    }
+    return files;
+}
@@ -7,7 +7,6 @@
  * This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
  */
 
-#include <math_constants.h>
 #include "ptCamera.h"
 
 Camera::Camera(float vfov, float aspect) :
@@ -7,7 +7,11 @@
  * This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
  */
 #include <ptBVH.h>
+#include <ptWideBVH.h>
+#include <ptInstance.h>
+#include <ptMotionBVH.h>
 #include <ptTriangle.h>
+#include <ptSphereSet.h>
 #include "ptHitable.h"
 #include "ptHitableList.h"
 #include "ptSphere.h"
@@ -63,12 +67,30 @@ COMMON_FUNC Hitable *Hitable::Create(Stream *pStream)
         case BVHTypeId:
             hitable = new BVH();
             break;
+        case BVH4TypeId:
+            hitable = new BVH4();
+            break;
+        case BVH8TypeId:
+            hitable = new BVH8();
+            break;
+        case InstanceTypeId:
+            hitable = new Instance();
+            break;
+        case InstanceBVHTypeId:
+            hitable = new InstanceBVH();
+            break;
+        case MotionBVHTypeId:
+            hitable = new MotionBVH();
+            break;
         case TriangleTypeId:
             hitable = new Triangle();
             break;
         case TriMeshTypeId:
             hitable = new TriangleMesh();
             break;
+        case SphereSetTypeId:
+            hitable = new SphereSet();
+            break;
         default:
             return nullptr;
     }
@@ -8,6 +8,26 @@
  */
 
 #include "ptHitableList.h"
+#include "ptPrimitive.h"
+
+HitableList::HitableList(int c, Hitable** l) :
+    count(c),
+    list(l)
+{
+    prims = CreatePrimitives(list, count);
+}
+
+HitableList::~HitableList()
+{
+    delete[] list;
+    delete[] prims;
+}
+
+void HitableList::setItem(int i, Hitable* item)
+{
+    list[i] = item;
+    prims[i] = MakePrimitive(item);
+}
 
 bool HitableList::hit(const Rayf &r, float tmin, float tmax, HitRecord &rec, RNG &rng) const
 {
@@ -16,7 +36,7 @@ bool HitableList::hit(const Rayf &r, float tmin, float tmax, HitRecord &rec, RNG
     float closest_so_far = tmax;
     for (int i = 0; i < count; i++)
     {
-        if (list[i]->hit(r, tmin, closest_so_far, temp_rec, rng))
+        if (hitPrimitive(prims[i], r, tmin, closest_so_far, temp_rec, rng))
         {
             hit_anything = true;
             closest_so_far = temp_rec.t;
@@ -77,6 +97,7 @@ bool HitableList::deserialize(Stream *pStream)
         {
             list[i] = Hitable::Create(pStream);
         }
+        prims = CreatePrimitives(list, count);
     }
 
     return ok;
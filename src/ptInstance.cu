@@ -0,0 +1,168 @@
+/*
+ * CUDA (GPU) Pathtracer based on Peter Shirley's 'Ray Tracing in One Weekend' e-book
+ * series.
+ *
+ * Copyright (C) 2017 by Rick Weyrauch - rpweyrauch@gmail.com
+ *
+ * This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+ */
+
+#include <unordered_map>
+#include <vector>
+#include "ptInstance.h"
+
+Instance::Instance(Hitable* geometry, const Transform& toWorld) :
+    m_geometry(geometry)
+{
+    setTransform(toWorld);
+}
+
+void Instance::setTransform(const Transform& toWorld)
+{
+    m_toWorld = toWorld;
+    m_toObject = toWorld.inverse();
+
+    AABB<float> box;
+    m_hasBox = m_geometry->bounds(0, 1, box);
+    if (m_hasBox)
+        m_bbox = m_toWorld.bounds(box);
+}
+
+bool Instance::hit(const Rayf& r, float tmin, float tmax, HitRecord& rec, RNG& rng) const
+{
+    // The direction is not renormalized so that t is the same in both spaces.
+    const Rayf objectRay(m_toObject.point(r.origin()), m_toObject.vector(r.direction()), r.time());
+    if (m_geometry->hit(objectRay, tmin, tmax, rec, rng))
+    {
+        rec.p = m_toWorld.point(rec.p);
+        rec.normal = unit_vector(m_toObject.transposeVector(rec.normal));
+        return true;
+    }
+    return false;
+}
+
+// Light sampling is done in object space; exact for rigid transforms.
+float Instance::pdfValue(const Vector3f& o, const Vector3f& v, RNG& rng) const
+{
+    return m_geometry->pdfValue(m_toObject.point(o), m_toObject.vector(v), rng);
+}
+
+Vector3f Instance::random(const Vector3f& o, RNG& rng) const
+{
+    return m_toWorld.vector(m_geometry->random(m_toObject.point(o), rng));
+}
+
+bool Instance::serialize(Stream* pStream) const
+{
+    if (pStream == nullptr)
+        return false;
+
+    const int id = typeId();
+    bool ok = pStream->write(&id, sizeof(id));
+    ok &= pStream->write(&m_geometryIndex, sizeof(m_geometryIndex));
+    if (m_geometryIndex < 0)
+    {
+        if (m_geometry != nullptr)
+            ok &= m_geometry->serialize(pStream);
+        else
+            ok &= pStream->writeNull();
+    }
+
+    ok &= m_toWorld.serialize(pStream);
+    ok &= m_toObject.serialize(pStream);
+    const int boxFlag = m_hasBox ? 1 : 0;
+    ok &= pStream->write(&boxFlag, sizeof(boxFlag));
+    ok &= m_bbox.serialize(pStream);
+
+    return ok;
+}
+
+bool Instance::deserialize(Stream* pStream)
+{
+    if (pStream == nullptr)
+        return false;
+
+    bool ok = pStream->read(&m_geometryIndex, sizeof(m_geometryIndex));
+    if (m_geometryIndex < 0)
+        m_geometry = Hitable::Create(pStream);
+
+    ok &= m_toWorld.deserialize(pStream);
+    ok &= m_toObject.deserialize(pStream);
+    int boxFlag;
+    ok &= pStream->read(&boxFlag, sizeof(boxFlag));
+    m_hasBox = (boxFlag != 0);
+    ok &= m_bbox.deserialize(pStream);
+
+    return ok;
+}
+
+InstanceBVH::InstanceBVH(Instance** instances, int numInstances, float time0, float time1, BVHBuildMethod method)
+{
+    // Gather the distinct geometry referenced by the instances.
+    std::unordered_map<Hitable*, int> geometryIndex;
+    for (int i = 0; i < numInstances; i++)
+    {
+        Hitable* geometry = instances[i]->geometry();
+        auto it = geometryIndex.find(geometry);
+        if (it == geometryIndex.end())
+            it = geometryIndex.emplace(geometry, static_cast<int>(geometryIndex.size())).first;
+        instances[i]->bindGeometry(it->second, geometry);
+    }
+
+    m_numGeometry = static_cast<int>(geometryIndex.size());
+    m_geometry = new Hitable*[m_numGeometry];
+    for (const auto& it : geometryIndex)
+        m_geometry[it.second] = it.first;
+
+    std::vector<Hitable*> list(instances, instances + numInstances);
+    m_tlas = new BVH(list.data(), numInstances, time0, time1, method);
+}
+
+bool InstanceBVH::serialize(Stream* pStream) const
+{
+    if (pStream == nullptr)
+        return false;
+
+    const int id = typeId();
+    bool ok = pStream->write(&id, sizeof(id));
+    ok &= pStream->write(&m_numGeometry, sizeof(m_numGeometry));
+    for (int i = 0; i < m_numGeometry; i++)
+    {
+        ok &= m_geometry[i]->serialize(pStream);
+    }
+    ok &= m_tlas->serialize(pStream);
+
+    return ok;
+}
+
+bool InstanceBVH::deserialize(Stream* pStream)
+{
+    if (pStream == nullptr)
+        return false;
+
+    bool ok = pStream->read(&m_numGeometry, sizeof(m_numGeometry));
+    if (ok && (m_numGeometry > 0))
+    {
+        m_geometry = new Hitable*[m_numGeometry];
+        for (int i = 0; i < m_numGeometry; i++)
+        {
+            m_geometry[i] = Hitable::Create(pStream);
+        }
+    }
+
+    Hitable* tlas = Hitable::Create(pStream);
+    if (tlas == nullptr || tlas->typeId() != BVHTypeId)
+        return false;
+    m_tlas = static_cast<BVH*>(tlas);
+
+    // Point the instances back at the shared geometry.
+    for (int i = 0; i < m_tlas->primitiveCount(); i++)
+    {
+        Instance* instance = static_cast<Instance*>(m_tlas->primitives()[i]);
+        const int index = instance->geometryIndex();
+        if (index >= 0 && index < m_numGeometry)
+            instance->bindGeometry(index, m_geometry[index]);
+    }
+
+    return ok;
+}
@@ -0,0 +1,507 @@
+/*
+ * CUDA (GPU) Pathtracer based on Peter Shirley's 'Ray Tracing in One Weekend' e-book
+ * series.
+ *
+ * Copyright (C) 2017 by Rick Weyrauch - rpweyrauch@gmail.com
+ *
+ * This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+ */
+
+//
+// Linear BVH builder.
+//
+// Primitives are sorted along a Morton curve of their centroids and the binary radix
+// tree over the sorted codes is emitted with every internal node built independently
+// (Karras, "Maximizing Parallelism in the Construction of BVHs, Octrees, and k-d Trees",
+// HPG 2012).  Bounds and SAH costs are then propagated bottom-up, optionally
+// restructuring 7-leaf treelets for a lower SAH cost on the way (Karras and Aila, "Fast
+// Parallel Construction of High-Quality Bounding Volume Hierarchies", HPG 2013).
+// Every pass except the final flattening is O(n) and runs in parallel with OpenMP.
+//
+
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <memory>
+#include <vector>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "ptBVH.h"
+
+// Above this many primitives the 30-bit codes (10 bits per axis) start to produce too
+// many duplicates and 63-bit codes (21 bits per axis) are used instead.
+static const int LBVH_30BIT_MAX_PRIMS = 1 << 18;
+
+static const int TREELET_SIZE = 7;
+// Treelets are only formed below nodes with at least this many primitives.
+static const int TREELET_MIN_PRIMS = TREELET_SIZE;
+
+static int threadIndex()
+{
+#ifdef _OPENMP
+    return omp_get_thread_num();
+#else
+    return 0;
+#endif
+}
+
+static int threadCount()
+{
+#ifdef _OPENMP
+    return omp_get_num_threads();
+#else
+    return 1;
+#endif
+}
+
+static int maxThreadCount()
+{
+#ifdef _OPENMP
+    return omp_get_max_threads();
+#else
+    return 1;
+#endif
+}
+
+struct MortonPrimitive
+{
+    uint64_t code;
+    int index;      // into primInfo
+};
+
+// Insert two zero bits between each of the low 10 bits of v.
+static inline uint64_t expandBits10(uint32_t v)
+{
+    uint64_t x = v & 0x3ff;
+    x = (x | (x << 16)) & 0x30000ff;
+    x = (x | (x << 8)) & 0x300f00f;
+    x = (x | (x << 4)) & 0x30c30c3;
+    x = (x | (x << 2)) & 0x9249249;
+    return x;
+}
+
+// Insert two zero bits between each of the low 21 bits of v.
+static inline uint64_t expandBits21(uint64_t v)
+{
+    uint64_t x = v & 0x1fffff;
+    x = (x | (x << 32)) & 0x1f00000000ffffULL;
+    x = (x | (x << 16)) & 0x1f0000ff0000ffULL;
+    x = (x | (x << 8)) & 0x100f00f00f00f00fULL;
+    x = (x | (x << 4)) & 0x10c30c30c30c30c3ULL;
+    x = (x | (x << 2)) & 0x1249249249249249ULL;
+    return x;
+}
+
+//
+// Parallel least-significant-digit radix sort on the low numBits of the codes.  Each
+// thread histograms and scatters its own contiguous chunk, so the sort is stable.
+//
+static void radixSort(std::vector<MortonPrimitive>& prims, int numBits)
+{
+    const int bitsPerPass = 8;
+    const int numBuckets = 1 << bitsPerPass;
+    const int numPasses = (numBits + bitsPerPass - 1) / bitsPerPass;
+    const int n = static_cast<int>(prims.size());
+
+    std::vector<MortonPrimitive> temp(prims.size());
+    std::vector<int> offsets(maxThreadCount() * numBuckets);
+
+    for (int pass = 0; pass < numPasses; pass++)
+    {
+        const int shift = pass * bitsPerPass;
+        const MortonPrimitive* in = prims.data();
+        MortonPrimitive* out = temp.data();
+
+#pragma omp parallel
+        {
+            const int tid = threadIndex();
+            const int numThreads = threadCount();
+            const int begin = static_cast<int>((int64_t)n * tid / numThreads);
+            const int end = static_cast<int>((int64_t)n * (tid + 1) / numThreads);
+
+            int* count = &offsets[tid * numBuckets];
+            std::fill(count, count + numBuckets, 0);
+            for (int i = begin; i < end; i++)
+                count[(in[i].code >> shift) & (numBuckets - 1)]++;
+
+#pragma omp barrier
+#pragma omp single
+            {
+                // Exclusive prefix sum, bucket-major then thread order.
+                int sum = 0;
+                for (int b = 0; b < numBuckets; b++)
+                {
+                    for (int t = 0; t < numThreads; t++)
+                    {
+                        const int c = offsets[t * numBuckets + b];
+                        offsets[t * numBuckets + b] = sum;
+                        sum += c;
+                    }
+                }
+            }
+
+            for (int i = begin; i < end; i++)
+                out[count[(in[i].code >> shift) & (numBuckets - 1)]++] = in[i];
+        }
+
+        prims.swap(temp);
+    }
+}
+
+// Child references: >= 0 is an internal node, < 0 is the leaf ~index.
+struct LBVHNode
+{
+    AABB<float> bounds;
+    int child[2];
+    int parent;
+    int numPrims;
+    float cost;     // SAH cost of the subtree, weighted by area
+    bool leaf;      // cheaper to intersect all primitives of the subtree than to split
+};
+
+struct LBVHBuilder
+{
+    const std::vector<BVHPrimitiveInfo>& primInfo;
+    std::vector<MortonPrimitive> sorted;
+    std::vector<LBVHNode> nodes;
+    std::vector<int> leafParent;
+    int maxPrimsInLeaf;
+    int packetWidth;
+
+    LBVHBuilder(const std::vector<BVHPrimitiveInfo>& info, int maxPrims, int width) :
+        primInfo(info),
+        maxPrimsInLeaf(maxPrims),
+        packetWidth(width) {}
+
+    const AABB<float>& bounds(int c) const { return (c >= 0) ? nodes[c].bounds : primInfo[sorted[~c].index].bounds; }
+    int numPrims(int c) const { return (c >= 0) ? nodes[c].numPrims : 1; }
+    float cost(int c) const { return (c >= 0) ? nodes[c].cost : BVH_INTERSECT_COST * bounds(c).surfaceArea(); }
+
+    void setParent(int c, int parent)
+    {
+        if (c >= 0)
+            nodes[c].parent = parent;
+        else
+            leafParent[~c] = parent;
+    }
+
+    // Length of the common prefix of sorted codes i and j; equal codes are told apart by index.
+    int delta(int i, int64_t j) const
+    {
+        const int n = static_cast<int>(sorted.size());
+        if (j < 0 || j >= n)
+            return -1;
+        const uint64_t a = sorted[i].code;
+        const uint64_t b = sorted[j].code;
+        if (a != b)
+            return __builtin_clzll(a ^ b);
+        return 64 + __builtin_clz(static_cast<uint32_t>(i ^ (int)j));
+    }
+
+    void emitNode(int i)
+    {
+        // Direction of the node's range and the prefix shared with the neighbour outside it.
+        const int d = (delta(i, i + 1) - delta(i, i - 1)) >= 0 ? 1 : -1;
+        const int deltaMin = delta(i, i - d);
+
+        // Upper bound on the range length, then binary search for the other end.
+        int64_t lmax = 2;
+        while (delta(i, i + lmax * d) > deltaMin)
+            lmax *= 2;
+        int64_t l = 0;
+        for (int64_t t = lmax / 2; t >= 1; t /= 2)
+        {
+            if (delta(i, i + (l + t) * d) > deltaMin)
+                l += t;
+        }
+        const int j = static_cast<int>(i + l * d);
+
+        // Binary search for the split: the last position sharing more than deltaNode bits with i.
+        const int deltaNode = delta(i, j);
+        int64_t s = 0;
+        for (int64_t div = 2; ; div *= 2)
+        {
+            const int64_t t = (l + div - 1) / div;
+            if (delta(i, i + (s + t) * d) > deltaNode)
+                s += t;
+            if (t <= 1)
+                break;
+        }
+        const int gamma = static_cast<int>(i + s * d + std::min(d, 0));
+
+        const int first = std::min(i, j);
+        const int last = std::max(i, j);
+        LBVHNode& node = nodes[i];
+        node.child[0] = (first == gamma) ? ~gamma : gamma;
+        node.child[1] = (last == gamma + 1) ? ~(gamma + 1) : gamma + 1;
+        setParent(node.child[0], i);
+        setParent(node.child[1], i);
+    }
+
+    void updateNode(int i)
+    {
+        LBVHNode& node = nodes[i];
+        const int c0 = node.child[0];
+        const int c1 = node.child[1];
+        node.bounds = join(bounds(c0), bounds(c1));
+        node.numPrims = numPrims(c0) + numPrims(c1);
+
+        const float area = node.bounds.surfaceArea();
+        const float interiorCost = BVH_TRAVERSAL_COST * area + cost(c0) + cost(c1);
+        const float leafCost = BVHLeafCost(node.numPrims, packetWidth) * area;
+        node.leaf = (node.numPrims <= maxPrimsInLeaf) && (leafCost <= interiorCost);
+        node.cost = node.leaf ? leafCost : interiorCost;
+    }
+
+    void optimizeTreelet(int root);
+    int rebuildTreelet(int mask, int index, const int* leaves, const int* split, int* pool, int* poolSize);
+
+    bool flatten(std::vector<LinearBVHNode>& out, std::vector<BVHPrimitiveInfo>& ordered);
+    uint32_t flattenNode(int c, int depth, int* maxDepth, std::vector<LinearBVHNode>& out, std::vector<BVHPrimitiveInfo>& ordered, int* primOffset);
+    void gatherPrims(int c, std::vector<BVHPrimitiveInfo>& ordered, int* primOffset) const;
+};
+
+void LBVHBuilder::optimizeTreelet(int root)
+{
+    // Grow the treelet by repeatedly opening the internal treelet leaf with the largest area.
+    int leaves[TREELET_SIZE];
+    int pool[TREELET_SIZE - 2];
+    int numLeaves = 0;
+    int poolSize = 0;
+    leaves[numLeaves++] = nodes[root].child[0];
+    leaves[numLeaves++] = nodes[root].child[1];
+    while (numLeaves < TREELET_SIZE)
+    {
+        int best = -1;
+        float bestArea = -1;
+        for (int k = 0; k < numLeaves; k++)
+        {
+            if (leaves[k] >= 0 && nodes[leaves[k]].bounds.surfaceArea() > bestArea)
+            {
+                bestArea = nodes[leaves[k]].bounds.surfaceArea();
+                best = k;
+            }
+        }
+        if (best < 0)
+            break;
+
+        const int expand = leaves[best];
+        pool[poolSize++] = expand;
+        leaves[best] = nodes[expand].child[0];
+        leaves[numLeaves++] = nodes[expand].child[1];
+    }
+    if (numLeaves < 3)
+        return;
+
+    // Optimal SAH cost of every subset of the treelet leaves (dynamic programming).
+    const int numSubsets = 1 << numLeaves;
+    AABB<float> subsetBounds[1 << TREELET_SIZE];
+    int subsetPrims[1 << TREELET_SIZE];
+    float subsetCost[1 << TREELET_SIZE];
+    int split[1 << TREELET_SIZE];
+
+    for (int mask = 1; mask < numSubsets; mask++)
+    {
+        const int lowest = mask & -mask;
+        if (mask == lowest)
+        {
+            const int k = __builtin_ctz(mask);
+            subsetBounds[mask] = bounds(leaves[k]);
+            subsetPrims[mask] = numPrims(leaves[k]);
+            subsetCost[mask] = cost(leaves[k]);
+            split[mask] = 0;
+            continue;
+        }
+
+        subsetBounds[mask] = join(subsetBounds[mask ^ lowest], subsetBounds[lowest]);
+        subsetPrims[mask] = subsetPrims[mask ^ lowest] + subsetPrims[lowest];
+
+        // Each partition once: the part holding the lowest leaf goes left.
+        float bestCost = FLT_MAX;
+        int bestSplit = lowest;
+        for (int sub = (mask - 1) & mask; sub > 0; sub = (sub - 1) & mask)
+        {
+            if ((sub & lowest) == 0)
+                continue;
+            const float c = subsetCost[sub] + subsetCost[mask ^ sub];
+            if (c < bestCost)
+            {
+                bestCost = c;
+                bestSplit = sub;
+            }
+        }
+
+        const float area = subsetBounds[mask].surfaceArea();
+        const float interiorCost = BVH_TRAVERSAL_COST * area + bestCost;
+        const float leafCost = BVHLeafCost(subsetPrims[mask], packetWidth) * area;
+        subsetCost[mask] = (subsetPrims[mask] <= maxPrimsInLeaf && leafCost < interiorCost) ? leafCost : interiorCost;
+        split[mask] = bestSplit;
+    }
+
+    const int all = numSubsets - 1;
+    if (!(subsetCost[all] < nodes[root].cost * (1 - 1e-5f)))
+        return;
+
+    rebuildTreelet(all, root, leaves, split, pool, &poolSize);
+}
+
+int LBVHBuilder::rebuildTreelet(int mask, int index, const int* leaves, const int* split, int* pool, int* poolSize)
+{
+    if ((mask & (mask - 1)) == 0)
+        return leaves[__builtin_ctz(mask)];
+
+    if (index < 0)
+        index = pool[--(*poolSize)];
+
+    const int c0 = rebuildTreelet(split[mask], -1, leaves, split, pool, poolSize);
+    const int c1 = rebuildTreelet(mask ^ split[mask], -1, leaves, split, pool, poolSize);
+    nodes[index].child[0] = c0;
+    nodes[index].child[1] = c1;
+    setParent(c0, index);
+    setParent(c1, index);
+    updateNode(index);
+    return index;
+}
+
+void LBVHBuilder::gatherPrims(int c, std::vector<BVHPrimitiveInfo>& ordered, int* primOffset) const
+{
+    if (c < 0)
+    {
+        ordered[(*primOffset)++] = primInfo[sorted[~c].index];
+        return;
+    }
+    gatherPrims(nodes[c].child[0], ordered, primOffset);
+    gatherPrims(nodes[c].child[1], ordered, primOffset);
+}
+
+uint32_t LBVHBuilder::flattenNode(int c, int depth, int* maxDepth, std::vector<LinearBVHNode>& out, std::vector<BVHPrimitiveInfo>& ordered, int* primOffset)
+{
+    *maxDepth = std::max(*maxDepth, depth);
+
+    const uint32_t offset = static_cast<uint32_t>(out.size());
+    out.emplace_back();
+    out[offset].bounds = bounds(c);
+    out[offset].pad = 0;
+
+    if (c < 0 || nodes[c].leaf)
+    {
+        out[offset].primitivesOffset = static_cast<uint32_t>(*primOffset);
+        out[offset].numPrims = static_cast<uint16_t>(numPrims(c));
+        out[offset].axis = 0;
+        gatherPrims(c, ordered, primOffset);
+        return offset;
+    }
+
+    // Traversal visits the child on the near side of this axis first.
+    const Vector3f d = bounds(nodes[c].child[1]).centroid() - bounds(nodes[c].child[0]).centroid();
+    int axis = 0;
+    if (Abs(d.y()) > Abs(d[axis])) axis = 1;
+    if (Abs(d.z()) > Abs(d[axis])) axis = 2;
+
+    const int c0 = (d[axis] >= 0) ? nodes[c].child[0] : nodes[c].child[1];
+    const int c1 = (d[axis] >= 0) ? nodes[c].child[1] : nodes[c].child[0];
+
+    out[offset].axis = static_cast<uint8_t>(axis);
+    out[offset].numPrims = 0;
+    flattenNode(c0, depth + 1, maxDepth, out, ordered, primOffset);
+    const uint32_t second = flattenNode(c1, depth + 1, maxDepth, out, ordered, primOffset);
+    out[offset].secondChildOffset = second;
+    return offset;
+}
+
+bool LBVHBuilder::flatten(std::vector<LinearBVHNode>& out, std::vector<BVHPrimitiveInfo>& ordered)
+{
+    const int root = (sorted.size() == 1) ? ~0 : 0;
+    out.reserve(2 * sorted.size());
+    ordered.resize(sorted.size());
+    int primOffset = 0;
+    int maxDepth = 0;
+    flattenNode(root, 1, &maxDepth, out, ordered, &primOffset);
+    return maxDepth <= BVH_MAX_DEPTH;
+}
+
+bool BuildLBVHNodes(std::vector<BVHPrimitiveInfo>& primInfo, bool optimizeTreelets, int maxPrimsInLeaf,
+                    std::vector<LinearBVHNode>& linearNodes, float* sahCost, int packetWidth)
+{
+    const int n = static_cast<int>(primInfo.size());
+    LBVHBuilder builder(primInfo, maxPrimsInLeaf, packetWidth);
+
+    // Centroid bounds, for quantizing the centroids.
+    AABB<float> centroidBounds(primInfo[0].centroid, primInfo[0].centroid);
+#pragma omp parallel
+    {
+        AABB<float> local(primInfo[0].centroid, primInfo[0].centroid);
+#pragma omp for schedule(static) nowait
+        for (int i = 0; i < n; i++)
+            local = join(local, AABB<float>(primInfo[i].centroid, primInfo[i].centroid));
+#pragma omp critical
+        centroidBounds = join(centroidBounds, local);
+    }
+
+    const int bitsPerAxis = (n > LBVH_30BIT_MAX_PRIMS) ? 21 : 10;
+    const float cells = static_cast<float>(1 << bitsPerAxis);
+    const Vector3f extent = centroidBounds.max() - centroidBounds.min();
+    Vector3f scale;
+    for (int a = 0; a < 3; a++)
+        scale[a] = (extent[a] > 0) ? cells / extent[a] : 0;
+
+    builder.sorted.resize(n);
+#pragma omp parallel for schedule(static)
+    for (int i = 0; i < n; i++)
+    {
+        uint64_t code = 0;
+        for (int a = 0; a < 3; a++)
+        {
+            const float q = (primInfo[i].centroid[a] - centroidBounds.min()[a]) * scale[a];
+            const uint32_t cell = static_cast<uint32_t>(Clamp(q, 0.0f, cells - 1));
+            code |= ((bitsPerAxis == 10) ? expandBits10(cell) : expandBits21(cell)) << (2 - a);
+        }
+        builder.sorted[i].code = code;
+        builder.sorted[i].index = i;
+    }
+
+    radixSort(builder.sorted, 3 * bitsPerAxis);
+
+    builder.nodes.resize(std::max(n - 1, 0));
+    builder.leafParent.resize(n, -1);
+    if (n > 1)
+    {
+        builder.nodes[0].parent = -1;
+
+#pragma omp parallel for schedule(static)
+        for (int i = 0; i < n - 1; i++)
+            builder.emitNode(i);
+
+        // Bottom-up pass: the second thread to reach a node finishes it.
+        std::unique_ptr<std::atomic<int>[]> visits(new std::atomic<int>[n - 1]);
+        for (int i = 0; i < n - 1; i++)
+            visits[i].store(0, std::memory_order_relaxed);
+
+#pragma omp parallel for schedule(static)
+        for (int i = 0; i < n; i++)
+        {
+            int node = builder.leafParent[i];
+            while (node >= 0)
+            {
+                if (visits[node].fetch_add(1, std::memory_order_acq_rel) == 0)
+                    break;
+
+                builder.updateNode(node);
+                if (optimizeTreelets && builder.nodes[node].numPrims >= TREELET_MIN_PRIMS)
+                    builder.optimizeTreelet(node);
+                node = builder.nodes[node].parent;
+            }
+        }
+    }
+
+    linearNodes.clear();
+    std::vector<BVHPrimitiveInfo> ordered;
+    if (!builder.flatten(linearNodes, ordered))
+        return false;
+
+    const int root = (n == 1) ? ~0 : 0;
+    *sahCost = builder.cost(root) / builder.bounds(root).surfaceArea();
+    primInfo.swap(ordered);
+    return true;
+}
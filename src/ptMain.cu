@@ -8,12 +8,19 @@
  */
 
 #include "ptCudaCommon.h"
+#ifndef PT_CPU_ONLY
 #include <cuda_runtime_api.h>
+#endif
 #include <iostream>
 #include <fstream>
+#include <mutex>
 #include <thread>
 #include <vector>
 #include <algorithm>
+#include <chrono>
+#include <climits>
+#include <limits>
+#include <csignal>
 #include <unistd.h>
 #include "ptAABB.h"
 #include "ptRectangle.h"
@@ -23,10 +30,18 @@
 #include "ptAmbientLight.h"
 #include "ptRay.h"
 #include "ptBVH.h"
+#include "ptScene.h"
+#include "ptInstance.h"
+#include "ptTriangle.h"
+#include "ptMeshLoader.h"
 #include "ptCamera.h"
 #include "ptMaterial.h"
+#include "ptMaterialTable.h"
 #include "ptMedium.h"
 #include "ptProgress.h"
+#include "ptArena.h"
+#include "ptSceneCache.h"
+#include "ptTileScheduler.h"
 #include "cxxopts.hpp"
 
 #define STB_IMAGE_WRITE_IMPLEMENTATION
@@ -38,11 +53,19 @@
 #ifdef __CUDA_ARCH__
     __device__ AmbientLight* g_ambientLight = nullptr;
     __device__ Camera* g_cam = nullptr;
+    __device__ MaterialTable* g_materials = nullptr;
 #else
     AmbientLight* g_ambientLight = nullptr;
     Camera* g_cam = nullptr;
+    MaterialTable* g_materials = nullptr;
 #endif
 
+// BVH build method used by the scene builders.
+BVHBuildMethod g_bvhBuildMethod = BVHBuildSAH;
+
+// Mesh file rendered by the file_mesh scene.
+std::string g_meshFile;
+
 COMMON_FUNC Vector3f deNan(const Vector3f& c)
 {
     Vector3f temp = c;
@@ -104,8 +127,8 @@ COMMON_FUNC Vector3f color(const Rayf& r_in, Hitable* world, Hitable* lightShape
         if (world->hit(currentRay, 0.001f, FLT_MAX, rec, rng))
         {
             ScatterRecord srec;
-            auto emitted = rec.material->emitted(currentRay, rec, rec.uv, rec.p);
-            if (rec.material->scatter(currentRay, rec, srec, rng))
+            auto emitted = g_materials->emitted(currentRay, rec, rec.uv, rec.p);
+            if (g_materials->scatter(currentRay, rec, srec, rng))
             {
                 if (srec.isSpecular)
                 {
@@ -122,14 +145,14 @@ COMMON_FUNC Vector3f color(const Rayf& r_in, Hitable* world, Hitable* lightShape
                         MixturePdf p(&plight, &pdf);
                         auto scattered = Rayf(rec.p, p.generate(rng), currentRay.time());
                         float pdfValue = p.value(scattered.direction(), rng);
-                        accumCol *= (emitted + (srec.attenuation * rec.material->scatteringPdf(currentRay, rec, scattered)) / pdfValue);
+                        accumCol *= (emitted + (srec.attenuation * g_materials->scatteringPdf(currentRay, rec, scattered)) / pdfValue);
                         currentRay = scattered;
                     }
                     else
                     {
                         auto scattered = Rayf(rec.p, srec.cosinePdf ? pdf.generate(rng) : pdf2.generate(rng), currentRay.time());
                         float pdfValue = srec.cosinePdf ? pdf.value(scattered.direction(), rng) : pdf2.value(scattered.direction(), rng);
-                        accumCol *= (emitted + (srec.attenuation * rec.material->scatteringPdf(currentRay, rec, scattered)) / pdfValue);
+                        accumCol *= (emitted + (srec.attenuation * g_materials->scatteringPdf(currentRay, rec, scattered)) / pdfValue);
                         currentRay = scattered;
                     }
                 }
@@ -150,16 +173,19 @@ COMMON_FUNC Vector3f color(const Rayf& r_in, Hitable* world, Hitable* lightShape
     return accumCol;
 }
 
-COMMON_FUNC Vector3f render_pixel(Hitable** world, Hitable** lightShapes, int x, int y, int nx, int ny, int ns, RNG& rng, int maxDepth)
+// Radiance of sample s of pixel (x, y), drawn from the sample's own random stream.
+COMMON_FUNC Vector3f render_sample(Hitable** world, Hitable** lightShapes, int x, int y, int nx, int ny, int s, int maxDepth)
+{
+    SampleRng rng(y * nx + x, s);
+    float u = (x + rng.rand()) / float(nx);
+    float v = (y + rng.rand()) / float(ny);
+    Rayf r = g_cam->getRay(u, v, rng);
+    return deNan(color(r, *world, *lightShapes, rng, maxDepth));
+}
+
+// Gamma corrected estimate of a pixel from the sum of its first ns samples.
+COMMON_FUNC Vector3f resolve_pixel(Vector3f accumCol, int ns)
 {
-    Vector3f accumCol(0, 0, 0);
-    for (int s = 0; s < ns; s++)
-    {
-        float u = (x + rng.rand()) / float(nx);
-        float v = (y + rng.rand()) / float(ny);
-        Rayf r = g_cam->getRay(u, v, rng);
-        accumCol += deNan(color(r, *world, *lightShapes, rng, maxDepth));
-    }
     accumCol /= float(ns);
     accumCol[0] = sqrtf(fmaxf(0.0f, accumCol[0]));
     accumCol[1] = sqrtf(fmaxf(0.0f, accumCol[1]));
@@ -168,6 +194,17 @@ COMMON_FUNC Vector3f render_pixel(Hitable** world, Hitable** lightShapes, int x,
     return accumCol;
 }
 
+COMMON_FUNC Vector3f render_pixel(Hitable** world, Hitable** lightShapes, int x, int y, int nx, int ny, int ns, int maxDepth)
+{
+    Vector3f accumCol(0, 0, 0);
+    for (int s = 0; s < ns; s++)
+    {
+        accumCol += render_sample(world, lightShapes, x, y, nx, ny, s, maxDepth);
+    }
+    return resolve_pixel(accumCol, ns);
+}
+
+#ifndef PT_CPU_ONLY
 __global__ void render_kernel(float3* pOutImage, Hitable** world, Hitable** lightShapes, int nx, int ny, int ns, int maxDepth, int* progress)
 {
     int x = blockIdx.x * blockDim.x + threadIdx.x;
@@ -177,19 +214,16 @@ __global__ void render_kernel(float3* pOutImage, Hitable** world, Hitable** ligh
 
     unsigned int i = (ny - y - 1) * nx + x; // index of current pixel (calculated using thread index)
 
-    unsigned int seed0 = x;  // seeds for random number generator
-    unsigned int seed1 = y;
-    //SimpleRng rng(seed0, seed1);
-    PcgRng rng(i);
-    Vector3f accumCol = render_pixel(world, lightShapes, x, y, nx, ny, ns, rng, maxDepth);
+    Vector3f accumCol = render_pixel(world, lightShapes, x, y, nx, ny, ns, maxDepth);
 
     pOutImage[i] = make_float3(accumCol[0], accumCol[1], accumCol[2]);
 
     if (progress != nullptr)
         atomicAdd(progress, 1);
 }
+#endif // PT_CPU_ONLY
 
-COMMON_FUNC void simple_spheres(float aspect, Hitable **world, Hitable** lightShapes, Camera** camera, AmbientLight** ambientLight)
+void simple_spheres(float aspect, Hitable **world, Hitable** lightShapes, Camera** camera, AmbientLight** ambientLight)
 {
     int i = 0;
     Hitable** list = new Hitable*[4];
@@ -206,7 +240,7 @@ COMMON_FUNC void simple_spheres(float aspect, Hitable **world, Hitable** lightSh
     *ambientLight = new SkyAmbient();
 }
 
-COMMON_FUNC void simple_light(float aspect, Hitable **world, Hitable** lightShapes, Camera** camera, AmbientLight** ambientLight)
+void simple_light(float aspect, Hitable **world, Hitable** lightShapes, Camera** camera, AmbientLight** ambientLight)
 {
     const Vector3f lookFrom(13, 2, 3);
     const Vector3f lookAt(0, 0, 0);
@@ -233,7 +267,7 @@ COMMON_FUNC void simple_light(float aspect, Hitable **world, Hitable** lightShap
     *lightShapes = new HitableList(2, lights);
 }
 
-COMMON_FUNC void random_scene(float aspect, Hitable **world, Hitable** lightShapes, Camera** camera, AmbientLight** ambientLight)
+void random_scene(float aspect, Hitable **world, Hitable** lightShapes, Camera** camera, AmbientLight** ambientLight)
 {
     const Vector3f lookFrom(13, 2, 3);
     const Vector3f lookAt(0, 0, 0);
@@ -283,7 +317,7 @@ COMMON_FUNC void random_scene(float aspect, Hitable **world, Hitable** lightShap
     *lightShapes = nullptr;
 }
 
-COMMON_FUNC void cornell_box(float aspect, Hitable **world, Hitable** lightShapes, Camera** camera, AmbientLight** ambientLight)
+void cornell_box(float aspect, Hitable **world, Hitable** lightShapes, Camera** camera, AmbientLight** ambientLight)
 {
     int i = 0;
     Hitable **list = new Hitable*[8];
@@ -316,7 +350,7 @@ COMMON_FUNC void cornell_box(float aspect, Hitable **world, Hitable** lightShape
     *lightShapes = new XZRectangle(213, 343, 227, 332, 554, NULL);
 }
 
-COMMON_FUNC void cornell_box_spheres(float aspect, Hitable **world, Hitable** lightShapes, Camera** camera, AmbientLight** ambientLight)
+void cornell_box_spheres(float aspect, Hitable **world, Hitable** lightShapes, Camera** camera, AmbientLight** ambientLight)
 {
     int i = 0;
     Hitable **list = new Hitable*[8];
@@ -347,7 +381,7 @@ COMMON_FUNC void cornell_box_spheres(float aspect, Hitable **world, Hitable** li
     *lightShapes = nullptr;
 }
 
-COMMON_FUNC void final(float aspect, Hitable **world, Hitable** lightShapes, Camera** camera, AmbientLight** ambientLight)
+void final(float aspect, Hitable **world, Hitable** lightShapes, Camera** camera, AmbientLight** ambientLight)
 {
     const Vector3f lookFrom(478, 278, -600); //(278, 278, -800); //(13, 2, 3);
     const Vector3f lookAt(278, 278, 0); //(0, 1, 0);
@@ -381,7 +415,8 @@ COMMON_FUNC void final(float aspect, Hitable **world, Hitable** lightShapes, Cam
 
     int i = 0;
     Hitable **list = new Hitable*[12];
-    list[i++] = new BVH(boxList, bi, 0, 1, rng);
+    list[i++] = new BVH(boxList, bi, 0, 1, g_bvhBuildMethod);
+    delete[] boxList;
     Material* light = new DiffuseLight(new ConstantTexture(Vector3f(6, 6, 6)));
     list[i++] = new FlipNormals(new XZRectangle(123, 423, 147, 412, 554, light));
     Vector3f center(400, 400, 200);
@@ -409,7 +444,8 @@ COMMON_FUNC void final(float aspect, Hitable **world, Hitable** lightShapes, Cam
     {
         boxList2[j] = new Sphere(Vector3f(165*rng.rand(), 165*rng.rand(), 165*rng.rand()), 10, white);
     }
-    //list[i++] = new Translate(new RotateY(new BVH(boxList2, ns, 0.0f, 1.0f, rng), 15), Vector3f(-100, 270, 395));
+    //list[i++] = new Translate(new RotateY(new BVH(boxList2, ns, 0.0f, 1.0f, g_bvhBuildMethod), 15), Vector3f(-100, 270, 395));
+    delete[] boxList2;
 
     *lightShapes = new XZRectangle(123, 423, 147, 412, 554, nullptr);
     //lights.push_back(new Sphere(Vector3(360, 150, 145), 70, nullptr));
@@ -420,14 +456,157 @@ COMMON_FUNC void final(float aspect, Hitable **world, Hitable** lightShapes, Cam
     *world = new HitableList(i, list);
 }
 
+void instances(float aspect, Hitable **world, Hitable** lightShapes, Camera** camera, AmbientLight** ambientLight)
+{
+    const Vector3f lookFrom(0, 24, 40);
+    const Vector3f lookAt(0, 0, 0);
+    *camera = new Camera(lookFrom, lookAt, Vector3f(0, 1, 0), 40, aspect, 0.0f, 10.0f, 0.0, 1.0);
+
+    SimpleRng rng(42, 13);
+
+    // Two pieces of shared geometry: a box and a small cluster of spheres.
+    Hitable* box = new Box(Vector3f(-0.5f, 0, -0.5f), Vector3f(0.5f, 1, 0.5f), new Lambertian(new ConstantTexture(Vector3f(0.73, 0.35, 0.2))));
+    const int nc = 64;
+    Hitable** cluster = new Hitable*[nc];
+    Material* metal = new Metal(Vector3f(0.8, 0.8, 0.9), 0.1);
+    for (int j = 0; j < nc; j++)
+    {
+        cluster[j] = new Sphere(Vector3f(rng.rand() - 0.5f, rng.rand(), rng.rand() - 0.5f), 0.1f, metal);
+    }
+    Hitable* clusterBVH = new BVH(cluster, nc, 0, 1, g_bvhBuildMethod);
+    delete[] cluster;
+
+    const int nb = 64;
+    Hitable** list = new Hitable*[nb * nb + 1];
+    int i = 0;
+    list[i++] = new Sphere(Vector3f(0, -1000, 0), 1000, new Lambertian(new ConstantTexture(Vector3f(0.5, 0.5, 0.5))));
+    for (int a = 0; a < nb; a++)
+    {
+        for (int b = 0; b < nb; b++)
+        {
+            const Vector3f position(a - nb / 2 + 0.5f, 0, b - nb / 2 + 0.5f);
+            const float scale = 0.3f + 0.4f * rng.rand();
+            const Transform toWorld = Transform::Translate(position) * Transform::RotateY(360 * rng.rand()) *
+                                      Transform::Scale(Vector3f(scale, scale + rng.rand(), scale));
+            list[i++] = new Instance(((a + b) % 2) ? box : clusterBVH, toWorld);
+        }
+    }
+
+    *world = new HitableList(i, list);
+    *lightShapes = nullptr;
+    *ambientLight = new SkyAmbient();
+}
+
+// Torus around the y axis with smooth normals and (u, v) wrapping once around each circle.
+TriangleMesh* torus_mesh(float radius, float tubeRadius, int numRings, int numSides, Material* material)
+{
+    TriangleMesh* mesh = new TriangleMesh(material);
+    for (int ring = 0; ring <= numRings; ring++)
+    {
+        const float u = ring / (float)numRings;
+        const float phi = 2 * CUDART_PI_F * u;
+        const Vector3f axis(cos(phi), 0, sin(phi));
+        for (int side = 0; side <= numSides; side++)
+        {
+            const float v = side / (float)numSides;
+            const float theta = 2 * CUDART_PI_F * v;
+            const Vector3f normal = cos(theta) * axis + Vector3f(0, sin(theta), 0);
+            mesh->addVertex(radius * axis + tubeRadius * normal, normal, Vector2f(u, v));
+        }
+    }
+    for (int ring = 0; ring < numRings; ring++)
+    {
+        for (int side = 0; side < numSides; side++)
+        {
+            const unsigned int i0 = ring * (numSides + 1) + side;
+            const unsigned int i1 = i0 + numSides + 1;
+            mesh->addTriangle({ i0, i0 + 1, i1 });
+            mesh->addTriangle({ i1, i0 + 1, i1 + 1 });
+        }
+    }
+    mesh->complete(g_bvhBuildMethod);
+    return mesh;
+}
+
+void meshes(float aspect, Hitable **world, Hitable** lightShapes, Camera** camera, AmbientLight** ambientLight)
+{
+    const Vector3f lookFrom(0, 4, 9);
+    const Vector3f lookAt(0, 0.5f, 0);
+    *camera = new Camera(lookFrom, lookAt, Vector3f(0, 1, 0), 40, aspect, 0.0f, 10.0f, 0.0, 1.0);
+
+    int i = 0;
+    Hitable** list = new Hitable*[4];
+    list[i++] = new Sphere(Vector3f(0, -1000, 0), 1000, new Lambertian(new ConstantTexture(Vector3f(0.5, 0.5, 0.5))));
+    list[i++] = new Instance(torus_mesh(1.0f, 0.4f, 96, 48, new Dielectric(1.5)), Transform::Translate(Vector3f(-2.4f, 0.4f, 0)));
+    list[i++] = new Instance(torus_mesh(1.0f, 0.4f, 96, 48, new Metal(Vector3f(0.8, 0.6, 0.2), 0.05)),
+                             Transform::Translate(Vector3f(0, 1.4f, 0)) * Transform::RotateX(90));
+#ifdef __CUDA_ARCH__
+#else
+    int nx, ny, nz;
+    unsigned char* tex_data = stbi_load("earthmap.jpg", &nx, &ny, &nz, 0);
+    Material* emat = (tex_data != nullptr) ? new Lambertian(new ImageTexture(tex_data, nx, ny))
+                                           : new Lambertian(new ConstantTexture(Vector3f(0.1, 0.2, 0.5)));
+    list[i++] = new Instance(torus_mesh(1.0f, 0.4f, 96, 48, emat), Transform::Translate(Vector3f(2.4f, 0.4f, 0)));
+#endif
+
+    *world = new HitableList(i, list);
+    *lightShapes = nullptr;
+    *ambientLight = new SkyAmbient();
+}
+
+// A mesh file on a ground plane, framed by the camera.
+void file_mesh(float aspect, Hitable **world, Hitable** lightShapes, Camera** camera, AmbientLight** ambientLight)
+{
+    Material* material = new Lambertian(new ConstantTexture(Vector3f(0.73, 0.73, 0.73)));
+
+    const auto start = std::chrono::steady_clock::now();
+    MeshLoadStats stats;
+    Hitable* mesh = LoadMesh(g_meshFile, material, g_bvhBuildMethod, &stats);
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    AABB<float> bbox(Vector3f(-1, -1, -1), Vector3f(1, 1, 1));
+    int i = 0;
+    Hitable** list = new Hitable*[2];
+    if (mesh != nullptr && mesh->bounds(0, 1, bbox))
+    {
+        std::cout << "Loaded " << g_meshFile << ": " << stats.numTriangles << " triangles, " << stats.numVertices
+                  << " vertices in " << seconds << " s (" << stats.buffersViewed << " buffers used in place, "
+                  << stats.buffersCopied << " converted)." << std::endl;
+        list[i++] = mesh;
+    }
+    else
+    {
+        std::cerr << "Failed to load mesh " << g_meshFile << std::endl;
+    }
+
+    const Vector3f center = bbox.centroid();
+    const float radius = 0.5f * (bbox.max() - bbox.min()).length();
+    const float groundRadius = 1000 * radius;
+    list[i++] = new Sphere(Vector3f(center.x(), bbox.min().y() - groundRadius, center.z()), groundRadius,
+                           new Lambertian(new ConstantTexture(Vector3f(0.5, 0.5, 0.5))));
+
+    const Vector3f lookFrom = center + radius * Vector3f(0.8f, 0.9f, 2.4f);
+    *camera = new Camera(lookFrom, center, Vector3f(0, 1, 0), 40, aspect, 0.0f, 10.0f, 0.0, 1.0);
+
+    *world = new HitableList(i, list);
+    *lightShapes = nullptr;
+    *ambientLight = new SkyAmbient();
+}
+
+#ifndef PT_CPU_ONLY
 __global__ void allocate_world_kernel(Hitable** world, Hitable** lightShapes, void* pData, size_t dataSize)
 {
     Stream stream(pData, dataSize);
+    stream.setReadInPlace(true);
+    g_materials = new MaterialTable();
+    stream.setMaterialTable(g_materials);
     *world = Hitable::Create(&stream);
     *lightShapes = Hitable::Create(&stream);
     g_cam = Camera::Create(&stream);
     g_ambientLight = AmbientLight::Create(&stream);
+    g_materials->sortByType();
 }
+#endif // PT_CPU_ONLY
 
 void writeImage(const std::string& outFile, const Vector3f* outImage, int nx, int ny)
 {
@@ -486,12 +665,133 @@ void writeImage(const std::string& outFile, const Vector3f* outImage, int nx, in
     }
 }
 
-void renderLine(int line, Vector3f* outLine, int nx, int ny, int ns, Hitable* world, Hitable* lightShapes, RNG& rng, int maxDepth)
+// Rows of outImage run top to bottom, render_pixel's y bottom to top.
+void renderTile(const ImageTile& tile, Vector3f* outImage, int nx, int ny, int ns, Hitable* world, Hitable* lightShapes, int maxDepth)
+{
+    for (int j = tile.y0; j < tile.y1; j++)
+    {
+        const int line = ny - j - 1;
+        for (int x = tile.x0; x < tile.x1; x++)
+        {
+            outImage[nx * j + x] = render_pixel(&world, &lightShapes, x, line, nx, ny, ns, maxDepth);
+        }
+    }
+}
+
+// Running sums of one pixel of a progressive render.
+struct PixelAccum
+{
+    Vector3f sum;
+    // Luminance of the samples and its square, for the variance of the estimate.
+    double lumSum;
+    double lumSqSum;
+    int samples;
+    bool converged;
+};
+
+// Samples of a pixel an adaptive render takes before testing it for convergence.
+const int ADAPTIVE_MIN_SAMPLES = 16;
+
+// Relative errors are taken against at least this luminance, so that nearly black
+// pixels converge.
+const double ADAPTIVE_MIN_LUMINANCE = 1e-3;
+
+// Standard error of the mean luminance of the pixel relative to the mean.
+double relativeError(const PixelAccum& pixel)
+{
+    const double n = pixel.samples;
+    const double mean = pixel.lumSum / n;
+    const double variance = std::max(0.0, (pixel.lumSqSum - n * mean * mean) / (n - 1));
+    return std::sqrt(variance / n) / std::max(mean, ADAPTIVE_MIN_LUMINANCE);
+}
+
+// Adds samples [firstSample, firstSample + numSamples) to every pixel of the tile that
+// has not converged; pixels is laid out like outImage.
+void accumulateTile(const ImageTile& tile, PixelAccum* pixels, int nx, int ny, int firstSample, int numSamples,
+                    Hitable* world, Hitable* lightShapes, int maxDepth)
+{
+    for (int j = tile.y0; j < tile.y1; j++)
+    {
+        const int line = ny - j - 1;
+        for (int x = tile.x0; x < tile.x1; x++)
+        {
+            PixelAccum& pixel = pixels[nx * j + x];
+            if (pixel.converged)
+                continue;
+
+            for (int s = firstSample; s < firstSample + numSamples; s++)
+            {
+                const Vector3f col = render_sample(&world, &lightShapes, x, line, nx, ny, s, maxDepth);
+                pixel.sum += col;
+                const double lum = 0.2126 * col[0] + 0.7152 * col[1] + 0.0722 * col[2];
+                pixel.lumSum += lum;
+                pixel.lumSqSum += lum * lum;
+            }
+            pixel.samples += numSamples;
+        }
+    }
+}
+
+// Marks the pixels converged whose relative error, and that of their eight neighbours, is
+// below threshold once they have minSamples samples.  The variance of a pixel that has
+// not yet drawn its rare bright paths (caustics) is underestimated; requiring the
+// neighbourhood to agree keeps such pixels from stopping early and coming out too dark.
+// Returns the number of converged pixels.
+int updateConvergence(PixelAccum* pixels, int nx, int ny, float threshold, int minSamples)
+{
+    std::vector<float> errors(nx * ny);
+    for (int i = 0; i < nx * ny; i++)
+    {
+        errors[i] = (pixels[i].samples < minSamples) ? std::numeric_limits<float>::infinity()
+                                                     : float(relativeError(pixels[i]));
+    }
+
+    int numConverged = 0;
+    for (int y = 0; y < ny; y++)
+    {
+        for (int x = 0; x < nx; x++)
+        {
+            PixelAccum& pixel = pixels[nx * y + x];
+            if (!pixel.converged)
+            {
+                float error = 0;
+                for (int j = std::max(y - 1, 0); j <= std::min(y + 1, ny - 1); j++)
+                {
+                    for (int i = std::max(x - 1, 0); i <= std::min(x + 1, nx - 1); i++)
+                        error = std::max(error, errors[nx * j + i]);
+                }
+                pixel.converged = error < threshold;
+            }
+            numConverged += pixel.converged ? 1 : 0;
+        }
+    }
+    return numConverged;
+}
+
+// Tiles with a pixel that still takes samples.
+std::vector<ImageTile> activeTiles(const std::vector<ImageTile>& tiles, const PixelAccum* pixels, int nx)
 {
-    for (int x = 0; x < nx; x++)
+    std::vector<ImageTile> active;
+    for (const ImageTile& tile : tiles)
     {
-        outLine[x] = render_pixel(&world, &lightShapes, x, line, nx, ny, ns, rng, maxDepth);
+        bool converged = true;
+        for (int j = tile.y0; (j < tile.y1) && converged; j++)
+        {
+            for (int x = tile.x0; (x < tile.x1) && converged; x++)
+                converged = pixels[nx * j + x].converged;
+        }
+        if (!converged)
+            active.push_back(tile);
     }
+    return active;
+}
+
+// Set on SIGINT during a progressive render, which then stops after the current pass.
+static volatile std::sig_atomic_t g_stopRender = 0;
+
+static void stopRender(int)
+{
+    g_stopRender = 1;
 }
 
 void medianFilter3x3(Vector3f*, const Vector3f *, int, int);
@@ -507,10 +807,32 @@ int main(int argc, char** argv)
         ("w,width", "Output width.", cxxopts::value<int>())
         ("h,height", "Output height.", cxxopts::value<int>())
         ("n,numsamples", "Number of sample rays per pixel.", cxxopts::value<int>())
-        ("t,threads", "Number of render threads.", cxxopts::value<int>())
+        ("t,threads", "Number of CPU render threads (default: one per hardware thread).", cxxopts::value<int>())
+        ("tilesize", "Edge length in pixels of the tiles the CPU renderer schedules.", cxxopts::value<int>())
+        ("progressive", "Render on the CPU in passes over the whole image, so that an interrupted (Ctrl-C) render "
+            "still writes the samples taken so far.")
+        ("time", "Render progressively for at most this many seconds, or until the -n samples are taken if it is "
+            "also given.", cxxopts::value<float>())
+        ("passsamples", "Samples per pixel added by each progressive pass (default 1).", cxxopts::value<int>())
+        ("adaptive", "Render progressively and stop sampling pixels whose relative error falls below this threshold "
+            "(e.g. 0.05); -n is then the average samples per pixel, which the pixels still sampled may exceed.  "
+            "Also writes the samples per pixel, relative to -n, to <file>_samples.<ext>.", cxxopts::value<float>())
+        ("minsamples", "Samples every pixel takes before an adaptive render tests it for convergence (default 16).", cxxopts::value<int>())
         ("d,maxdepth", "Maximum ray bounces.", cxxopts::value<int>())
         ("s,stacksize", "Size of GPU thread stack (bytes)", cxxopts::value<int>())
-        ("f,file", "Output filename.", cxxopts::value<std::string>());
+        ("b,bvh", "BVH build method (sah, median, lbvh or treelet).", cxxopts::value<std::string>())
+        ("a,accel", "Acceleration structure for large lists (bvh, bvh4 or bvh8).", cxxopts::value<std::string>())
+        ("l,listsize", "Lists larger than this are replaced by a BVH (0 disables).", cxxopts::value<int>())
+        ("nomotionbvh", "Bound moving objects over the whole shutter interval instead of using a motion BVH.")
+        ("nospheresets", "Keep spheres as separate BVH primitives instead of packing them into sphere sets.")
+        ("f,file", "Output filename.", cxxopts::value<std::string>())
+        ("scene", "Scene to render (random, final, instances, meshes, cornell, spheres, light).", cxxopts::value<std::string>())
+        ("mesh", "Render this mesh file (obj, ply, glb or gltf) instead of a built-in scene.", cxxopts::value<std::string>())
+        ("savescene", "Write the prepared scene to this file.", cxxopts::value<std::string>())
+        ("loadscene", "Render a scene file written with --savescene, used in place, instead of building the scene.",
+            cxxopts::value<std::string>())
+        ("scenecache", "Directory of prepared scenes keyed by a hash of their inputs; a cached scene is used instead of "
+            "building it again.", cxxopts::value<std::string>());
 
     options.parse(argc, argv);
 
@@ -518,11 +840,21 @@ int main(int argc, char** argv)
     int ns = 100;
     int nx = 128 * 4;
     int ny = 128 * 4;
-    bool cpu = options.count("cpu") > 0;
+    // Progressive rendering is implemented by the CPU renderer only.
+    const bool progressive = options.count("progressive") || options.count("time") || options.count("passsamples") ||
+                             options.count("adaptive");
+#ifndef PT_CPU_ONLY
+    bool cpu = options.count("cpu") > 0 || progressive;
+    int threadStackSize = -1; // default
+#endif
     bool filter = options.count("median") > 0;
-    int numThreads = 1;
+    int numThreads = 0;
+    int tileSize = 16;
+    float timeBudget = 0; // seconds, 0 -> no limit
+    int passSamples = 1;
+    float adaptiveThreshold = 0; // 0 -> every pixel takes all samples
+    int minSamples = ADAPTIVE_MIN_SAMPLES;
     int maxDepth = 25;
-    int threadStackSize = -1; // default
 
     std::string outFile("outputImage.ppm");
 
@@ -537,9 +869,96 @@ int main(int argc, char** argv)
     if (options.count("file"))
         outFile = options["file"].as<std::string>();
     if (options.count("threads"))
-        numThreads = options["numthreads"].as<int>();
+        numThreads = options["threads"].as<int>();
+    if (options.count("tilesize"))
+        tileSize = options["tilesize"].as<int>();
+    if (options.count("time"))
+        timeBudget = options["time"].as<float>();
+    if (options.count("passsamples"))
+        passSamples = std::max(1, options["passsamples"].as<int>());
+    if (options.count("adaptive"))
+        adaptiveThreshold = options["adaptive"].as<float>();
+    if (options.count("minsamples"))
+        minSamples = std::max(2, options["minsamples"].as<int>());
+#ifndef PT_CPU_ONLY
     if (options.count("stacksize"))
         threadStackSize = options["stacksize"].as<int>();
+#endif
+    if (options.count("bvh"))
+    {
+        const std::string method = options["bvh"].as<std::string>();
+        if (method == "median")
+            g_bvhBuildMethod = BVHBuildMedian;
+        else if (method == "sah")
+            g_bvhBuildMethod = BVHBuildSAH;
+        else if (method == "lbvh")
+            g_bvhBuildMethod = BVHBuildLBVH;
+        else if (method == "treelet")
+            g_bvhBuildMethod = BVHBuildLBVHTreelet;
+        else
+        {
+            std::cerr << "Unknown BVH build method: " << method << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    typedef void (*SceneFunc)(float, Hitable**, Hitable**, Camera**, AmbientLight**);
+    SceneFunc sceneFunc = random_scene;
+    std::string sceneName("random");
+    if (options.count("scene"))
+    {
+        const std::string scene = options["scene"].as<std::string>();
+        sceneName = scene;
+        if (scene == "random")
+            sceneFunc = random_scene;
+        else if (scene == "final")
+            sceneFunc = final;
+        else if (scene == "instances")
+            sceneFunc = instances;
+        else if (scene == "meshes")
+            sceneFunc = meshes;
+        else if (scene == "cornell")
+            sceneFunc = cornell_box;
+        else if (scene == "spheres")
+            sceneFunc = simple_spheres;
+        else if (scene == "light")
+            sceneFunc = simple_light;
+        else
+        {
+            std::cerr << "Unknown scene: " << scene << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+    if (options.count("mesh"))
+    {
+        g_meshFile = options["mesh"].as<std::string>();
+        sceneFunc = file_mesh;
+        sceneName = "mesh";
+    }
+
+    ScenePrepOptions prepOptions;
+    prepOptions.method = g_bvhBuildMethod;
+    if (options.count("listsize"))
+        prepOptions.listThreshold = options["listsize"].as<int>();
+    if (options.count("nomotionbvh"))
+        prepOptions.motionBVH = false;
+    if (options.count("nospheresets"))
+        prepOptions.sphereSets = false;
+    if (options.count("accel"))
+    {
+        const std::string accel = options["accel"].as<std::string>();
+        if (accel == "bvh")
+            prepOptions.accel = SceneAccelBVH;
+        else if (accel == "bvh4")
+            prepOptions.accel = SceneAccelBVH4;
+        else if (accel == "bvh8")
+            prepOptions.accel = SceneAccelBVH8;
+        else
+        {
+            std::cerr << "Unknown acceleration structure: " << accel << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
 
     if (quick)
     {
@@ -548,34 +967,127 @@ int main(int argc, char** argv)
         ns /= 16;
     }
 
+    // A time budget alone bounds the render, not the default sample count.
+    if (timeBudget > 0 && !options.count("numsamples"))
+        ns = INT_MAX;
+
     const float aspect = float(nx)/float(ny);
 
     std::vector<Vector3f> outImage(nx*ny);
 
-    Hitable* world = nullptr;
-    Hitable* lightShapes = nullptr;
-    Camera* camera = nullptr;
-    AmbientLight* ambientLight = nullptr;
-    random_scene(aspect, &world, &lightShapes, &camera, &ambientLight);// cornellBox(); // simpleLight(); //randomScene(); //
-    Stream* pStream = new Stream();
-    pStream->create(1024 * 1024 * 16);
+    // The scene, its prepared acceleration structures and the copy rendered on the CPU
+    // all live in one arena.
+    SceneArena sceneArena;
+    SceneArena::Scope arenaScope(&sceneArena);
+
+    // The renderers read the scene from the stream.  Its bulk arrays are used in place,
+    // so a mapped scene file is rendered without copying them.
+    // The scene cache key covers everything the prepared scene depends on.  The camera is
+    // part of the scene, hence the aspect ratio.
+    std::string cacheFile;
+    if (options.count("scenecache") && !options.count("loadscene"))
+    {
+        SceneCacheKey key;
+        // The builders and serializers are identified by the scene file format and the
+        // running executable.
+        key.addValue(SCENE_FILE_VERSION);
+        key.addFile("/proc/self/exe");
+        key.add(sceneName);
+        if (sceneName == "mesh")
+        {
+            for (const std::string& file : MeshInputFiles(g_meshFile))
+                key.addFile(file);
+        }
+        else
+            key.addFile("earthmap.jpg");
+        key.addValue(aspect);
+        key.addValue(prepOptions.listThreshold);
+        key.addValue(prepOptions.accel);
+        key.addValue(prepOptions.method);
+        key.addValue(prepOptions.time0);
+        key.addValue(prepOptions.time1);
+        key.addValue(prepOptions.motionBVH);
+        key.addValue(prepOptions.sphereSets);
+        cacheFile = SceneCachePath(options["scenecache"].as<std::string>(), key.value());
+    }
 
-    bool ok = world->serialize(pStream);
-    if (lightShapes != nullptr)
-        ok |= lightShapes->serialize(pStream);
-    else
-        ok |= pStream->writeNull();
-    ok |= camera->serialize(pStream);
-    if (ambientLight != nullptr)
-        ok |= ambientLight->serialize(pStream);
+    Stream* pStream = new Stream();
+    if (options.count("loadscene"))
+    {
+        const std::string sceneFile = options["loadscene"].as<std::string>();
+        if (!pStream->open(sceneFile.c_str()))
+        {
+            std::cerr << "Failed to load scene file " << sceneFile << "." << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+    else if (!cacheFile.empty() && pStream->open(cacheFile.c_str()))
+    {
+        std::cout << "Using cached scene " << cacheFile << "." << std::endl;
+    }
     else
-        ok |= pStream->writeNull();
-
-    if (!ok)
     {
-        std::cerr << "Failed to serialize world to GPU memory." << std::endl;
-        return EXIT_FAILURE;
+        Hitable* world = nullptr;
+        Hitable* lightShapes = nullptr;
+        Camera* camera = nullptr;
+        AmbientLight* ambientLight = nullptr;
+        sceneFunc(aspect, &world, &lightShapes, &camera, &ambientLight);
+
+        ScenePrepStats prepStats;
+        world = PrepareScene(world, prepOptions, &prepStats);
+        if (prepStats.listsPromoted > 0)
+        {
+            std::cout << "Scene prep: " << prepStats.listsPromoted << " list(s) promoted, " << prepStats.primitivesPromoted
+                      << " primitives in acceleration structures, " << prepStats.primitivesLinear << " kept linear";
+            if (prepStats.spheresPacked > 0)
+                std::cout << ", " << prepStats.spheresPacked << " spheres packed into sphere sets";
+            std::cout << "." << std::endl;
+        }
+
+        auto writeScene = [&](Stream* stream)
+        {
+            bool ok = world->serialize(stream);
+            if (lightShapes != nullptr)
+                ok &= lightShapes->serialize(stream);
+            else
+                ok &= stream->writeNull();
+            ok &= camera->serialize(stream);
+            if (ambientLight != nullptr)
+                ok &= ambientLight->serialize(stream);
+            else
+                ok &= stream->writeNull();
+            return ok && stream->good();
+        };
+
+        // Measure first, so that the buffer is allocated once at the exact size.
+        Stream sizeStream;
+        sizeStream.measure();
+        writeScene(&sizeStream);
+
+        const bool ok = pStream->create(sizeStream.bytesWritten()) && writeScene(pStream);
+
+        // The camera and ambient light live outside the scene arena; the stream holds copies now.
+        delete camera;
+        delete ambientLight;
+        if (!ok)
+        {
+            std::cerr << "Failed to serialize world to GPU memory." << std::endl;
+            return EXIT_FAILURE;
+        }
+
+        if (options.count("savescene"))
+        {
+            const std::string sceneFile = options["savescene"].as<std::string>();
+            if (!pStream->save(sceneFile.c_str()))
+                std::cerr << "Failed to save scene file " << sceneFile << "." << std::endl;
+        }
+        if (!cacheFile.empty())
+        {
+            if (!StoreSceneCache(*pStream, options["scenecache"].as<std::string>(), cacheFile))
+                std::cerr << "Failed to write scene cache " << cacheFile << "." << std::endl;
+        }
     }
+#ifndef PT_CPU_ONLY
     if (!cpu)
     {
         size_t stackSize;
@@ -652,30 +1164,174 @@ int main(int argc, char** argv)
         cudaFree(world);
     }
     else
+#endif // PT_CPU_ONLY
     {
-        Hitable* clonedWorld = Hitable::Create(pStream);
-        g_ambientLight = ambientLight;
-        g_cam = camera;
-        unsigned int seed0 = 42;
-        unsigned int seed1 = 13;
-        PcgRng rng(seed0);//, seed1);
-
-        Progress progress(nx*ny, "PathTracers");
+        MaterialTable materials;
+        pStream->setMaterialTable(&materials);
+        pStream->setReadInPlace(true);
+        Hitable* world = Hitable::Create(pStream);
+        Hitable* lightShapes = Hitable::Create(pStream);
+        g_cam = Camera::Create(pStream);
+        g_ambientLight = AmbientLight::Create(pStream);
+        if ((world == nullptr) || !pStream->good())
+        {
+            std::cerr << "Failed to read the scene." << std::endl;
+            return EXIT_FAILURE;
+        }
+        materials.sortByType();
+        g_materials = &materials;
+        TileScheduler scheduler(numThreads);
 
-        #pragma omp parallel for if(numThreads)
-        for (int j = 0; j < ny; j++)
+        const std::vector<ImageTile> tiles = MortonOrderedTiles(nx, ny, tileSize);
+        if (progressive)
         {
-            Vector3f* outLine = outImage.data() + (nx * j);
-            const int line = ny - j - 1;
-            renderLine(line, outLine, nx, ny, ns, clonedWorld, lightShapes, rng, maxDepth);
+            // Every pass adds the same number of samples to all pixels that have not converged.
+            // Sample s of a pixel is the same whichever pass takes it, and the sums are
+            // accumulated in sample order, so without adaptive sampling the image after n
+            // samples matches a render with -n n.
+            PixelAccum zeroPixel = { Vector3f(0, 0, 0), 0.0, 0.0, 0, false };
+            std::vector<PixelAccum> pixels(nx * ny, zeroPixel);
+            std::vector<ImageTile> passTiles = tiles;
+            const long long numPixels = static_cast<long long>(nx) * ny;
+            int numSamples = 0;         // of every pixel still sampled
+            int numPasses = 0;
+            double lastPassSeconds = 0;
+            std::vector<double> busySeconds(scheduler.threadCount(), 0.0);
+
+            // -n is the average over the image: samples saved on converged pixels go to the
+            // pixels still sampled.  Without a sample target only the time budget ends the
+            // render.
+            const bool sampleTarget = (ns != INT_MAX);
+            const long long sampleBudget = sampleTarget ? numPixels * ns : LLONG_MAX;
+            long long totalSamples = 0;
+            long long numActive = numPixels;
+
+            // Progress is the fraction of the sample budget, of the pixels converged or of the
+            // time budget taken, whichever is largest.
+            const int progressSteps = 1000;
+            int progressStep = 0;
+            Progress progress(progressSteps, "PathTracers");
+
+            g_stopRender = 0;
+            auto previousHandler = std::signal(SIGINT, stopRender);
+            const auto start = std::chrono::steady_clock::now();
+            while ((totalSamples < sampleBudget) && (numActive > 0) && !g_stopRender)
+            {
+                // Stop early rather than run a pass that would overrun the budget.
+                const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                if ((timeBudget > 0) && (numPasses > 0) && (elapsed + lastPassSeconds > timeBudget))
+                    break;
+
+                // Passes take about the same number of samples as pixels converge, and the last
+                // one overruns the budget by less than a sample per pixel still sampled.
+                long long passCount = passSamples * (numPixels / numActive);
+                if (sampleTarget)
+                    passCount = std::min(passCount, std::max(1LL, (sampleBudget - totalSamples) / numActive));
+                passCount = std::min<long long>(passCount, INT_MAX - numSamples);
+                const int firstSample = numSamples;
+                const int count = static_cast<int>(passCount);
+                scheduler.run(passTiles, [&](const ImageTile& tile, int thread)
+                {
+                    accumulateTile(tile, pixels.data(), nx, ny, firstSample, count, world, lightShapes, maxDepth);
+                });
+                numSamples += count;
+                totalSamples += numActive * count;
+                numPasses++;
+                lastPassSeconds = scheduler.wallSeconds();
+                for (size_t t = 0; t < busySeconds.size(); t++)
+                    busySeconds[t] += scheduler.threadStats()[t].busySeconds;
+                if (numSamples == INT_MAX)
+                    break;
+
+                double done = double(totalSamples) / sampleBudget;
+                if (adaptiveThreshold > 0)
+                {
+                    const int numConverged = updateConvergence(pixels.data(), nx, ny, adaptiveThreshold, minSamples);
+                    passTiles = activeTiles(passTiles, pixels.data(), nx);
+                    numActive = numPixels - numConverged;
+                    done = std::max(done, double(numConverged) / numPixels);
+                }
+                if (timeBudget > 0)
+                {
+                    const double now = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                    done = std::max(done, now / timeBudget);
+                }
+                const int step = std::min(progressSteps, int(done * progressSteps));
+                if (step > progressStep)
+                {
+                    progress.update(step - progressStep);
+                    progressStep = step;
+                }
+            }
+            std::signal(SIGINT, previousHandler);
+            progress.completed();
+
+            for (int i = 0; i < nx * ny; i++)
+                outImage[i] = resolve_pixel(pixels[i].sum, pixels[i].samples);
+
+            const double wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            const double averageSamples = double(totalSamples) / numPixels;
+            std::cout << "Rendered " << averageSamples << " samples per pixel in " << numPasses << " pass(es) on "
+                      << scheduler.threadCount() << " thread(s) in " << wallSeconds << " s";
+            if (g_stopRender)
+                std::cout << " (interrupted)";
+            std::cout << "." << std::endl;
+            if (adaptiveThreshold > 0)
+            {
+                std::cout << "  adaptive: " << (numPixels - numActive) << " of " << numPixels << " pixels converged, "
+                          << "up to " << numSamples << " samples per pixel";
+                if (sampleTarget)
+                    std::cout << ", " << int(100.0 * totalSamples / sampleBudget + 0.5) << "% of the budget of " << ns;
+                std::cout << std::endl;
+            }
+            for (size_t t = 0; t < busySeconds.size(); t++)
+            {
+                std::cout << "  thread " << t << ": busy " << busySeconds[t] << " s ("
+                          << int(100 * busySeconds[t] / wallSeconds + 0.5) << "%)" << std::endl;
+            }
 
-            #pragma omp critical(progress)
+            if (adaptiveThreshold > 0)
             {
-                progress.update(nx);
+                // Samples per pixel relative to the budget: mid grey is the average budget,
+                // white twice that or more.
+                const double budget = sampleTarget ? ns : std::max(averageSamples, 1.0);
+                std::vector<Vector3f> sampleImage(nx * ny);
+                for (int i = 0; i < nx * ny; i++)
+                {
+                    const float value = float(0.5 * pixels[i].samples / budget);
+                    sampleImage[i] = Vector3f(value, value, value);
+                }
+                const auto extStart = outFile.rfind('.');
+                const std::string sampleFile = (extStart == std::string::npos) ? outFile + "_samples.ppm" :
+                    outFile.substr(0, extStart) + "_samples" + outFile.substr(extStart);
+                writeImage(sampleFile, sampleImage.data(), nx, ny);
             }
         }
+        else
+        {
+            Progress progress(nx*ny, "PathTracers");
+            std::mutex progressLock;
 
-        progress.completed();
+            scheduler.run(tiles, [&](const ImageTile& tile, int thread)
+            {
+                renderTile(tile, outImage.data(), nx, ny, ns, world, lightShapes, maxDepth);
+
+                std::lock_guard<std::mutex> guard(progressLock);
+                progress.update((tile.x1 - tile.x0) * (tile.y1 - tile.y0));
+            });
+
+            progress.completed();
+
+            std::cout << "Rendered " << tiles.size() << " tiles on " << scheduler.threadCount() << " thread(s) in "
+                      << scheduler.wallSeconds() << " s." << std::endl;
+            const std::vector<TileScheduler::ThreadStats>& threadStats = scheduler.threadStats();
+            for (size_t t = 0; t < threadStats.size(); t++)
+            {
+                std::cout << "  thread " << t << ": busy " << threadStats[t].busySeconds << " s ("
+                          << int(100 * threadStats[t].busySeconds / scheduler.wallSeconds() + 0.5) << "%), "
+                          << threadStats[t].tiles << " tiles, " << threadStats[t].tilesStolen << " stolen" << std::endl;
+            }
+        }
     }
 
     pStream->close();
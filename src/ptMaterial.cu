@@ -8,6 +8,7 @@
  */
 
 #include "ptMaterial.h"
+#include "ptMaterialTable.h"
 
 
 Material* Material::Create(Stream* pStream)
@@ -23,6 +24,10 @@ Material* Material::Create(Stream* pStream)
 
     switch (typeId)
     {
+        case NullTypeId:
+            return nullptr;
+        case ReferenceTypeId:
+            return static_cast<Material*>(pStream->readReference());
         case LambertianTypeId:
             material = new Lambertian();
             break;
@@ -42,11 +47,15 @@ Material* Material::Create(Stream* pStream)
             return nullptr;
     }
 
+    pStream->addReference(material);
     ok = material->deserialize(pStream);
     if (!ok)
     {
         delete material;
-        material = nullptr;
+        return nullptr;
     }
+
+    if (pStream->getMaterialTable() != nullptr)
+        pStream->getMaterialTable()->add(material);
     return material;
 }
@@ -0,0 +1,101 @@
+/*
+ * CUDA (GPU) Pathtracer based on Peter Shirley's 'Ray Tracing in One Weekend' e-book
+ * series.
+ *
+ * Copyright (C) 2017 by Rick Weyrauch - rpweyrauch@gmail.com
+ *
+ * This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+ */
+
+#include "ptMaterialTable.h"
+
+COMMON_FUNC void MaterialTable::add(Material* material)
+{
+    if (m_count == m_capacity)
+    {
+        const int capacity = (m_capacity > 0) ? 2 * m_capacity : 16;
+        Material** materials = new Material*[capacity];
+        int* types = new int[capacity];
+        for (int i = 0; i < m_count; i++)
+        {
+            materials[i] = m_materials[i];
+            types[i] = m_types[i];
+        }
+        delete[] m_materials;
+        delete[] m_types;
+        m_materials = materials;
+        m_types = types;
+        m_capacity = capacity;
+    }
+
+    material->setIndex(static_cast<uint32_t>(m_count));
+    m_materials[m_count] = material;
+    m_types[m_count] = material->typeId();
+    m_count++;
+}
+
+COMMON_FUNC void MaterialTable::sortByType()
+{
+    if (m_count < 2)
+        return;
+
+    // Stable counting sort over the distinct types, of which a scene has only a few.  It
+    // also runs on the device, so no standard library.
+    const int maxTypes = 32;
+    int types[maxTypes];
+    int starts[maxTypes];
+    int numTypes = 0;
+    for (int i = 0; i < m_count; i++)
+    {
+        int t = 0;
+        while (t < numTypes && types[t] != m_types[i])
+            t++;
+        if (t == numTypes)
+        {
+            if (numTypes == maxTypes)
+                return;
+            types[numTypes] = m_types[i];
+            starts[numTypes] = 0;
+            numTypes++;
+        }
+        starts[t]++;
+    }
+
+    // Ascending type order.
+    for (int i = 1; i < numTypes; i++)
+    {
+        for (int j = i; j > 0 && types[j-1] > types[j]; j--)
+        {
+            const int type = types[j];
+            types[j] = types[j-1];
+            types[j-1] = type;
+            const int count = starts[j];
+            starts[j] = starts[j-1];
+            starts[j-1] = count;
+        }
+    }
+    int offset = 0;
+    for (int t = 0; t < numTypes; t++)
+    {
+        const int count = starts[t];
+        starts[t] = offset;
+        offset += count;
+    }
+
+    Material** materials = new Material*[m_capacity];
+    int* sortedTypes = new int[m_capacity];
+    for (int i = 0; i < m_count; i++)
+    {
+        int t = 0;
+        while (types[t] != m_types[i])
+            t++;
+        const int dest = starts[t]++;
+        materials[dest] = m_materials[i];
+        sortedTypes[dest] = m_types[i];
+        materials[dest]->setIndex(static_cast<uint32_t>(dest));
+    }
+    delete[] m_materials;
+    delete[] m_types;
+    m_materials = materials;
+    m_types = sortedTypes;
+}
@@ -0,0 +1,557 @@
+/*
+ * CUDA (GPU) Pathtracer based on Peter Shirley's 'Ray Tracing in One Weekend' e-book
+ * series.
+ *
+ * Copyright (C) 2017 by Rick Weyrauch - rpweyrauch@gmail.com
+ *
+ * This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+ */
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "ptMeshLoader.h"
+#include "ptTriangle.h"
+
+bool MappedFile::open(const std::string& filename)
+{
+    close();
+
+    const int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0)
+    {
+        ::close(fd);
+        return false;
+    }
+
+    void* data = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED)
+        return false;
+
+    madvise(data, static_cast<size_t>(st.st_size), MADV_SEQUENTIAL);
+    m_data = static_cast<const char*>(data);
+    m_size = static_cast<size_t>(st.st_size);
+    return true;
+}
+
+void MappedFile::close()
+{
+    if (m_data != nullptr)
+        munmap(const_cast<char*>(m_data), m_size);
+    m_data = nullptr;
+    m_size = 0;
+}
+
+namespace
+{
+
+// Chunks are at least this large so tiny files are parsed by one thread.
+const size_t OBJ_MIN_CHUNK_SIZE = 1 << 20;
+
+// Corner attribute flags: the index is relative to the end of the chunk's own list
+// (negative OBJ index) and still needs the chunk's global offset.
+const uint8_t OBJ_RELATIVE_V = 1;
+const uint8_t OBJ_RELATIVE_VT = 2;
+const uint8_t OBJ_RELATIVE_VN = 4;
+
+struct ObjCorner
+{
+    int v, vt, vn;      // 0-based, -1 -> absent
+};
+
+struct ObjChunk
+{
+    std::vector<Vector3f> positions;
+    std::vector<Vector2f> texCoords;
+    std::vector<Vector3f> normals;
+    std::vector<ObjCorner> corners;
+    std::vector<uint8_t> relative;
+    std::vector<int> faceSizes;
+    int numTriangles = 0;
+};
+
+inline bool isBlank(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+inline const char* skipBlanks(const char* p, const char* end)
+{
+    while (p < end && isBlank(*p))
+        p++;
+    return p;
+}
+
+inline bool isDigit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+const double g_exactPowers[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+// Decimal float: [sign] digits [. digits] [(e|E) [sign] digits].  The significand is
+// accumulated exactly up to 19 digits, then scaled by an exact power of ten where
+// possible.  Returns nullptr if there are no digits.
+const char* parseFloat(const char* p, const char* end, float& value)
+{
+    p = skipBlanks(p, end);
+
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+'))
+        negative = (*p++ == '-');
+
+    uint64_t significand = 0;
+    int numDigits = 0;
+    int exponent = 0;
+    bool anyDigits = false;
+    for (; p < end && isDigit(*p); p++)
+    {
+        anyDigits = true;
+        if (numDigits < 19)
+        {
+            significand = significand * 10 + (*p - '0');
+            if (significand != 0) numDigits++;
+        }
+        else
+        {
+            exponent++;
+        }
+    }
+    if (p < end && *p == '.')
+    {
+        for (p++; p < end && isDigit(*p); p++)
+        {
+            anyDigits = true;
+            if (numDigits < 19)
+            {
+                significand = significand * 10 + (*p - '0');
+                if (significand != 0) numDigits++;
+                exponent--;
+            }
+        }
+    }
+    if (!anyDigits)
+        return nullptr;
+
+    if (p < end && (*p == 'e' || *p == 'E'))
+    {
+        const char* q = p + 1;
+        bool negativeExp = false;
+        if (q < end && (*q == '-' || *q == '+'))
+            negativeExp = (*q++ == '-');
+        if (q < end && isDigit(*q))
+        {
+            int e = 0;
+            for (; q < end && isDigit(*q); q++)
+                e = std::min(e * 10 + (*q - '0'), 10000);
+            exponent += negativeExp ? -e : e;
+            p = q;
+        }
+    }
+
+    double v = static_cast<double>(significand);
+    if (v != 0)
+    {
+        if (exponent >= 0)
+            v = (exponent <= 22) ? v * g_exactPowers[exponent] : v * std::pow(10.0, exponent);
+        else
+            v = (exponent >= -22) ? v / g_exactPowers[-exponent] : v * std::pow(10.0, exponent);
+    }
+    value = static_cast<float>(negative ? -v : v);
+    return p;
+}
+
+const char* parseInt(const char* p, const char* end, int& value)
+{
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+'))
+        negative = (*p++ == '-');
+    if (p == end || !isDigit(*p))
+        return nullptr;
+
+    int64_t v = 0;
+    for (; p < end && isDigit(*p); p++)
+        v = std::min<int64_t>(v * 10 + (*p - '0'), INT32_MAX);
+    value = static_cast<int>(negative ? -v : v);
+    return p;
+}
+
+// OBJ index (1-based, negative -> from the end) to 0-based.  Relative indices are made
+// relative to the start of the chunk and flagged; -1 -> invalid or absent.
+inline int resolveIndex(int index, int chunkCount, uint8_t flag, uint8_t& relative)
+{
+    if (index > 0)
+        return index - 1;
+    if (index < 0)
+    {
+        relative |= flag;
+        return chunkCount + index;
+    }
+    return -1;
+}
+
+void parseFace(const char* p, const char* end, ObjChunk& chunk)
+{
+    const size_t firstCorner = chunk.corners.size();
+    const int numPositions = static_cast<int>(chunk.positions.size());
+    const int numTexCoords = static_cast<int>(chunk.texCoords.size());
+    const int numNormals = static_cast<int>(chunk.normals.size());
+
+    while (true)
+    {
+        p = skipBlanks(p, end);
+        if (p == end)
+            break;
+
+        int v = 0, vt = 0, vn = 0;
+        p = parseInt(p, end, v);
+        if (p == nullptr)
+            break;
+        if (p < end && *p == '/')
+        {
+            p++;
+            if (p < end && *p != '/' && !isBlank(*p))
+            {
+                p = parseInt(p, end, vt);
+                if (p == nullptr)
+                    break;
+            }
+            if (p < end && *p == '/')
+            {
+                p = parseInt(p + 1, end, vn);
+                if (p == nullptr)
+                    break;
+            }
+        }
+
+        uint8_t relative = 0;
+        ObjCorner corner;
+        corner.v = resolveIndex(v, numPositions, OBJ_RELATIVE_V, relative);
+        corner.vt = resolveIndex(vt, numTexCoords, OBJ_RELATIVE_VT, relative);
+        corner.vn = resolveIndex(vn, numNormals, OBJ_RELATIVE_VN, relative);
+        chunk.corners.push_back(corner);
+        chunk.relative.push_back(relative);
+    }
+
+    const int numCorners = static_cast<int>(chunk.corners.size() - firstCorner);
+    if (numCorners < 3)
+    {
+        chunk.corners.resize(firstCorner);
+        chunk.relative.resize(firstCorner);
+        return;
+    }
+    chunk.faceSizes.push_back(numCorners);
+    chunk.numTriangles += numCorners - 2;
+}
+
+void parseChunk(const char* p, const char* end, ObjChunk& chunk)
+{
+    while (p < end)
+    {
+        const char* lineEnd = static_cast<const char*>(memchr(p, '\n', end - p));
+        if (lineEnd == nullptr)
+            lineEnd = end;
+
+        const char* q = skipBlanks(p, lineEnd);
+        if (lineEnd - q >= 2)
+        {
+            if (q[0] == 'v' && isBlank(q[1]))
+            {
+                Vector3f position(0, 0, 0);
+                const char* r = q + 1;
+                for (int k = 0; k < 3 && r != nullptr; k++)
+                    r = parseFloat(r, lineEnd, position[k]);
+                chunk.positions.push_back(position);
+            }
+            else if (q[0] == 'v' && q[1] == 't')
+            {
+                Vector2f uv(0, 0);
+                const char* r = parseFloat(q + 2, lineEnd, uv[0]);
+                if (r != nullptr)
+                    parseFloat(r, lineEnd, uv[1]);
+                chunk.texCoords.push_back(uv);
+            }
+            else if (q[0] == 'v' && q[1] == 'n')
+            {
+                Vector3f normal(0, 0, 0);
+                const char* r = q + 2;
+                for (int k = 0; k < 3 && r != nullptr; k++)
+                    r = parseFloat(r, lineEnd, normal[k]);
+                chunk.normals.push_back(normal);
+            }
+            else if (q[0] == 'f' && isBlank(q[1]))
+            {
+                parseFace(q + 1, lineEnd, chunk);
+            }
+        }
+
+        p = lineEnd + 1;
+    }
+}
+
+template <typename T>
+void exclusiveScan(const std::vector<T>& counts, std::vector<T>& offsets)
+{
+    offsets.resize(counts.size() + 1);
+    offsets[0] = 0;
+    for (size_t i = 0; i < counts.size(); i++)
+        offsets[i + 1] = offsets[i] + counts[i];
+}
+
+} // namespace
+
+TriangleMesh* LoadOBJ(const std::string& filename, Material* material, BVHBuildMethod method, MeshLoadStats* stats)
+{
+    MappedFile file;
+    if (!file.open(filename))
+        return nullptr;
+
+    const char* data = file.data();
+    const size_t size = file.size();
+
+    // Chunk boundaries at line starts.
+    int numThreads = 1;
+#ifdef _OPENMP
+    numThreads = omp_get_max_threads();
+#endif
+    const size_t chunkSize = std::max(OBJ_MIN_CHUNK_SIZE, size / (8 * numThreads) + 1);
+    std::vector<size_t> bounds(1, 0);
+    while (bounds.back() < size)
+    {
+        size_t next = std::min(size, bounds.back() + chunkSize);
+        if (next < size)
+        {
+            const char* eol = static_cast<const char*>(memchr(data + next, '\n', size - next));
+            next = (eol != nullptr) ? (eol - data) + 1 : size;
+        }
+        bounds.push_back(next);
+    }
+    const int numChunks = static_cast<int>(bounds.size()) - 1;
+
+    std::vector<ObjChunk> chunks(numChunks);
+#pragma omp parallel for schedule(dynamic, 1)
+    for (int c = 0; c < numChunks; c++)
+        parseChunk(data + bounds[c], data + bounds[c + 1], chunks[c]);
+
+    // Global offsets of every chunk's elements.
+    std::vector<int> posCounts(numChunks), tcCounts(numChunks), nCounts(numChunks), faceCounts(numChunks), triCounts(numChunks);
+    std::vector<size_t> cornerCounts(numChunks);
+    for (int c = 0; c < numChunks; c++)
+    {
+        posCounts[c] = static_cast<int>(chunks[c].positions.size());
+        tcCounts[c] = static_cast<int>(chunks[c].texCoords.size());
+        nCounts[c] = static_cast<int>(chunks[c].normals.size());
+        faceCounts[c] = static_cast<int>(chunks[c].faceSizes.size());
+        triCounts[c] = chunks[c].numTriangles;
+        cornerCounts[c] = chunks[c].corners.size();
+    }
+    std::vector<int> posOffsets, tcOffsets, nOffsets, faceOffsets, triOffsets;
+    std::vector<size_t> cornerOffsets;
+    exclusiveScan(posCounts, posOffsets);
+    exclusiveScan(tcCounts, tcOffsets);
+    exclusiveScan(nCounts, nOffsets);
+    exclusiveScan(faceCounts, faceOffsets);
+    exclusiveScan(triCounts, triOffsets);
+    exclusiveScan(cornerCounts, cornerOffsets);
+
+    const int numPositions = posOffsets[numChunks];
+    const int numTexCoords = tcOffsets[numChunks];
+    const int numNormals = nOffsets[numChunks];
+    const int numTriangles = triOffsets[numChunks];
+    const size_t numCorners = cornerOffsets[numChunks];
+    if (numTriangles == 0)
+        return nullptr;
+
+    // Merge the attribute lists and make every corner index global.
+    std::vector<Vector3f> positions(numPositions), normals(numNormals);
+    std::vector<Vector2f> texCoords(numTexCoords);
+    std::vector<ObjCorner> corners(numCorners);
+#pragma omp parallel for schedule(dynamic, 1)
+    for (int c = 0; c < numChunks; c++)
+    {
+        ObjChunk& chunk = chunks[c];
+        std::copy(chunk.positions.begin(), chunk.positions.end(), positions.begin() + posOffsets[c]);
+        std::copy(chunk.texCoords.begin(), chunk.texCoords.end(), texCoords.begin() + tcOffsets[c]);
+        std::copy(chunk.normals.begin(), chunk.normals.end(), normals.begin() + nOffsets[c]);
+
+        for (size_t i = 0; i < chunk.corners.size(); i++)
+        {
+            ObjCorner corner = chunk.corners[i];
+            const uint8_t relative = chunk.relative[i];
+            if (relative & OBJ_RELATIVE_V) corner.v += posOffsets[c];
+            if (relative & OBJ_RELATIVE_VT) corner.vt += tcOffsets[c];
+            if (relative & OBJ_RELATIVE_VN) corner.vn += nOffsets[c];
+            if (corner.v < 0 || corner.v >= numPositions) corner.v = -1;
+            if (corner.vt < 0 || corner.vt >= numTexCoords) corner.vt = -1;
+            if (corner.vn < 0 || corner.vn >= numNormals) corner.vn = -1;
+            corners[cornerOffsets[c] + i] = corner;
+        }
+
+        std::vector<Vector3f>().swap(chunk.positions);
+        std::vector<Vector2f>().swap(chunk.texCoords);
+        std::vector<Vector3f>().swap(chunk.normals);
+        std::vector<ObjCorner>().swap(chunk.corners);
+        std::vector<uint8_t>().swap(chunk.relative);
+    }
+
+    // Deduplicate the corners: bucket them by position, then compare the (few) texcoord
+    // and normal pairs sharing each position.
+    std::vector<int> byPositionOffsets(numPositions + 1, 0);
+    for (size_t i = 0; i < numCorners; i++)
+    {
+        if (corners[i].v >= 0)
+            byPositionOffsets[corners[i].v + 1]++;
+    }
+    for (int v = 0; v < numPositions; v++)
+        byPositionOffsets[v + 1] += byPositionOffsets[v];
+
+    std::vector<int> byPosition(byPositionOffsets[numPositions]);
+    {
+        std::vector<int> fill(byPositionOffsets.begin(), byPositionOffsets.end() - 1);
+        for (size_t i = 0; i < numCorners; i++)
+        {
+            if (corners[i].v >= 0)
+                byPosition[fill[corners[i].v]++] = static_cast<int>(i);
+        }
+    }
+
+    // cornerVertex first holds the rank of the corner among its position's unique
+    // pairs, then the global vertex index.
+    std::vector<uint32_t> cornerVertex(numCorners, UINT32_MAX);
+    std::vector<int> uniqueCounts(numPositions, 0);
+#pragma omp parallel for schedule(dynamic, 4096)
+    for (int v = 0; v < numPositions; v++)
+    {
+        const int first = byPositionOffsets[v];
+        const int last = byPositionOffsets[v + 1];
+        int numUnique = 0;
+        for (int k = first; k < last; k++)
+        {
+            const ObjCorner& corner = corners[byPosition[k]];
+            uint32_t rank = numUnique;
+            for (int u = first; u < k; u++)
+            {
+                const ObjCorner& other = corners[byPosition[u]];
+                if (other.vt == corner.vt && other.vn == corner.vn)
+                {
+                    rank = cornerVertex[byPosition[u]];
+                    break;
+                }
+            }
+            if (rank == static_cast<uint32_t>(numUnique))
+                numUnique++;
+            cornerVertex[byPosition[k]] = rank;
+        }
+        uniqueCounts[v] = numUnique;
+    }
+
+    std::vector<int> vertexOffsets;
+    exclusiveScan(uniqueCounts, vertexOffsets);
+    const int numVertices = vertexOffsets[numPositions];
+
+    std::vector<Vector3f> vertPositions(numVertices), vertNormals(numVertices);
+    std::vector<Vector2f> vertTexCoords(numVertices);
+#pragma omp parallel for schedule(dynamic, 4096)
+    for (int v = 0; v < numPositions; v++)
+    {
+        uint32_t nextRank = 0;
+        for (int k = byPositionOffsets[v]; k < byPositionOffsets[v + 1]; k++)
+        {
+            const int i = byPosition[k];
+            const ObjCorner& corner = corners[i];
+            const uint32_t rank = cornerVertex[i];
+            cornerVertex[i] = vertexOffsets[v] + rank;
+            if (rank != nextRank)
+                continue;
+
+            // First corner with this pair.
+            const int vertex = vertexOffsets[v] + rank;
+            vertPositions[vertex] = positions[v];
+            vertNormals[vertex] = (corner.vn >= 0) ? normals[corner.vn] : Vector3f(0, 0, 0);
+            vertTexCoords[vertex] = (corner.vt >= 0) ? texCoords[corner.vt] : Vector2f(0, 0);
+            nextRank++;
+        }
+    }
+
+    // Fan triangulation; corners without a valid position leave an out of range index,
+    // so TriangleMesh::complete() drops their triangles.
+    std::vector<TriIndex> triangles(numTriangles);
+#pragma omp parallel for schedule(dynamic, 1)
+    for (int c = 0; c < numChunks; c++)
+    {
+        size_t corner = cornerOffsets[c];
+        int tri = triOffsets[c];
+        for (int faceSize : chunks[c].faceSizes)
+        {
+            const uint32_t i0 = cornerVertex[corner];
+            for (int k = 1; k + 1 < faceSize; k++)
+                triangles[tri++] = { i0, cornerVertex[corner + k], cornerVertex[corner + k + 1] };
+            corner += faceSize;
+        }
+    }
+
+    if (stats != nullptr)
+    {
+        stats->files.assign(1, filename);
+        stats->numPositions = numPositions;
+        stats->numTexCoords = numTexCoords;
+        stats->numNormals = numNormals;
+        stats->numFaces = faceOffsets[numChunks];
+        stats->numVertices = numVertices;
+    }
+
+    TriangleMesh* mesh = new TriangleMesh(material);
+    mesh->reserve(numVertices, numTriangles);
+    mesh->addVertices(vertPositions.data(), vertNormals.data(), vertTexCoords.data(), numVertices);
+    mesh->addTriangles(triangles.data(), numTriangles);
+    mesh->complete(method);
+
+    // complete() has dropped the degenerate triangles.
+    if (stats != nullptr)
+        stats->numTriangles = mesh->triangleCount();
+    return mesh;
+}
+
+static std::string lowerCaseExtension(const std::string& filename)
+{
+    const size_t dot = filename.rfind('.');
+    std::string ext = (dot == std::string::npos) ? std::string() : filename.substr(dot + 1);
+    std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return static_cast<char>(tolower(c)); });
+    return ext;
+}
+
+Hitable* LoadMesh(const std::string& filename, Material* material, BVHBuildMethod method, MeshLoadStats* stats)
+{
+    const std::string ext = lowerCaseExtension(filename);
+    if (ext == "ply")
+        return LoadPLY(filename, material, method, stats);
+    if (ext == "glb" || ext == "gltf")
+        return LoadGLTF(filename, material, method, stats);
+    return LoadOBJ(filename, material, method, stats);
+}
+
+std::vector<std::string> MeshInputFiles(const std::string& filename)
+{
+    const std::string ext = lowerCaseExtension(filename);
+    if (ext == "glb" || ext == "gltf")
+        return GltfInputFiles(filename);
+    return std::vector<std::string>(1, filename);
+}
@@ -0,0 +1,433 @@
+/*
+ * CUDA (GPU) Pathtracer based on Peter Shirley's 'Ray Tracing in One Weekend' e-book
+ * series.
+ *
+ * Copyright (C) 2017 by Rick Weyrauch - rpweyrauch@gmail.com
+ *
+ * This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+ */
+
+#include <algorithm>
+#include <cfloat>
+#include "ptRNG.h"
+#include "ptMotionBVH.h"
+
+static const int NUM_SAH_BUCKETS = 12;
+
+static AABB<float> lerp(const AABB<float>& box0, const AABB<float>& box1, float u)
+{
+    return AABB<float>((1 - u) * box0.min() + u * box1.min(), (1 - u) * box0.max() + u * box1.max());
+}
+
+MotionBVH::MotionBVH(Hitable** list, int length, float time0, float time1, int maxTemporalSplits, int maxPrimsInLeaf) :
+    m_maxPrimsInLeaf(std::max(1, maxPrimsInLeaf))
+{
+    if (length <= 0)
+        return;
+
+    m_numPrims = length;
+    m_prims = new Hitable*[length];
+    for (int i = 0; i < length; i++)
+        m_prims[i] = list[i];
+    m_records = CreatePrimitives(m_prims, m_numPrims);
+
+    std::vector<int> indices(length);
+    for (int i = 0; i < length; i++)
+        indices[i] = i;
+
+    std::vector<PrimitiveInfo> info;
+    primitiveInfo(list, indices.data(), length, time0, time1, info);
+
+    std::vector<int> primIndices;
+    primIndices.reserve(length);
+    BuildNode* root = recursiveBuild(list, info, 0, length, time0, time1, 0, maxTemporalSplits, primIndices);
+
+    m_sahCost = computeCost(root) / join(root->bounds0, root->bounds1).surfaceArea();
+
+    m_numPrimIndices = static_cast<int>(primIndices.size());
+    m_primIndices = new int[m_numPrimIndices];
+    std::copy(primIndices.begin(), primIndices.end(), m_primIndices);
+
+    m_nodes = new MotionBVHNode[m_numNodes];
+    uint32_t offset = 0;
+    flattenTree(root, &offset);
+    deleteTree(root);
+}
+
+void MotionBVH::primitiveInfo(Hitable** list, const int* indices, int count, float time0, float time1, std::vector<PrimitiveInfo>& info) const
+{
+    info.resize(count);
+#pragma omp parallel for schedule(static)
+    for (int i = 0; i < count; i++)
+    {
+        PrimitiveInfo& pi = info[i];
+        pi.index = indices[i];
+        list[pi.index]->motionBounds(time0, time1, pi.bounds0, pi.bounds1);
+        pi.midBounds = lerp(pi.bounds0, pi.bounds1, 0.5f);
+        pi.centroid = pi.midBounds.centroid();
+    }
+}
+
+MotionBVH::BuildNode* MotionBVH::createLeaf(std::vector<PrimitiveInfo>& info, int start, int end, const AABB<float>& bounds0,
+                                            const AABB<float>& bounds1, float time0, float time1, std::vector<int>& primIndices)
+{
+    auto node = new BuildNode();
+    node->bounds0 = bounds0;
+    node->bounds1 = bounds1;
+    node->time0 = time0;
+    node->time1 = time1;
+    node->firstPrimOffset = static_cast<int>(primIndices.size());
+    node->numPrims = end - start;
+    m_numNodes++;
+
+    for (int i = start; i < end; i++)
+        primIndices.push_back(info[i].index);
+
+    return node;
+}
+
+MotionBVH::BuildNode* MotionBVH::recursiveBuild(Hitable** list, std::vector<PrimitiveInfo>& info, int start, int end, float time0,
+                                                float time1, int depth, int temporalSplitsLeft, std::vector<int>& primIndices)
+{
+    AABB<float> bounds0 = info[start].bounds0;
+    AABB<float> bounds1 = info[start].bounds1;
+    AABB<float> centroidBounds(info[start].centroid, info[start].centroid);
+    for (int i = start + 1; i < end; i++)
+    {
+        bounds0 = join(bounds0, info[i].bounds0);
+        bounds1 = join(bounds1, info[i].bounds1);
+        centroidBounds = join(centroidBounds, AABB<float>(info[i].centroid, info[i].centroid));
+    }
+
+    const int numPrims = end - start;
+    if (numPrims == 1)
+        return createLeaf(info, start, end, bounds0, bounds1, time0, time1, primIndices);
+
+    const float area = lerp(bounds0, bounds1, 0.5f).surfaceArea();
+    const bool forceMedian = depth >= BVH_MAX_DEPTH / 2;
+
+    // Binned SAH on the centroids at the middle of the interval.  A child's area is that
+    // of its interpolated box at the middle, which grows when its primitives move apart.
+    float bestCost = FLT_MAX;
+    int bestAxis = -1;
+    int bestSplit = -1;
+    for (int dim = 0; dim < 3 && !forceMedian; dim++)
+    {
+        const float cmin = centroidBounds.min()[dim];
+        const float extent = centroidBounds.max()[dim] - cmin;
+        if (extent <= 0)
+            continue;
+
+        int counts[NUM_SAH_BUCKETS] = { 0 };
+        AABB<float> boxes0[NUM_SAH_BUCKETS], boxes1[NUM_SAH_BUCKETS];
+        for (int i = start; i < end; i++)
+        {
+            const int b = Clamp(int(NUM_SAH_BUCKETS * ((info[i].centroid[dim] - cmin) / extent)), 0, NUM_SAH_BUCKETS - 1);
+            boxes0[b] = (counts[b] == 0) ? info[i].bounds0 : join(boxes0[b], info[i].bounds0);
+            boxes1[b] = (counts[b] == 0) ? info[i].bounds1 : join(boxes1[b], info[i].bounds1);
+            counts[b]++;
+        }
+
+        for (int split = 0; split < NUM_SAH_BUCKETS - 1; split++)
+        {
+            AABB<float> below0, below1, above0, above1;
+            int countBelow = 0, countAbove = 0;
+            for (int b = 0; b < NUM_SAH_BUCKETS; b++)
+            {
+                if (counts[b] == 0)
+                    continue;
+                if (b <= split)
+                {
+                    below0 = (countBelow == 0) ? boxes0[b] : join(below0, boxes0[b]);
+                    below1 = (countBelow == 0) ? boxes1[b] : join(below1, boxes1[b]);
+                    countBelow += counts[b];
+                }
+                else
+                {
+                    above0 = (countAbove == 0) ? boxes0[b] : join(above0, boxes0[b]);
+                    above1 = (countAbove == 0) ? boxes1[b] : join(above1, boxes1[b]);
+                    countAbove += counts[b];
+                }
+            }
+            if (countBelow == 0 || countAbove == 0)
+                continue;
+
+            const float cost = countBelow * lerp(below0, below1, 0.5f).surfaceArea() +
+                               countAbove * lerp(above0, above1, 0.5f).surfaceArea();
+            if (cost < bestCost)
+            {
+                bestCost = cost;
+                bestAxis = dim;
+                bestSplit = split;
+            }
+        }
+    }
+    const float spatialCost = (bestAxis >= 0) ? BVH_TRAVERSAL_COST + BVH_INTERSECT_COST * bestCost / area : FLT_MAX;
+
+    // Temporal split: both halves keep every primitive, each is visited by half of the
+    // rays, and each bounds only half of the motion.
+    float temporalCost = FLT_MAX;
+    if (temporalSplitsLeft > 0 && !forceMedian)
+    {
+        AABB<float> boundsMid = info[start].midBounds;
+        for (int i = start + 1; i < end; i++)
+            boundsMid = join(boundsMid, info[i].midBounds);
+
+        const float childArea = lerp(bounds0, boundsMid, 0.5f).surfaceArea() + lerp(boundsMid, bounds1, 0.5f).surfaceArea();
+        temporalCost = BVH_TRAVERSAL_COST + BVH_INTERSECT_COST * numPrims * 0.5f * childArea / area;
+    }
+
+    const float leafCost = BVH_INTERSECT_COST * numPrims;
+    if (numPrims <= m_maxPrimsInLeaf && leafCost <= spatialCost && leafCost <= temporalCost)
+        return createLeaf(info, start, end, bounds0, bounds1, time0, time1, primIndices);
+
+    auto node = new BuildNode();
+    m_numNodes++;
+    node->bounds0 = bounds0;
+    node->bounds1 = bounds1;
+    node->time0 = time0;
+    node->time1 = time1;
+
+    if (temporalCost < spatialCost)
+    {
+        const float timeMid = 0.5f * (time0 + time1);
+        std::vector<int> indices(numPrims);
+        for (int i = 0; i < numPrims; i++)
+            indices[i] = info[start + i].index;
+
+        m_numTemporalSplits++;
+        node->axis = MOTION_BVH_TEMPORAL_SPLIT;
+
+        std::vector<PrimitiveInfo> halfInfo;
+        primitiveInfo(list, indices.data(), numPrims, time0, timeMid, halfInfo);
+        node->children[0] = recursiveBuild(list, halfInfo, 0, numPrims, time0, timeMid, depth + 1, temporalSplitsLeft - 1, primIndices);
+        primitiveInfo(list, indices.data(), numPrims, timeMid, time1, halfInfo);
+        node->children[1] = recursiveBuild(list, halfInfo, 0, numPrims, timeMid, time1, depth + 1, temporalSplitsLeft - 1, primIndices);
+        return node;
+    }
+
+    int mid = (start + end) / 2;
+    int axis = centroidBounds.maximumExtent();
+    if (bestAxis >= 0)
+    {
+        const float cmin = centroidBounds.min()[bestAxis];
+        const float extent = centroidBounds.max()[bestAxis] - cmin;
+        PrimitiveInfo* pmid = std::partition(&info[start], &info[end-1]+1,
+            [=](const PrimitiveInfo& pi) {
+                const int b = Clamp(int(NUM_SAH_BUCKETS * ((pi.centroid[bestAxis] - cmin) / extent)), 0, NUM_SAH_BUCKETS - 1);
+                return b <= bestSplit;
+            });
+        mid = int(pmid - &info[0]);
+        axis = bestAxis;
+    }
+    if (bestAxis < 0 || mid == start || mid == end)
+    {
+        mid = (start + end) / 2;
+        std::nth_element(&info[start], &info[mid], &info[end-1]+1,
+                         [axis](const PrimitiveInfo& a, const PrimitiveInfo& b) {
+                             return a.centroid[axis] < b.centroid[axis];
+                         });
+    }
+
+    node->axis = axis;
+    node->children[0] = recursiveBuild(list, info, start, mid, time0, time1, depth + 1, temporalSplitsLeft, primIndices);
+    node->children[1] = recursiveBuild(list, info, mid, end, time0, time1, depth + 1, temporalSplitsLeft, primIndices);
+    return node;
+}
+
+float MotionBVH::computeCost(const BuildNode* node) const
+{
+    const float area = lerp(node->bounds0, node->bounds1, 0.5f).surfaceArea();
+    if (node->numPrims > 0)
+        return BVH_INTERSECT_COST * node->numPrims * area;
+
+    // Only one half of a temporal split is visited, each for half of the rays.
+    const float childCost = computeCost(node->children[0]) + computeCost(node->children[1]);
+    return BVH_TRAVERSAL_COST * area + ((node->axis == MOTION_BVH_TEMPORAL_SPLIT) ? 0.5f * childCost : childCost);
+}
+
+uint32_t MotionBVH::flattenTree(const BuildNode* node, uint32_t* offset)
+{
+    MotionBVHNode* linearNode = &m_nodes[*offset];
+    linearNode->bounds0 = node->bounds0;
+    linearNode->bounds1 = node->bounds1;
+    linearNode->time0 = node->time0;
+    linearNode->time1 = node->time1;
+    linearNode->pad = 0;
+    const uint32_t myOffset = (*offset)++;
+    if (node->numPrims > 0)
+    {
+        linearNode->primitivesOffset = static_cast<uint32_t>(node->firstPrimOffset);
+        linearNode->numPrims = static_cast<uint16_t>(node->numPrims);
+        linearNode->axis = 0;
+    }
+    else
+    {
+        linearNode->axis = static_cast<uint8_t>(node->axis);
+        linearNode->numPrims = 0;
+        flattenTree(node->children[0], offset);
+        linearNode->secondChildOffset = flattenTree(node->children[1], offset);
+    }
+    return myOffset;
+}
+
+void MotionBVH::deleteTree(BuildNode* node)
+{
+    if (node == nullptr)
+        return;
+    deleteTree(node->children[0]);
+    deleteTree(node->children[1]);
+    delete node;
+}
+
+bool MotionBVH::hit(const Rayf& r, float tmin, float tmax, HitRecord& rec, RNG& rng) const
+{
+    if (m_nodes == nullptr)
+        return false;
+
+    const Vector3f invDir(1 / r.direction().x(), 1 / r.direction().y(), 1 / r.direction().z());
+    const int dirIsNeg[3] = { invDir.x() < 0, invDir.y() < 0, invDir.z() < 0 };
+
+    bool hitAnything = false;
+    int toVisitOffset = 0;
+    uint32_t currentNodeIndex = 0;
+    uint32_t nodesToVisit[BVH_MAX_DEPTH];
+    while (true)
+    {
+        const MotionBVHNode* node = &m_nodes[currentNodeIndex];
+        if (node->boundsAt(r.time()).hit(r, invDir, dirIsNeg, tmin, tmax))
+        {
+            if (node->numPrims > 0)
+            {
+                for (int i = 0; i < node->numPrims; i++)
+                {
+                    if (hitPrimitive(m_records[m_primIndices[node->primitivesOffset + i]], r, tmin, tmax, rec, rng))
+                    {
+                        hitAnything = true;
+                        tmax = rec.t;
+                    }
+                }
+                if (toVisitOffset == 0) break;
+                currentNodeIndex = nodesToVisit[--toVisitOffset];
+            }
+            else if (node->axis == MOTION_BVH_TEMPORAL_SPLIT)
+            {
+                // Only the half containing the ray's time.
+                const uint32_t second = node->secondChildOffset;
+                currentNodeIndex = (r.time() < m_nodes[second].time0) ? currentNodeIndex + 1 : second;
+            }
+            else
+            {
+                // Visit the near child first, defer the far one.
+                if (dirIsNeg[node->axis])
+                {
+                    nodesToVisit[toVisitOffset++] = currentNodeIndex + 1;
+                    currentNodeIndex = node->secondChildOffset;
+                }
+                else
+                {
+                    nodesToVisit[toVisitOffset++] = node->secondChildOffset;
+                    currentNodeIndex = currentNodeIndex + 1;
+                }
+            }
+        }
+        else
+        {
+            if (toVisitOffset == 0) break;
+            currentNodeIndex = nodesToVisit[--toVisitOffset];
+        }
+    }
+    return hitAnything;
+}
+
+bool MotionBVH::bounds(float t0, float t1, AABB<float>& bbox) const
+{
+    if (m_nodes == nullptr)
+        return false;
+
+    bbox = join(m_nodes[0].bounds0, m_nodes[0].bounds1);
+    return true;
+}
+
+bool MotionBVH::motionBounds(float t0, float t1, AABB<float>& bbox0, AABB<float>& bbox1) const
+{
+    if (m_nodes == nullptr)
+        return false;
+
+    // Exact only for the interval the tree was built over.
+    if (t0 != m_nodes[0].time0 || t1 != m_nodes[0].time1)
+        return Hitable::motionBounds(t0, t1, bbox0, bbox1);
+
+    bbox0 = m_nodes[0].bounds0;
+    bbox1 = m_nodes[0].bounds1;
+    return true;
+}
+
+float MotionBVH::pdfValue(const Vector3f& o, const Vector3f& v, RNG& rng) const
+{
+    float weight = 1 / (float)m_numPrims;
+    float sum = 0;
+    for (int i = 0; i < m_numPrims; i++)
+    {
+        sum += weight * m_prims[i]->pdfValue(o, v, rng);
+    }
+    return sum;
+}
+
+Vector3f MotionBVH::random(const Vector3f& o, RNG& rng) const
+{
+    auto index = Clamp(int(rng.rand() * m_numPrims), 0, m_numPrims - 1);
+    return m_prims[index]->random(o, rng);
+}
+
+bool MotionBVH::serialize(Stream *pStream) const
+{
+    if (pStream == nullptr)
+        return false;
+
+    const int id = typeId();
+    bool ok = pStream->write(&id, sizeof(id));
+    ok &= pStream->write(&m_numPrims, sizeof(m_numPrims));
+    for (int i = 0; i < m_numPrims; i++)
+    {
+        ok &= m_prims[i]->serialize(pStream);
+    }
+
+    ok &= pStream->write(&m_numPrimIndices, sizeof(m_numPrimIndices));
+    if (m_numPrimIndices > 0)
+        ok &= pStream->writeArray(m_primIndices, m_numPrimIndices * sizeof(int));
+
+    ok &= pStream->write(&m_numNodes, sizeof(m_numNodes));
+    if (m_numNodes > 0)
+        ok &= pStream->writeArray(m_nodes, m_numNodes * sizeof(MotionBVHNode));
+
+    return ok;
+}
+
+bool MotionBVH::deserialize(Stream *pStream)
+{
+    if (pStream == nullptr)
+        return false;
+
+    bool ok = pStream->read(&m_numPrims, sizeof(m_numPrims));
+    if (ok && (m_numPrims > 0))
+    {
+        m_prims = new Hitable*[m_numPrims];
+        for (int i = 0; i < m_numPrims; i++)
+        {
+            m_prims[i] = Hitable::Create(pStream);
+        }
+        m_records = CreatePrimitives(m_prims, m_numPrims);
+    }
+
+    m_arraysInStream = pStream->readsInPlace();
+    ok &= pStream->read(&m_numPrimIndices, sizeof(m_numPrimIndices));
+    if (ok && (m_numPrimIndices > 0))
+        ok &= pStream->readArray(m_primIndices, m_numPrimIndices);
+
+    ok &= pStream->read(&m_numNodes, sizeof(m_numNodes));
+    if (ok && (m_numNodes > 0))
+        ok &= pStream->readArray(m_nodes, m_numNodes);
+
+    return ok;
+}
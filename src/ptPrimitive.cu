@@ -0,0 +1,104 @@
+/*
+ * CUDA (GPU) Pathtracer based on Peter Shirley's 'Ray Tracing in One Weekend' e-book
+ * series.
+ *
+ * Copyright (C) 2017 by Rick Weyrauch - rpweyrauch@gmail.com
+ *
+ * This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+ */
+
+#include "ptPrimitive.h"
+
+static COMMON_FUNC bool isStoredInline(int type)
+{
+    switch (type)
+    {
+        case SphereTypeId:
+        case MovingSphereTypeId:
+        case XYRectangleTypeId:
+        case XZRectangleTypeId:
+        case YZRectangleTypeId:
+            return true;
+        default:
+            return false;
+    }
+}
+
+COMMON_FUNC Primitive MakePrimitive(const Hitable* hitable)
+{
+    Primitive prim;
+    prim.type = hitable->typeId();
+    prim.hitable = hitable;
+    switch (prim.type)
+    {
+        case SphereTypeId:
+        {
+            const Sphere* sphere = static_cast<const Sphere*>(hitable);
+            for (int a = 0; a < 3; a++)
+                prim.sphere.center[a] = sphere->getCenter()[a];
+            prim.sphere.radius = sphere->getRadius();
+            prim.material = sphere->getMaterial();
+            break;
+        }
+        case MovingSphereTypeId:
+        {
+            const MovingSphere* sphere = static_cast<const MovingSphere*>(hitable);
+            for (int a = 0; a < 3; a++)
+            {
+                prim.movingSphere.center0[a] = sphere->getCenter0()[a];
+                prim.movingSphere.center1[a] = sphere->getCenter1()[a];
+            }
+            prim.movingSphere.time0 = sphere->getTime0();
+            prim.movingSphere.time1 = sphere->getTime1();
+            prim.movingSphere.radius = sphere->getRadius();
+            prim.material = sphere->getMaterial();
+            break;
+        }
+        case XYRectangleTypeId:
+        {
+            const XYRectangle* rect = static_cast<const XYRectangle*>(hitable);
+            rect->getExtent(prim.rectangle.a0, prim.rectangle.a1, prim.rectangle.b0, prim.rectangle.b1, prim.rectangle.k);
+            prim.material = rect->getMaterial();
+            break;
+        }
+        case XZRectangleTypeId:
+        {
+            const XZRectangle* rect = static_cast<const XZRectangle*>(hitable);
+            rect->getExtent(prim.rectangle.a0, prim.rectangle.a1, prim.rectangle.b0, prim.rectangle.b1, prim.rectangle.k);
+            prim.material = rect->getMaterial();
+            break;
+        }
+        case YZRectangleTypeId:
+        {
+            const YZRectangle* rect = static_cast<const YZRectangle*>(hitable);
+            rect->getExtent(prim.rectangle.a0, prim.rectangle.a1, prim.rectangle.b0, prim.rectangle.b1, prim.rectangle.k);
+            prim.material = rect->getMaterial();
+            break;
+        }
+        case FlipNormalsTypeId:
+        {
+            // Unwrap when the flipped hitable is stored inline, otherwise keep the wrapper.
+            const Hitable* flipped = static_cast<const FlipNormals*>(hitable)->getHitable();
+            if (flipped == nullptr)
+                break;
+            Primitive inner = MakePrimitive(flipped);
+            if (isStoredInline(inner.type))
+            {
+                inner.flipNormals = !inner.flipNormals;
+                return inner;
+            }
+            break;
+        }
+        default:
+            break;
+    }
+    return prim;
+}
+
+COMMON_FUNC Primitive* CreatePrimitives(Hitable* const* list, int count)
+{
+    Primitive* prims = new Primitive[count];
+    for (int i = 0; i < count; i++)
+        prims[i] = MakePrimitive(list[i]);
+    return prims;
+}
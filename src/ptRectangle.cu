@@ -11,20 +11,7 @@
 
 bool XYRectangle::hit(const Rayf &r_in, float t0, float t1, HitRecord &rec, RNG &rng) const
 {
-    float t = (k - r_in.origin().z()) / r_in.direction().z();
-    if (t < t0 || t > t1) return false;
-    float x = r_in.origin().x() + t * r_in.direction().x();
-    float y = r_in.origin().y() + t * r_in.direction().y();
-    if (x < x0 || x > x1 || y < y0 || y > y1) return false;
-
-    rec.uv.u() = (x - x0) / (x1 - x0);
-    rec.uv.v() = (y - y0) / (y1 - y0);
-    rec.t = t;
-    rec.material = material;
-    rec.p = r_in.pointAt(t);
-    rec.normal = Vector3f(0, 0, 1);
-
-    return true;
+    return hitRectangle<0, 1, 2>(x0, x1, y0, y1, k, material, r_in, t0, t1, rec);
 }
 
 bool XYRectangle::serialize(Stream *pStream) const
@@ -65,20 +52,7 @@ bool XYRectangle::deserialize(Stream *pStream)
 
 bool XZRectangle::hit(const Rayf &r_in, float t0, float t1, HitRecord &rec, RNG &rng) const
 {
-    float t = (k - r_in.origin().y()) / r_in.direction().y();
-    if (t < t0 || t > t1) return false;
-    float x = r_in.origin().x() + t * r_in.direction().x();
-    float z = r_in.origin().z() + t * r_in.direction().z();
-    if (x < x0 || x > x1 || z < z0 || z > z1) return false;
-
-    rec.uv.u() = (x - x0) / (x1 - x0);
-    rec.uv.v() = (z - z0) / (z1 - z0);
-    rec.t = t;
-    rec.material = material;
-    rec.p = r_in.pointAt(t);
-    rec.normal = Vector3f(0, 1, 0);
-
-    return true;
+    return hitRectangle<0, 2, 1>(x0, x1, z0, z1, k, material, r_in, t0, t1, rec);
 }
 
 bool XZRectangle::serialize(Stream *pStream) const
@@ -119,20 +93,7 @@ bool XZRectangle::deserialize(Stream *pStream)
 
 bool YZRectangle::hit(const Rayf &r_in, float t0, float t1, HitRecord &rec, RNG &rng) const
 {
-    float t = (k - r_in.origin().x()) / r_in.direction().x();
-    if (t < t0 || t > t1) return false;
-    float y = r_in.origin().y() + t * r_in.direction().y();
-    float z = r_in.origin().z() + t * r_in.direction().z();
-    if (y < y0 || y > y1 || z < z0 || z > z1) return false;
-
-    rec.uv.u() = (y - y0) / (y1 - y0);
-    rec.uv.v() = (z - z0) / (z1 - z0);
-    rec.t = t;
-    rec.material = material;
-    rec.p = r_in.pointAt(t);
-    rec.normal = Vector3f(1, 0, 0);
-
-    return true;
+    return hitRectangle<1, 2, 0>(y0, y1, z0, z1, k, material, r_in, t0, t1, rec);
 }
 
 bool YZRectangle::serialize(Stream *pStream) const
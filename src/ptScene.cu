@@ -0,0 +1,193 @@
+/*
+ * CUDA (GPU) Pathtracer based on Peter Shirley's 'Ray Tracing in One Weekend' e-book
+ * series.
+ *
+ * Copyright (C) 2017 by Rick Weyrauch - rpweyrauch@gmail.com
+ *
+ * This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+ */
+
+#include <vector>
+#include "ptScene.h"
+#include "ptHitableList.h"
+#include "ptWideBVH.h"
+#include "ptInstance.h"
+#include "ptMotionBVH.h"
+#include "ptSphereSet.h"
+
+static bool hasMotion(Hitable** list, int length, const ScenePrepOptions& options)
+{
+    for (int i = 0; i < length; i++)
+    {
+        AABB<float> box0, box1;
+        if (!list[i]->motionBounds(options.time0, options.time1, box0, box1))
+            continue;
+        for (int k = 0; k < 3; k++)
+        {
+            if (box0.min()[k] != box1.min()[k] || box0.max()[k] != box1.max()[k])
+                return true;
+        }
+    }
+    return false;
+}
+
+static bool isSphere(const Hitable* hitable)
+{
+    return hitable->typeId() == SphereTypeId || hitable->typeId() == MovingSphereTypeId;
+}
+
+static Hitable* createAccel(Hitable** list, int length, const ScenePrepOptions& options, ScenePrepStats& stats)
+{
+    // Instances go into a two-level structure so their shared geometry is stored once,
+    // and spheres into a SphereSet; these then become children of the list's tree.
+    std::vector<Instance*> instances;
+    std::vector<Hitable*> spheres;
+    for (int i = 0; i < length; i++)
+    {
+        if (list[i]->typeId() == InstanceTypeId)
+            instances.push_back(static_cast<Instance*>(list[i]));
+        else if (isSphere(list[i]))
+            spheres.push_back(list[i]);
+    }
+    const bool groupInstances = instances.size() > 1;
+    const bool packSpheres = options.sphereSets && spheres.size() > 1;
+
+    std::vector<Hitable*> others;
+    for (int i = 0; i < length; i++)
+    {
+        if ((groupInstances && list[i]->typeId() == InstanceTypeId) || (packSpheres && isSphere(list[i])))
+            continue;
+        others.push_back(list[i]);
+    }
+    if (groupInstances)
+        others.push_back(new InstanceBVH(instances.data(), static_cast<int>(instances.size()), options.time0, options.time1, options.method));
+    if (packSpheres)
+    {
+        others.push_back(new SphereSet(spheres.data(), static_cast<int>(spheres.size()), options.time0, options.time1, options.method));
+        stats.spheresPacked += static_cast<int>(spheres.size());
+    }
+    if (others.size() == 1)
+        return others[0];
+
+    const int numOthers = static_cast<int>(others.size());
+    BVH* bvh = new BVH(others.data(), numOthers, options.time0, options.time1, options.method);
+    if (options.motionBVH && hasMotion(others.data(), numOthers, options))
+    {
+        MotionBVH* motionBvh = new MotionBVH(others.data(), numOthers, options.time0, options.time1);
+        if (motionBvh->sahCost() * MOTION_BVH_MIN_SAH_GAIN < bvh->sahCost())
+        {
+            delete bvh;
+            return motionBvh;
+        }
+        delete motionBvh;
+    }
+
+    if (options.accel == SceneAccelBVH)
+        return bvh;
+
+    // The wide trees only need the binary tree while collapsing it.
+    Hitable* wideBvh = nullptr;
+    if (options.accel == SceneAccelBVH4)
+        wideBvh = new BVH4(*bvh);
+    else
+        wideBvh = new BVH8(*bvh);
+    delete bvh;
+    return wideBvh;
+}
+
+static Hitable* prepareList(HitableList* world, const ScenePrepOptions& options, ScenePrepStats& stats)
+{
+    const int count = world->size();
+    Hitable* const* items = world->items();
+
+    // Prepare nested lists first.
+    for (int i = 0; i < count; i++)
+    {
+        if (items[i]->typeId() == ListTypeId)
+            world->setItem(i, prepareList(static_cast<HitableList*>(items[i]), options, stats));
+    }
+
+    std::vector<AABB<float>> boxes(count);
+    std::vector<bool> bounded(count);
+    for (int i = 0; i < count; i++)
+        bounded[i] = items[i]->bounds(options.time0, options.time1, boxes[i]);
+
+    // Union of the bounded siblings before (prefix) and after (suffix) each child.
+    std::vector<AABB<float>> prefix(count + 1), suffix(count + 1);
+    std::vector<bool> hasPrefix(count + 1, false), hasSuffix(count + 1, false);
+    for (int i = 0; i < count; i++)
+    {
+        prefix[i+1] = prefix[i];
+        hasPrefix[i+1] = hasPrefix[i];
+        if (bounded[i])
+        {
+            prefix[i+1] = hasPrefix[i] ? join(prefix[i], boxes[i]) : boxes[i];
+            hasPrefix[i+1] = true;
+        }
+    }
+    for (int i = count - 1; i >= 0; i--)
+    {
+        suffix[i] = suffix[i+1];
+        hasSuffix[i] = hasSuffix[i+1];
+        if (bounded[i])
+        {
+            suffix[i] = hasSuffix[i+1] ? join(suffix[i+1], boxes[i]) : boxes[i];
+            hasSuffix[i] = true;
+        }
+    }
+
+    std::vector<Hitable*> accelItems, linearItems;
+    for (int i = 0; i < count; i++)
+    {
+        bool enclosesSiblings = false;
+        if (bounded[i] && (hasPrefix[i] || hasSuffix[i+1]))
+        {
+            AABB<float> siblings;
+            if (hasPrefix[i] && hasSuffix[i+1])
+                siblings = join(prefix[i], suffix[i+1]);
+            else
+                siblings = hasPrefix[i] ? prefix[i] : suffix[i+1];
+            enclosesSiblings = boxes[i].contains(siblings);
+        }
+
+        if (bounded[i] && !enclosesSiblings)
+            accelItems.push_back(items[i]);
+        else
+            linearItems.push_back(items[i]);
+    }
+
+    const int numAccel = static_cast<int>(accelItems.size());
+    if (numAccel <= options.listThreshold)
+        return world;
+
+    Hitable* accel = createAccel(accelItems.data(), numAccel, options, stats);
+
+    stats.listsPromoted++;
+    stats.primitivesPromoted += numAccel;
+    stats.primitivesLinear += static_cast<int>(linearItems.size());
+
+    if (linearItems.empty())
+        return accel;
+
+    const int numLinear = static_cast<int>(linearItems.size()) + 1;
+    Hitable** linearList = new Hitable*[numLinear];
+    linearList[0] = accel;
+    for (int i = 1; i < numLinear; i++)
+        linearList[i] = linearItems[i-1];
+    return new HitableList(numLinear, linearList);
+}
+
+Hitable* PrepareScene(Hitable* world, const ScenePrepOptions& options, ScenePrepStats* stats)
+{
+    ScenePrepStats localStats;
+    if (stats == nullptr)
+        stats = &localStats;
+
+    if (world == nullptr || options.listThreshold <= 0)
+        return world;
+
+    if (world->typeId() == ListTypeId)
+        return prepareList(static_cast<HitableList*>(world), options, *stats);
+
+    return world;
+}
@@ -0,0 +1,93 @@
+/*
+ * CUDA (GPU) Pathtracer based on Peter Shirley's 'Ray Tracing in One Weekend' e-book
+ * series.
+ *
+ * Copyright (C) 2017 by Rick Weyrauch - rpweyrauch@gmail.com
+ *
+ * This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+ */
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "ptSceneCache.h"
+#include "ptMeshLoader.h"
+#include "ptStream.h"
+
+static const uint64_t FNV_PRIME = 1099511628211ull;
+
+void SceneCacheKey::add(const void* pData, size_t size)
+{
+    // FNV-1a, eight bytes at a time so that large input files hash quickly.  The shift
+    // carries the high bits of each word down, which the multiplication alone does not.
+    const unsigned char* bytes = static_cast<const unsigned char*>(pData);
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t))
+    {
+        uint64_t word;
+        memcpy(&word, bytes + i, sizeof(word));
+        m_hash = (m_hash ^ word) * FNV_PRIME;
+        m_hash ^= m_hash >> 29;
+    }
+    for (; i < size; i++)
+        m_hash = (m_hash ^ bytes[i]) * FNV_PRIME;
+
+    // The length separates consecutive inputs.
+    m_hash = (m_hash ^ static_cast<uint64_t>(size)) * FNV_PRIME;
+}
+
+uint64_t SceneCacheKey::value() const
+{
+    // Final avalanche (MurmurHash3 fmix64).
+    uint64_t h = m_hash;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+    return h;
+}
+
+void SceneCacheKey::add(const std::string& str)
+{
+    add(str.data(), str.size());
+}
+
+void SceneCacheKey::addFile(const std::string& filename)
+{
+    add(filename);
+
+    MappedFile file;
+    const int present = file.open(filename) ? 1 : 0;
+    addValue(present);
+    if (present)
+        add(file.data(), file.size());
+}
+
+std::string SceneCachePath(const std::string& directory, uint64_t key)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.ptscene", static_cast<unsigned long long>(key));
+    return directory + "/" + name;
+}
+
+bool StoreSceneCache(const Stream& stream, const std::string& directory, const std::string& path)
+{
+    if ((mkdir(directory.c_str(), 0755) != 0) && (errno != EEXIST))
+        return false;
+
+    const std::string tempPath = path + "." + std::to_string(getpid()) + ".tmp";
+    if (!stream.save(tempPath.c_str()))
+    {
+        remove(tempPath.c_str());
+        return false;
+    }
+    if (rename(tempPath.c_str(), path.c_str()) != 0)
+    {
+        remove(tempPath.c_str());
+        return false;
+    }
+    return true;
+}
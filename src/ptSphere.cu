@@ -10,33 +10,7 @@
 
 bool Sphere::hit(const Rayf &r, float tmin, float tmax, HitRecord &rec, RNG &rng) const
 {
-    Vector3f oc = r.origin() - center;
-    float a = dot(r.direction(), r.direction());
-    float b = dot(oc, r.direction());
-    float c = dot(oc, oc) - radius * radius;
-    float discriminant = b * b - a * c;
-    if (discriminant > 0)
-    {
-        float temp = (-b - Sqrt(discriminant)) / a;
-        if (temp < tmax && temp > tmin)
-        {
-            rec.t = temp;
-            rec.p = r.pointAt(rec.t);
-            rec.normal = (rec.p - center) / radius;
-            rec.material = material;
-            return true;
-        }
-        temp = (-b + Sqrt(discriminant)) / a;
-        if (temp < tmax && temp > tmin)
-        {
-            rec.t = temp;
-            rec.p = r.pointAt(rec.t);
-            rec.normal = (rec.p - center) / radius;
-            rec.material = material;
-            return true;
-        }
-    }
-    return false;
+    return hitSphere(center, radius, material, r, tmin, tmax, rec);
 }
 
 bool Sphere::serialize(Stream *pStream) const
@@ -48,7 +22,10 @@ bool Sphere::serialize(Stream *pStream) const
     bool ok = pStream->write(&id, sizeof(id));
     ok |= center.serialize(pStream);
     ok |= pStream->write(&radius, sizeof(radius));
-    ok |= material->serialize(pStream);
+    if (material != nullptr)
+        ok |= material->serialize(pStream);
+    else
+        ok |= pStream->writeNull();
     return ok;
 }
 
@@ -65,35 +42,7 @@ bool Sphere::deserialize(Stream *pStream)
 
 bool MovingSphere::hit(const Rayf &ray, float t_min, float t_max, HitRecord &rec, RNG &rng) const
 {
-    Vector3f oc = ray.origin() - center(ray.time());
-    float a = dot(ray.direction(), ray.direction());
-    float b = dot(oc, ray.direction());
-    float c = dot(oc, oc) - radius * radius;
-    float discriminant = b * b - a * c;
-    if (discriminant > 0)
-    {
-        float temp = (-b - Sqrt(discriminant)) / a;
-        if (temp < t_max && temp > t_min)
-        {
-            rec.t = temp;
-            rec.p = ray.pointAt(rec.t);
-            rec.normal = (rec.p - center(ray.time())) / radius;
-            rec.material = material;
-            get_uv(rec.p, rec.uv);
-            return true;
-        }
-        temp = (-b + Sqrt(discriminant)) / a;
-        if (temp < t_max && temp > t_min)
-        {
-            rec.t = temp;
-            rec.p = ray.pointAt(rec.t);
-            rec.normal = (rec.p - center(ray.time())) / radius;
-            rec.material = material;
-            get_uv(rec.p, rec.uv);
-            return true;
-        }
-    }
-    return false;
+    return hitSphere(center(ray.time()), radius, material, ray, t_min, t_max, rec);
 }
 
 bool MovingSphere::serialize(Stream *pStream) const
@@ -108,7 +57,10 @@ bool MovingSphere::serialize(Stream *pStream) const
     ok |= pStream->write(&time0, sizeof(time0));
     ok |= pStream->write(&time1, sizeof(time1));
     ok |= pStream->write(&radius, sizeof(radius));
-    ok |= material->serialize(pStream);
+    if (material != nullptr)
+        ok |= material->serialize(pStream);
+    else
+        ok |= pStream->writeNull();
 
     return ok;
 }
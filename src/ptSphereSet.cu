@@ -0,0 +1,304 @@
+/*
+ * CUDA (GPU) Pathtracer based on Peter Shirley's 'Ray Tracing in One Weekend' e-book
+ * series.
+ *
+ * Copyright (C) 2017 by Rick Weyrauch - rpweyrauch@gmail.com
+ *
+ * This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+ */
+
+#include <vector>
+#include <unordered_map>
+#include "ptSphereSet.h"
+#include "ptSphere.h"
+
+SphereSet::SphereSet(Hitable* const* list, int count, float time0, float time1, BVHBuildMethod method) :
+    m_time0(time0),
+    m_time1(time1)
+{
+    // Center at time zero, velocity, radius and material of every sphere.
+    std::vector<Vector3f> centers(count), velocities(count);
+    std::vector<float> radii(count);
+    std::vector<BVHPrimitiveInfo> primInfo(count);
+    std::vector<int> sphereMaterial(count);
+    std::vector<Material*> materials;
+    std::unordered_map<Material*, int> materialIndex;
+    for (int i = 0; i < count; i++)
+    {
+        Material* material = nullptr;
+        if (list[i]->typeId() == MovingSphereTypeId)
+        {
+            const MovingSphere* sphere = static_cast<const MovingSphere*>(list[i]);
+            centers[i] = sphere->center(0);
+            velocities[i] = sphere->velocity();
+            radii[i] = sphere->getRadius();
+            material = sphere->getMaterial();
+        }
+        else
+        {
+            const Sphere* sphere = static_cast<const Sphere*>(list[i]);
+            centers[i] = sphere->getCenter();
+            velocities[i] = Vector3f(0, 0, 0);
+            radii[i] = sphere->getRadius();
+            material = sphere->getMaterial();
+        }
+
+        // Swept over the shutter interval.
+        const float r = fabsf(radii[i]);
+        const Vector3f rv(r, r, r);
+        const Vector3f c0 = centers[i] + time0 * velocities[i];
+        const Vector3f c1 = centers[i] + time1 * velocities[i];
+        const AABB<float> box0(c0 - rv, c0 + rv), box1(c1 - rv, c1 + rv);
+        primInfo[i] = BVHPrimitiveInfo(i, join(box0, box1));
+        m_bbox0 = (i == 0) ? box0 : join(m_bbox0, box0);
+        m_bbox1 = (i == 0) ? box1 : join(m_bbox1, box1);
+
+        auto found = materialIndex.find(material);
+        if (found == materialIndex.end())
+        {
+            found = materialIndex.emplace(material, static_cast<int>(materials.size())).first;
+            materials.push_back(material);
+        }
+        sphereMaterial[i] = found->second;
+    }
+
+    if (count == 0)
+        return;
+
+    std::vector<LinearBVHNode> linearNodes;
+    BuildBVHNodes(primInfo, method, PacketWidth, linearNodes, PacketWidth);
+    m_numSpheres = count;
+
+    // One packet per leaf, unused lanes cleared.
+    std::vector<int> leaves;
+    for (int i = 0; i < static_cast<int>(linearNodes.size()); i++)
+    {
+        if (linearNodes[i].numPrims > 0)
+            leaves.push_back(i);
+    }
+    m_numPackets = static_cast<int>(leaves.size());
+    m_packets = new SpherePacket<PacketWidth>[m_numPackets];
+    m_materialIndices = new int[m_numPackets * PacketWidth];
+    for (int p = 0; p < m_numPackets; p++)
+    {
+        LinearBVHNode& leaf = linearNodes[leaves[p]];
+        for (int lane = 0; lane < PacketWidth; lane++)
+        {
+            if (lane < leaf.numPrims)
+            {
+                const int index = primInfo[leaf.primitivesOffset + lane].index;
+                m_packets[p].set(lane, centers[index], velocities[index], radii[index]);
+                m_materialIndices[p * PacketWidth + lane] = sphereMaterial[index];
+            }
+            else
+            {
+                m_packets[p].clear(lane);
+                m_materialIndices[p * PacketWidth + lane] = -1;
+            }
+        }
+        leaf.primitivesOffset = p;
+    }
+
+    m_numMaterials = static_cast<int>(materials.size());
+    m_materials = new Material*[m_numMaterials];
+    std::copy(materials.begin(), materials.end(), m_materials);
+
+    m_numNodes = static_cast<int>(linearNodes.size());
+    m_nodes = new LinearBVHNode[m_numNodes];
+    std::copy(linearNodes.begin(), linearNodes.end(), m_nodes);
+}
+
+bool SphereSet::hit(const Rayf& r, float tmin, float tmax, HitRecord& rec, RNG& rng) const
+{
+    if (m_nodes == nullptr)
+        return false;
+
+    const Vector3f invDir(1 / r.direction().x(), 1 / r.direction().y(), 1 / r.direction().z());
+    const int dirIsNeg[3] = { invDir.x() < 0, invDir.y() < 0, invDir.z() < 0 };
+
+    int hitPacket = -1, hitLane = -1;
+    int toVisitOffset = 0;
+    uint32_t currentNodeIndex = 0;
+    uint32_t nodesToVisit[BVH_MAX_DEPTH];
+    while (true)
+    {
+        const LinearBVHNode* node = &m_nodes[currentNodeIndex];
+        if (node->bounds.hit(r, invDir, dirIsNeg, tmin, tmax))
+        {
+            if (node->numPrims > 0)
+            {
+                const int packet = node->primitivesOffset;
+                const int lane = intersectSpheres(m_packets[packet], r, tmin, tmax);
+                if (lane >= 0)
+                {
+                    hitPacket = packet;
+                    hitLane = lane;
+                }
+                if (toVisitOffset == 0) break;
+                currentNodeIndex = nodesToVisit[--toVisitOffset];
+            }
+            else
+            {
+                if (dirIsNeg[node->axis])
+                {
+                    nodesToVisit[toVisitOffset++] = currentNodeIndex + 1;
+                    currentNodeIndex = node->secondChildOffset;
+                }
+                else
+                {
+                    nodesToVisit[toVisitOffset++] = node->secondChildOffset;
+                    currentNodeIndex = currentNodeIndex + 1;
+                }
+            }
+        }
+        else
+        {
+            if (toVisitOffset == 0) break;
+            currentNodeIndex = nodesToVisit[--toVisitOffset];
+        }
+    }
+
+    if (hitPacket < 0)
+        return false;
+
+    // Shade only the closest hit.
+    const SpherePacket<PacketWidth>& packet = m_packets[hitPacket];
+    rec.t = tmax;
+    rec.p = r.pointAt(tmax);
+    rec.normal = (rec.p - packet.centerAt(hitLane, r.time())) / packet.radius[hitLane];
+    rec.material = MaterialIndex(m_materials[m_materialIndices[hitPacket * PacketWidth + hitLane]]);
+    get_uv(rec.normal, rec.uv);
+    return true;
+}
+
+bool SphereSet::bounds(float t0, float t1, AABB<float>& bbox) const
+{
+    if (m_nodes == nullptr)
+        return false;
+    bbox = m_nodes[0].bounds;
+    return true;
+}
+
+bool SphereSet::motionBounds(float t0, float t1, AABB<float>& bbox0, AABB<float>& bbox1) const
+{
+    if (m_nodes == nullptr)
+        return false;
+
+    // Exact only for the interval the set was built over.
+    if (t0 != m_time0 || t1 != m_time1)
+        return Hitable::motionBounds(t0, t1, bbox0, bbox1);
+
+    bbox0 = m_bbox0;
+    bbox1 = m_bbox1;
+    return true;
+}
+
+bool SphereSet::isStatic(int lane) const
+{
+    const SpherePacket<PacketWidth>& packet = m_packets[lane / PacketWidth];
+    const int i = lane % PacketWidth;
+    return m_materialIndices[lane] >= 0 && packet.velocity[0][i] == 0 && packet.velocity[1][i] == 0 && packet.velocity[2][i] == 0;
+}
+
+Sphere SphereSet::sphere(int lane) const
+{
+    const SpherePacket<PacketWidth>& packet = m_packets[lane / PacketWidth];
+    const int i = lane % PacketWidth;
+    return Sphere(packet.centerAt(i, 0), packet.radius[i], m_materials[m_materialIndices[lane]]);
+}
+
+// Moving spheres are not sampled, as MovingSphere isn't.
+float SphereSet::pdfValue(const Vector3f& o, const Vector3f& v, RNG& rng) const
+{
+    const float weight = 1 / (float)m_numSpheres;
+    float sum = 0;
+    for (int lane = 0; lane < m_numPackets * PacketWidth; lane++)
+    {
+        if (isStatic(lane))
+            sum += weight * sphere(lane).pdfValue(o, v, rng);
+    }
+    return sum;
+}
+
+Vector3f SphereSet::random(const Vector3f& o, RNG& rng) const
+{
+    int index = Clamp(int(rng.rand() * m_numSpheres), 0, m_numSpheres - 1);
+    for (int lane = 0; lane < m_numPackets * PacketWidth; lane++)
+    {
+        if (m_materialIndices[lane] >= 0 && index-- == 0)
+            return isStatic(lane) ? sphere(lane).random(o, rng) : Vector3f(1, 0, 0);
+    }
+    return Vector3f(1, 0, 0);
+}
+
+bool SphereSet::serialize(Stream *pStream) const
+{
+    if (pStream == nullptr)
+        return false;
+
+    const int id = typeId();
+    bool ok = pStream->write(&id, sizeof(id));
+    ok &= pStream->write(&m_numSpheres, sizeof(m_numSpheres));
+    ok &= pStream->write(&m_numPackets, sizeof(m_numPackets));
+    if (m_numPackets > 0)
+    {
+        ok &= pStream->writeArray(m_packets, m_numPackets * sizeof(SpherePacket<PacketWidth>));
+        ok &= pStream->writeArray(m_materialIndices, m_numPackets * PacketWidth * sizeof(int));
+    }
+
+    ok &= pStream->write(&m_numMaterials, sizeof(m_numMaterials));
+    for (int i = 0; i < m_numMaterials; i++)
+    {
+        if (m_materials[i] != nullptr)
+            ok &= m_materials[i]->serialize(pStream);
+        else
+            ok &= pStream->writeNull();
+    }
+
+    ok &= pStream->write(&m_numNodes, sizeof(m_numNodes));
+    if (m_numNodes > 0)
+        ok &= pStream->writeArray(m_nodes, m_numNodes * sizeof(LinearBVHNode));
+
+    ok &= pStream->write(&m_time0, sizeof(m_time0));
+    ok &= pStream->write(&m_time1, sizeof(m_time1));
+    ok &= m_bbox0.serialize(pStream);
+    ok &= m_bbox1.serialize(pStream);
+
+    return ok;
+}
+
+bool SphereSet::deserialize(Stream *pStream)
+{
+    if (pStream == nullptr)
+        return false;
+
+    m_arraysInStream = pStream->readsInPlace();
+    bool ok = pStream->read(&m_numSpheres, sizeof(m_numSpheres));
+    ok &= pStream->read(&m_numPackets, sizeof(m_numPackets));
+    if (ok && (m_numPackets > 0))
+    {
+        ok &= pStream->readArray(m_packets, m_numPackets);
+        ok &= pStream->readArray(m_materialIndices, m_numPackets * PacketWidth);
+    }
+
+    ok &= pStream->read(&m_numMaterials, sizeof(m_numMaterials));
+    if (ok && (m_numMaterials > 0))
+    {
+        m_materials = new Material*[m_numMaterials];
+        for (int i = 0; i < m_numMaterials; i++)
+        {
+            m_materials[i] = Material::Create(pStream);
+        }
+    }
+
+    ok &= pStream->read(&m_numNodes, sizeof(m_numNodes));
+    if (ok && (m_numNodes > 0))
+        ok &= pStream->readArray(m_nodes, m_numNodes);
+
+    ok &= pStream->read(&m_time0, sizeof(m_time0));
+    ok &= pStream->read(&m_time1, sizeof(m_time1));
+    ok &= m_bbox0.deserialize(pStream);
+    ok &= m_bbox1.deserialize(pStream);
+
+    return ok;
+}
@@ -7,11 +7,41 @@
  * This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
  */
 
+#ifndef PT_CPU_ONLY
 #include <cuda_runtime.h>
+#endif
+#ifdef PT_CPU_ONLY
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#include <cstdio>
+#include <cstdlib>
 #include <cstring>
 #include <cstdint>
 #include "ptStream.h"
 
+// Start of a scene file, followed by the serialized data.  The packet width is part of
+// the layout of the packed primitives.
+struct SceneFileHeader
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t packetWidth;
+    uint64_t size;
+};
+
+static const uint32_t SCENE_FILE_MAGIC = MakeFourCC('P', 'T', 'S', 'C');
+
+static_assert(sizeof(SceneFileHeader) % Stream::ARRAY_ALIGNMENT == 0, "Scene file data must stay aligned");
+
+static bool validHeader(const SceneFileHeader& header, size_t dataSize)
+{
+    return (header.magic == SCENE_FILE_MAGIC) && (header.version == SCENE_FILE_VERSION) &&
+           (header.packetWidth == PRIMITIVE_PACKET_WIDTH) && (header.size <= dataSize);
+}
+
 Stream::Stream()
 {
 }
@@ -22,6 +52,9 @@ Stream::~Stream()
     if (ownBuffer)
         close();
 #endif
+    delete[] writtenObjects;
+    delete[] writtenHandles;
+    delete[] readObjects;
 }
 
 bool Stream::create(size_t size)
@@ -29,11 +62,19 @@ bool Stream::create(size_t size)
     if (pBuffer != nullptr)
         return false;
 
+#ifdef PT_CPU_ONLY
+    pBuffer = malloc(size);
+    if (pBuffer == nullptr)
+    {
+        return false;
+    }
+#else
     cudaError_t err = cudaMallocManaged(&pBuffer, size);
     if (err != cudaSuccess)
     {
         return false;
     }
+#endif
 
     bufferSize = size;
 
@@ -42,25 +83,140 @@ bool Stream::create(size_t size)
 
 bool Stream::close()
 {
+#ifdef PT_CPU_ONLY
+    if (pMapping != nullptr)
+    {
+        munmap(pMapping, mappingSize);
+        pMapping = nullptr;
+        mappingSize = 0;
+        pBuffer = nullptr;
+        bufferSize = 0;
+    }
+#endif
     if (pBuffer != nullptr)
     {
+#ifdef PT_CPU_ONLY
+        free(pBuffer);
+        pBuffer = nullptr;
+        bufferSize = 0;
+#else
         cudaError_t err = cudaFree(pBuffer);
         pBuffer = nullptr;
         bufferSize = 0;
 
         if (err != cudaSuccess) return false;
+#endif
     }
     return true;
 }
 
-bool Stream::write(const void* pData, size_t size)
+bool Stream::save(const char* path) const
 {
     if (pBuffer == nullptr)
         return false;
 
-    if (writeOffset + size >= bufferSize)
+    FILE* fp = fopen(path, "wb");
+    if (fp == nullptr)
+        return false;
+
+    SceneFileHeader header;
+    header.magic = SCENE_FILE_MAGIC;
+    header.version = SCENE_FILE_VERSION;
+    header.packetWidth = PRIMITIVE_PACKET_WIDTH;
+    header.size = writeOffset;
+    bool ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+    ok = ok && (fwrite(pBuffer, 1, writeOffset, fp) == writeOffset);
+    ok = (fclose(fp) == 0) && ok;
+
+    return ok;
+}
+
+bool Stream::open(const char* path)
+{
+    if (pBuffer != nullptr)
+        return false;
+
+#ifdef PT_CPU_ONLY
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if ((fstat(fd, &st) != 0) || (static_cast<size_t>(st.st_size) < sizeof(SceneFileHeader)))
+    {
+        ::close(fd);
+        return false;
+    }
+
+    // Private and writable, so that objects may still modify what they read in place.
+    const size_t fileSize = static_cast<size_t>(st.st_size);
+    void* mapping = mmap(nullptr, fileSize, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED)
+        return false;
+
+    const SceneFileHeader* header = static_cast<const SceneFileHeader*>(mapping);
+    if (!validHeader(*header, fileSize - sizeof(SceneFileHeader)))
+    {
+        munmap(mapping, fileSize);
+        return false;
+    }
+
+    pMapping = mapping;
+    mappingSize = fileSize;
+    pBuffer = static_cast<uint8_t*>(mapping) + sizeof(SceneFileHeader);
+    bufferSize = header->size;
+#else
+    FILE* fp = fopen(path, "rb");
+    if (fp == nullptr)
         return false;
 
+    SceneFileHeader header;
+    bool ok = fread(&header, sizeof(header), 1, fp) == 1;
+    fseek(fp, 0, SEEK_END);
+    const long fileSize = ftell(fp);
+    fseek(fp, sizeof(header), SEEK_SET);
+    ok = ok && (fileSize >= long(sizeof(header))) && validHeader(header, size_t(fileSize) - sizeof(header));
+    ok = ok && create(header.size);
+    ok = ok && (fread(pBuffer, 1, header.size, fp) == header.size);
+    fclose(fp);
+    if (!ok)
+    {
+        close();
+        return false;
+    }
+#endif
+
+    ownBuffer = true;
+    writeOffset = bufferSize;
+    readOffset = 0;
+
+    return true;
+}
+
+void Stream::measure()
+{
+    if (pBuffer != nullptr)
+        return;
+
+    measuring = true;
+    writeOffset = 0;
+}
+
+bool Stream::write(const void* pData, size_t size)
+{
+    if (measuring)
+    {
+        writeOffset += size;
+        return true;
+    }
+
+    if ((pBuffer == nullptr) || (writeOffset + size > bufferSize))
+    {
+        failed = true;
+        return false;
+    }
+
     uint8_t* pDest = (uint8_t*)pBuffer + writeOffset;
     memcpy(pDest, pData, size);
     writeOffset += size;
@@ -74,13 +230,34 @@ bool Stream::writeNull()
     return write(&nullId, sizeof(nullId));
 }
 
-bool Stream::read(void* pData, size_t size)
+bool Stream::writeArray(const void* pData, size_t size)
 {
-    if (pBuffer == nullptr)
+    const size_t start = (writeOffset + ARRAY_ALIGNMENT - 1) & ~(ARRAY_ALIGNMENT - 1);
+    if (measuring)
+    {
+        writeOffset = start + size;
+        return true;
+    }
+
+    if ((pBuffer == nullptr) || (start + size > bufferSize))
+    {
+        failed = true;
         return false;
+    }
 
-    if (readOffset + size >= bufferSize)
+    memset((uint8_t*)pBuffer + writeOffset, 0, start - writeOffset);
+    writeOffset = start;
+
+    return write(pData, size);
+}
+
+bool Stream::read(void* pData, size_t size)
+{
+    if ((pBuffer == nullptr) || (readOffset + size > bufferSize))
+    {
+        failed = true;
         return false;
+    }
 
     const uint8_t* pSrc = (uint8_t*)pBuffer + readOffset;
     memcpy(pData, pSrc, size);
@@ -88,3 +265,96 @@ bool Stream::read(void* pData, size_t size)
 
     return true;
 }
+
+const void* Stream::readArrayData(size_t size)
+{
+    const size_t start = (readOffset + ARRAY_ALIGNMENT - 1) & ~(ARRAY_ALIGNMENT - 1);
+    if ((pBuffer == nullptr) || (start + size > bufferSize))
+    {
+        failed = true;
+        return nullptr;
+    }
+
+    readOffset = start + size;
+
+    return (const uint8_t*)pBuffer + start;
+}
+
+static uint32_t addressSlot(const void* object, uint32_t capacity)
+{
+    const uint64_t a = reinterpret_cast<uintptr_t>(object) >> 4;
+    return static_cast<uint32_t>((a * 0x9E3779B97F4A7C15ull) >> 32) & (capacity - 1);
+}
+
+void Stream::growWrittenObjects()
+{
+    const uint32_t oldCapacity = writtenCapacity;
+    const void** oldObjects = writtenObjects;
+    uint32_t* oldHandles = writtenHandles;
+
+    writtenCapacity = (oldCapacity > 0) ? 2 * oldCapacity : 64;
+    writtenObjects = new const void*[writtenCapacity];
+    writtenHandles = new uint32_t[writtenCapacity];
+    for (uint32_t i = 0; i < writtenCapacity; i++)
+        writtenObjects[i] = nullptr;
+
+    for (uint32_t i = 0; i < oldCapacity; i++)
+    {
+        if (oldObjects[i] == nullptr)
+            continue;
+        uint32_t slot = addressSlot(oldObjects[i], writtenCapacity);
+        while (writtenObjects[slot] != nullptr)
+            slot = (slot + 1) & (writtenCapacity - 1);
+        writtenObjects[slot] = oldObjects[i];
+        writtenHandles[slot] = oldHandles[i];
+    }
+
+    delete[] oldObjects;
+    delete[] oldHandles;
+}
+
+bool Stream::writeReference(const void* object)
+{
+    // Keep the table at most half full.
+    if (2 * (numWritten + 1) > writtenCapacity)
+        growWrittenObjects();
+
+    uint32_t slot = addressSlot(object, writtenCapacity);
+    while (writtenObjects[slot] != nullptr)
+    {
+        if (writtenObjects[slot] == object)
+        {
+            const int id = ReferenceTypeId;
+            write(&id, sizeof(id));
+            write(&writtenHandles[slot], sizeof(uint32_t));
+            return true;
+        }
+        slot = (slot + 1) & (writtenCapacity - 1);
+    }
+
+    writtenObjects[slot] = object;
+    writtenHandles[slot] = numWritten++;
+    return false;
+}
+
+void Stream::addReference(void* object)
+{
+    if (numRead == readCapacity)
+    {
+        readCapacity = (readCapacity > 0) ? 2 * readCapacity : 64;
+        void** objects = new void*[readCapacity];
+        for (uint32_t i = 0; i < numRead; i++)
+            objects[i] = readObjects[i];
+        delete[] readObjects;
+        readObjects = objects;
+    }
+    readObjects[numRead++] = object;
+}
+
+void* Stream::readReference()
+{
+    uint32_t handle = 0;
+    if (!read(&handle, sizeof(handle)) || (handle >= numRead))
+        return nullptr;
+    return readObjects[handle];
+}
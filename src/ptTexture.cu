@@ -22,6 +22,8 @@ Texture* Texture::Create(Stream* pStream)
 
     switch (typeId)
     {
+        case ReferenceTypeId:
+            return static_cast<Texture*>(pStream->readReference());
         case ConstantTextureTypeId:
             texture = new ConstantTexture();
             break;
@@ -38,6 +40,7 @@ Texture* Texture::Create(Stream* pStream)
             return nullptr;
     }
 
+    pStream->addReference(texture);
     ok = texture->deserialize(pStream);
     if (!ok)
     {
@@ -0,0 +1,162 @@
+/*
+ * CUDA (GPU) Pathtracer based on Peter Shirley's 'Ray Tracing in One Weekend' e-book
+ * series.
+ *
+ * Copyright (C) 2017 by Rick Weyrauch - rpweyrauch@gmail.com
+ *
+ * This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+#include "ptTileScheduler.h"
+
+// Interleaves the bits of x and y (x in the even bits).
+static uint64_t mortonCode(uint32_t x, uint32_t y)
+{
+    uint64_t code = 0;
+    for (int bit = 0; bit < 32; bit++)
+    {
+        code |= static_cast<uint64_t>((x >> bit) & 1u) << (2 * bit);
+        code |= static_cast<uint64_t>((y >> bit) & 1u) << (2 * bit + 1);
+    }
+    return code;
+}
+
+std::vector<ImageTile> MortonOrderedTiles(int nx, int ny, int tileSize)
+{
+    tileSize = std::max(tileSize, 1);
+    const int numX = (nx + tileSize - 1) / tileSize;
+    const int numY = (ny + tileSize - 1) / tileSize;
+
+    std::vector<std::pair<uint64_t, ImageTile>> ordered;
+    ordered.reserve(numX * numY);
+    for (int ty = 0; ty < numY; ty++)
+    {
+        for (int tx = 0; tx < numX; tx++)
+        {
+            ImageTile tile;
+            tile.x0 = tx * tileSize;
+            tile.y0 = ty * tileSize;
+            tile.x1 = std::min(tile.x0 + tileSize, nx);
+            tile.y1 = std::min(tile.y0 + tileSize, ny);
+            ordered.push_back(std::make_pair(mortonCode(tx, ty), tile));
+        }
+    }
+    std::sort(ordered.begin(), ordered.end(),
+              [](const std::pair<uint64_t, ImageTile>& a, const std::pair<uint64_t, ImageTile>& b) { return a.first < b.first; });
+
+    std::vector<ImageTile> tiles;
+    tiles.reserve(ordered.size());
+    for (const auto& entry : ordered)
+        tiles.push_back(entry.second);
+    return tiles;
+}
+
+TileScheduler::TileScheduler(int numThreads)
+{
+    if (numThreads <= 0)
+        numThreads = static_cast<int>(std::thread::hardware_concurrency());
+    m_numThreads = std::max(numThreads, 1);
+}
+
+int TileScheduler::steal(std::vector<WorkQueue>& queues, int thread, uint32_t& victimSeed)
+{
+    // Visit the other threads from a random start, so that thieves spread out.
+    victimSeed ^= victimSeed << 13;
+    victimSeed ^= victimSeed >> 17;
+    victimSeed ^= victimSeed << 5;
+    const int start = static_cast<int>(victimSeed % m_numThreads);
+
+    std::vector<int> loot;
+    for (int i = 0; i < m_numThreads && loot.empty(); i++)
+    {
+        const int victim = (start + i) % m_numThreads;
+        if (victim == thread)
+            continue;
+
+        std::lock_guard<std::mutex> guard(queues[victim].lock);
+        std::deque<int>& tiles = queues[victim].tiles;
+        const size_t count = (tiles.size() + 1) / 2;
+        loot.assign(tiles.end() - count, tiles.end());
+        tiles.erase(tiles.end() - count, tiles.end());
+    }
+    if (loot.empty())
+        return -1;
+
+    // Keep the first stolen tile, queue the rest in curve order.
+    if (loot.size() > 1)
+    {
+        std::lock_guard<std::mutex> guard(queues[thread].lock);
+        queues[thread].tiles.insert(queues[thread].tiles.end(), loot.begin() + 1, loot.end());
+    }
+    return loot.front();
+}
+
+void TileScheduler::run(const std::vector<ImageTile>& tiles, const std::function<void(const ImageTile&, int)>& renderTile)
+{
+    const auto runStart = std::chrono::steady_clock::now();
+
+    std::vector<WorkQueue> queues(m_numThreads);
+    const size_t numTiles = tiles.size();
+    for (int t = 0; t < m_numThreads; t++)
+    {
+        const size_t begin = numTiles * t / m_numThreads;
+        const size_t end = numTiles * (t + 1) / m_numThreads;
+        for (size_t i = begin; i < end; i++)
+            queues[t].tiles.push_back(static_cast<int>(i));
+    }
+
+    m_stats.assign(m_numThreads, ThreadStats());
+    std::atomic<int> remaining(static_cast<int>(numTiles));
+
+    auto worker = [&](int thread)
+    {
+        ThreadStats& stats = m_stats[thread];
+        uint32_t victimSeed = 2654435761u * static_cast<uint32_t>(thread + 1);
+        while (remaining.load() > 0)
+        {
+            int tile = -1;
+            bool stolen = false;
+            {
+                std::lock_guard<std::mutex> guard(queues[thread].lock);
+                if (!queues[thread].tiles.empty())
+                {
+                    tile = queues[thread].tiles.front();
+                    queues[thread].tiles.pop_front();
+                }
+            }
+            if (tile < 0)
+            {
+                tile = steal(queues, thread, victimSeed);
+                stolen = true;
+            }
+            if (tile < 0)
+            {
+                // The last tiles are being rendered elsewhere.
+                std::this_thread::yield();
+                continue;
+            }
+
+            const auto tileStart = std::chrono::steady_clock::now();
+            renderTile(tiles[tile], thread);
+            stats.busySeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - tileStart).count();
+            stats.tiles++;
+            if (stolen)
+                stats.tilesStolen++;
+            remaining--;
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (int t = 1; t < m_numThreads; t++)
+        threads.emplace_back(worker, t);
+    worker(0);
+    for (std::thread& thread : threads)
+        thread.join();
+
+    m_wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - runStart).count();
+}
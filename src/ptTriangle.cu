@@ -7,6 +7,7 @@
  * This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
  */
 
+#include <algorithm>
 #include "ptTriangle.h"
 #include "ptMaterial.h"
 
@@ -62,10 +63,10 @@ bool Triangle::hit(const Rayf& r, float t_min, float t_max, HitRecord& rec, RNG&
         return false;
 
     // Calculate t, scale parameters, ray intersects triangle.
-    float t = dot(edge2, qvec);
+    const auto inv_det = 1 / det;
+    float t = dot(edge2, qvec) * inv_det;
     if (t < t_min || t > t_max) return false;
 
-    const auto inv_det = 1 / det;
     u *= inv_det;
     v *= inv_det;
 
@@ -73,7 +74,7 @@ bool Triangle::hit(const Rayf& r, float t_min, float t_max, HitRecord& rec, RNG&
     rec.p = (1 - u - v) * v0 + u * v1 + v * v2;
     rec.normal = cross(edge1, edge2);
     rec.normal.make_unit_vector();
-    rec.material = material;
+    rec.material = MaterialIndex(material);
 
     Vector3f bary(1.0 - u - v, u, v);
     calcTexCoord(bary, rec.uv);
@@ -124,7 +125,10 @@ bool Triangle::serialize(Stream *pStream) const
     ok |= t0.serialize(pStream);
     ok |= t1.serialize(pStream);
     ok |= t2.serialize(pStream);
-    ok |= material->serialize(pStream);
+    if (material != nullptr)
+        ok |= material->serialize(pStream);
+    else
+        ok |= pStream->writeNull();
     ok |= bbox.serialize(pStream);
 
     return ok;
@@ -150,10 +154,78 @@ bool Triangle::deserialize(Stream *pStream)
 
 bool TriangleMesh::hit(const Rayf& r, float t_min, float t_max, HitRecord& rec, RNG& rng) const
 {
-    return false;
+    if (nodes == nullptr)
+        return false;
+
+    const Vector3f invDir(1 / r.direction().x(), 1 / r.direction().y(), 1 / r.direction().z());
+    const int dirIsNeg[3] = { invDir.x() < 0, invDir.y() < 0, invDir.z() < 0 };
+
+    int hitTri = -1;
+    float hitU = 0, hitV = 0;
+    int toVisitOffset = 0;
+    uint32_t currentNodeIndex = 0;
+    uint32_t nodesToVisit[BVH_MAX_DEPTH];
+    while (true)
+    {
+        const LinearBVHNode* node = &nodes[currentNodeIndex];
+        if (node->bounds.hit(r, invDir, dirIsNeg, t_min, t_max))
+        {
+            if (node->numPrims > 0)
+            {
+                const int packet = node->primitivesOffset;
+                const int lane = intersectTriangles(packets[packet], r, t_min, t_max, hitU, hitV);
+                if (lane >= 0)
+                    hitTri = packet * PacketWidth + lane;
+                if (toVisitOffset == 0) break;
+                currentNodeIndex = nodesToVisit[--toVisitOffset];
+            }
+            else
+            {
+                if (dirIsNeg[node->axis])
+                {
+                    nodesToVisit[toVisitOffset++] = currentNodeIndex + 1;
+                    currentNodeIndex = node->secondChildOffset;
+                }
+                else
+                {
+                    nodesToVisit[toVisitOffset++] = node->secondChildOffset;
+                    currentNodeIndex = currentNodeIndex + 1;
+                }
+            }
+        }
+        else
+        {
+            if (toVisitOffset == 0) break;
+            currentNodeIndex = nodesToVisit[--toVisitOffset];
+        }
+    }
+
+    if (hitTri < 0)
+        return false;
+
+    // Shade only the closest hit.
+    const TriIndex& ip = triIndices[hitTri];
+    const Vector3f hitBary(1 - hitU - hitV, hitU, hitV);
+    rec.t = t_max;
+    rec.p = r.pointAt(t_max);
+    rec.normal = Vector3f(0, 0, 0);
+    if (normalView.valid())
+        rec.normal = hitBary.x() * normalView[ip.i0] + hitBary.y() * normalView[ip.i1] + hitBary.z() * normalView[ip.i2];
+    if (rec.normal.squared_length() == 0)
+    {
+        const Vector3f v0 = positionView[ip.i0];
+        rec.normal = cross(positionView[ip.i1] - v0, positionView[ip.i2] - v0);
+    }
+    rec.normal.make_unit_vector();
+    rec.uv = Vector2f(0, 0);
+    if (texCoordView.valid())
+        rec.uv = hitBary.x() * texCoordView[ip.i0] + hitBary.y() * texCoordView[ip.i1] + hitBary.z() * texCoordView[ip.i2];
+    rec.material = MaterialIndex(material);
+
+    return true;
 }
 
-bool TriangleMesh::hit(const Rayf& ray, const TriangleFast& accel, float& tHit, Vector3f& bary) const
+bool TriangleMesh::hit(const Rayf& ray, const TriangleFast& accel, float t_min, float t_max, float& tHit, Vector3f& bary)
 {
     //
     // "Real Time Ray Tracing and Interactive Global Illumination", Ingo Wald:
@@ -162,14 +234,15 @@ bool TriangleMesh::hit(const Rayf& ray, const TriangleFast& accel, float& tHit,
     // Jakko Bikker
     // http://www.flipcode.com/articles/article_raytrace07.shtml
     //
-    static int axisModulo[] = { 0, 1, 2, 0, 1 };
+    const int axisModulo[] = { 0, 1, 2, 0, 1 };
     const int ku = axisModulo[accel.m_k+1];
     const int kv = axisModulo[accel.m_k+2];
 
     const float nd = 1 / (ray.direction()[accel.m_k] + accel.m_nu * ray.direction()[ku] + accel.m_nv * ray.direction()[kv]);
     float t = (accel.m_nd - ray.origin()[accel.m_k] - accel.m_nu * ray.origin()[ku] - accel.m_nv * ray.origin()[kv]) * nd;
 
-    if (t < 0)
+    // Also rejects the NaN of a ray parallel to the plane.
+    if (!(t > t_min && t < t_max))
     {
         return false;
     }
@@ -196,7 +269,11 @@ bool TriangleMesh::hit(const Rayf& ray, const TriangleFast& accel, float& tHit,
 
 bool TriangleMesh::bounds(float t0, float t1, AABB<float>& bbox) const
 {
-    return false;
+    if (nodes == nullptr)
+        return false;
+
+    bbox = this->bbox;
+    return true;
 }
 
 void TriangleMesh::addVertex(const Vector3f& p, const Vector3f& n, const Vector2f& tex)
@@ -206,18 +283,208 @@ void TriangleMesh::addVertex(const Vector3f& p, const Vector3f& n, const Vector2
     texCoords.push_back(tex);
 }
 
-void TriangleMesh::complete()
+void TriangleMesh::reserve(int numVertices, int numTriangles)
+{
+    verts.reserve(verts.size() + numVertices);
+    normals.reserve(normals.size() + numVertices);
+    texCoords.reserve(texCoords.size() + numVertices);
+    triangles.reserve(triangles.size() + numTriangles);
+}
+
+void TriangleMesh::addVertices(const Vector3f* p, const Vector3f* n, const Vector2f* tex, int numVertices)
+{
+    verts.insert(verts.end(), p, p + numVertices);
+    if (n != nullptr)
+        normals.insert(normals.end(), n, n + numVertices);
+    else
+        normals.resize(normals.size() + numVertices, Vector3f(0, 0, 0));
+    if (tex != nullptr)
+        texCoords.insert(texCoords.end(), tex, tex + numVertices);
+    else
+        texCoords.resize(texCoords.size() + numVertices, Vector2f(0, 0));
+}
+
+void TriangleMesh::addTriangles(const TriIndex* tris, int numTriangles)
 {
-    delete[] triAccel;
-    count = triangles.size();
-    triAccel = new TriangleFast[count];
+    triangles.insert(triangles.end(), tris, tris + numTriangles);
+}
+
+void TriangleMesh::setVertexViews(const StridedView<Vector3f>& p, const StridedView<Vector3f>& n, const StridedView<Vector2f>& tex,
+                                  int numVertices, std::shared_ptr<const void> owner)
+{
+    std::vector<Vector3f>().swap(verts);
+    std::vector<Vector3f>().swap(normals);
+    std::vector<Vector2f>().swap(texCoords);
+
+    numVerts = numVertices;
+    positionView = p;
+    normalView = n;
+    texCoordView = tex;
+    this->owner = std::move(owner);
+}
+
+void TriangleMesh::setIndexView(const StridedView<TriIndex>& tris, int numTriangles)
+{
+    std::vector<TriIndex>().swap(triangles);
 
-    int i = 0;
-    for (const auto ip : triangles)
+    indexView = tris;
+    numIndexViewTriangles = numTriangles;
+}
+
+void TriangleMesh::complete(BVHBuildMethod method)
+{
+    if (arraysInStream)
+    {
+        packets = nullptr;
+        triIndices = nullptr;
+        nodes = nullptr;
+        vertPositions = nullptr;
+        vertNormals = nullptr;
+        vertTexCoords = nullptr;
+        arraysInStream = false;
+    }
+    delete[] packets;
+    delete[] triIndices;
+    delete[] nodes;
+    packets = nullptr;
+    triIndices = nullptr;
+    nodes = nullptr;
+    count = 0;
+    numPackets = 0;
+    numNodes = 0;
+
+    // Vertices added one by one are moved into owned arrays, views set by an importer
+    // are used as they are.
+    if (!verts.empty() || !positionView.valid())
     {
-        TriangleFast triFast(verts[ip.i0], verts[ip.i1],  verts[ip.i2]);
-        triAccel[i++] = triFast;
+        delete[] vertPositions;
+        delete[] vertNormals;
+        delete[] vertTexCoords;
+        numVerts = static_cast<int>(verts.size());
+        vertPositions = new Vector3f[numVerts];
+        vertNormals = new Vector3f[numVerts];
+        vertTexCoords = new Vector2f[numVerts];
+        std::copy(verts.begin(), verts.end(), vertPositions);
+        std::copy(normals.begin(), normals.end(), vertNormals);
+        std::copy(texCoords.begin(), texCoords.end(), vertTexCoords);
+        positionView = StridedView<Vector3f>(vertPositions);
+        normalView = StridedView<Vector3f>(vertNormals);
+        texCoordView = StridedView<Vector2f>(vertTexCoords);
+        owner.reset();
     }
+
+    StridedView<TriIndex> tris(triangles.data());
+    int numTriangles = static_cast<int>(triangles.size());
+    if (indexView.valid())
+    {
+        tris = indexView;
+        numTriangles = numIndexViewTriangles;
+    }
+
+    // Bounds of the valid triangles; degenerate and out of range ones get no entry.
+    std::vector<BVHPrimitiveInfo> allInfo(numTriangles);
+    std::vector<char> valid(numTriangles, 0);
+#pragma omp parallel for schedule(static)
+    for (int i = 0; i < numTriangles; i++)
+    {
+        const TriIndex ip = tris[i];
+        if (ip.i0 >= (unsigned)numVerts || ip.i1 >= (unsigned)numVerts || ip.i2 >= (unsigned)numVerts)
+            continue;
+
+        const Vector3f v0 = positionView[ip.i0];
+        const Vector3f v1 = positionView[ip.i1];
+        const Vector3f v2 = positionView[ip.i2];
+        if (cross(v1 - v0, v2 - v0).squared_length() == 0)
+            continue;
+
+        Vector3f bmin, bmax;
+        for (int k = 0; k < 3; k++)
+        {
+            bmin[k] = Min(v0[k], Min(v1[k], v2[k])) - 0.0001f;
+            bmax[k] = Max(v0[k], Max(v1[k], v2[k])) + 0.0001f;
+        }
+        allInfo[i] = BVHPrimitiveInfo(i, AABB<float>(bmin, bmax));
+        valid[i] = 1;
+    }
+
+    std::vector<BVHPrimitiveInfo> primInfo;
+    primInfo.reserve(numTriangles);
+    for (int i = 0; i < numTriangles; i++)
+    {
+        if (valid[i])
+            primInfo.push_back(allInfo[i]);
+    }
+    std::vector<BVHPrimitiveInfo>().swap(allInfo);
+
+    if (!primInfo.empty())
+    {
+        std::vector<LinearBVHNode> linearNodes;
+        BuildBVHNodes(primInfo, method, PacketWidth, linearNodes, PacketWidth);
+        count = static_cast<int>(primInfo.size());
+
+        // One packet per leaf, unused lanes cleared.
+        std::vector<int> leaves;
+        for (int i = 0; i < static_cast<int>(linearNodes.size()); i++)
+        {
+            if (linearNodes[i].numPrims > 0)
+                leaves.push_back(i);
+        }
+        numPackets = static_cast<int>(leaves.size());
+        packets = new TrianglePacket<PacketWidth>[numPackets];
+        triIndices = new TriIndex[numPackets * PacketWidth];
+#pragma omp parallel for schedule(static)
+        for (int p = 0; p < numPackets; p++)
+        {
+            LinearBVHNode& leaf = linearNodes[leaves[p]];
+            for (int lane = 0; lane < PacketWidth; lane++)
+            {
+                if (lane < leaf.numPrims)
+                {
+                    const TriIndex ip = tris[primInfo[leaf.primitivesOffset + lane].index];
+                    triIndices[p * PacketWidth + lane] = ip;
+                    packets[p].set(lane, positionView[ip.i0], positionView[ip.i1], positionView[ip.i2]);
+                }
+                else
+                {
+                    triIndices[p * PacketWidth + lane] = { 0, 0, 0 };
+                    packets[p].clear(lane);
+                }
+            }
+            leaf.primitivesOffset = p;
+        }
+
+        numNodes = static_cast<int>(linearNodes.size());
+        nodes = new LinearBVHNode[numNodes];
+        std::copy(linearNodes.begin(), linearNodes.end(), nodes);
+        bbox = nodes[0].bounds;
+    }
+
+    std::vector<Vector3f>().swap(verts);
+    std::vector<Vector3f>().swap(normals);
+    std::vector<Vector2f>().swap(texCoords);
+    std::vector<TriIndex>().swap(triangles);
+    indexView = StridedView<TriIndex>();
+    numIndexViewTriangles = 0;
+}
+
+// Writes a view tightly packed, as an array of the stream.
+template <typename T>
+static bool writeView(Stream* pStream, const StridedView<T>& view, int n)
+{
+    if (view.packed())
+        return pStream->writeArray(view.data, n * sizeof(T));
+
+    // The first element aligns the array, the others follow it.
+    bool ok = true;
+    for (int i = 0; i < n; i++)
+    {
+        const T value = view[i];
+        if (i == 0)
+            ok &= pStream->writeArray(&value, sizeof(T));
+        else
+            ok &= pStream->write(&value, sizeof(T));
+    }
+    return ok;
 }
 
 bool TriangleMesh::serialize(Stream *pStream) const
@@ -227,20 +494,38 @@ bool TriangleMesh::serialize(Stream *pStream) const
 
     const int id = typeId();
     bool ok = pStream->write(&id, sizeof(id));
-    ok |= pStream->write(&count, sizeof(count));
-    for (int i = 0; i < count && ok; i++)
+    ok &= pStream->write(&count, sizeof(count));
+    ok &= pStream->write(&numPackets, sizeof(numPackets));
+    if (numPackets > 0)
     {
-        ok |= triAccel[i].m_v0.serialize(pStream);
-        ok |= pStream->write(&triAccel[i].m_nu, sizeof(float));
-        ok |= pStream->write(&triAccel[i].m_nv, sizeof(float));
-        ok |= pStream->write(&triAccel[i].m_nd, sizeof(float));
-        ok |= pStream->write(&triAccel[i].m_k, sizeof(int));
-        ok |= pStream->write(&triAccel[i].m_bnu, sizeof(float));
-        ok |= pStream->write(&triAccel[i].m_bnv, sizeof(float));
-        ok |= pStream->write(&triAccel[i].m_cnu, sizeof(float));
-        ok |= pStream->write(&triAccel[i].m_cnv, sizeof(float));
+        ok &= pStream->writeArray(packets, numPackets * sizeof(TrianglePacket<PacketWidth>));
+        ok &= pStream->writeArray(triIndices, numPackets * PacketWidth * sizeof(TriIndex));
     }
 
+    ok &= pStream->write(&numVerts, sizeof(numVerts));
+    if (numVerts > 0)
+    {
+        const int hasNormals = normalView.valid() ? 1 : 0;
+        const int hasTexCoords = texCoordView.valid() ? 1 : 0;
+        ok &= pStream->write(&hasNormals, sizeof(hasNormals));
+        ok &= pStream->write(&hasTexCoords, sizeof(hasTexCoords));
+        ok &= writeView(pStream, positionView, numVerts);
+        if (hasNormals)
+            ok &= writeView(pStream, normalView, numVerts);
+        if (hasTexCoords)
+            ok &= writeView(pStream, texCoordView, numVerts);
+    }
+
+    ok &= pStream->write(&numNodes, sizeof(numNodes));
+    if (numNodes > 0)
+        ok &= pStream->writeArray(nodes, numNodes * sizeof(LinearBVHNode));
+
+    if (material != nullptr)
+        ok &= material->serialize(pStream);
+    else
+        ok &= pStream->writeNull();
+    ok &= bbox.serialize(pStream);
+
     return ok;
 }
 
@@ -249,24 +534,42 @@ bool TriangleMesh::deserialize(Stream *pStream)
     if (pStream == nullptr)
         return false;
 
+    arraysInStream = pStream->readsInPlace();
     bool ok = pStream->read(&count, sizeof(count));
-    if (ok && (count > 0))
+    ok &= pStream->read(&numPackets, sizeof(numPackets));
+    if (ok && (numPackets > 0))
+    {
+        ok &= pStream->readArray(packets, numPackets);
+        ok &= pStream->readArray(triIndices, numPackets * PacketWidth);
+    }
+
+    ok &= pStream->read(&numVerts, sizeof(numVerts));
+    if (ok && (numVerts > 0))
     {
-        triAccel = new TriangleFast[count];
-        for (int i = 0; i < count && ok; i++)
+        int hasNormals = 0, hasTexCoords = 0;
+        ok &= pStream->read(&hasNormals, sizeof(hasNormals));
+        ok &= pStream->read(&hasTexCoords, sizeof(hasTexCoords));
+        ok &= pStream->readArray(vertPositions, numVerts);
+        positionView = StridedView<Vector3f>(vertPositions);
+        if (hasNormals)
         {
-            ok |= triAccel[i].m_v0.deserialize(pStream);
-            ok |= pStream->read(&triAccel[i].m_nu, sizeof(float));
-            ok |= pStream->read(&triAccel[i].m_nv, sizeof(float));
-            ok |= pStream->read(&triAccel[i].m_nd, sizeof(float));
-            ok |= pStream->read(&triAccel[i].m_k, sizeof(int));
-            ok |= pStream->read(&triAccel[i].m_bnu, sizeof(float));
-            ok |= pStream->read(&triAccel[i].m_bnv, sizeof(float));
-            ok |= pStream->read(&triAccel[i].m_cnu, sizeof(float));
-            ok |= pStream->read(&triAccel[i].m_cnv, sizeof(float));
+            ok &= pStream->readArray(vertNormals, numVerts);
+            normalView = StridedView<Vector3f>(vertNormals);
+        }
+        if (hasTexCoords)
+        {
+            ok &= pStream->readArray(vertTexCoords, numVerts);
+            texCoordView = StridedView<Vector2f>(vertTexCoords);
         }
     }
 
+    ok &= pStream->read(&numNodes, sizeof(numNodes));
+    if (ok && (numNodes > 0))
+        ok &= pStream->readArray(nodes, numNodes);
+
+    material = Material::Create(pStream);
+    ok &= bbox.deserialize(pStream);
+
     return ok;
 }
 
@@ -0,0 +1,369 @@
+/*
+ * CUDA (GPU) Pathtracer based on Peter Shirley's 'Ray Tracing in One Weekend' e-book
+ * series.
+ *
+ * Copyright (C) 2017 by Rick Weyrauch - rpweyrauch@gmail.com
+ *
+ * This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+ */
+
+#include <cfloat>
+#if !defined(__CUDA_ARCH__) && (defined(__SSE__) || defined(__AVX__))
+#include <immintrin.h>
+#endif
+#include "ptRNG.h"
+#include "ptWideBVH.h"
+
+template <int N>
+static WideBVHNode<N> emptyWideNode()
+{
+    WideBVHNode<N> node;
+    for (int i = 0; i < N; i++)
+    {
+        for (int a = 0; a < 3; a++)
+        {
+            node.bmin[a][i] = FLT_MAX;
+            node.bmax[a][i] = -FLT_MAX;
+        }
+        node.child[i] = -1;
+        node.numPrims[i] = 0;
+    }
+    return node;
+}
+
+//
+// Slab test of one ray against the N child boxes of a node.  Returns a bit mask of
+// the children overlapping [tmin, tmax] and the entry distance of every child.
+//
+template <int N>
+COMMON_FUNC inline int intersectChildrenScalar(const WideBVHNode<N>& node, const Vector3f& org, const Vector3f& invDir,
+                                               const int dirIsNeg[3], float tmin, float tmax, float* tEntry)
+{
+    int mask = 0;
+    for (int i = 0; i < N; i++)
+    {
+        float t0 = tmin;
+        float t1 = tmax;
+        for (int a = 0; a < 3; a++)
+        {
+            const float tNear = ((dirIsNeg[a] ? node.bmax[a][i] : node.bmin[a][i]) - org[a]) * invDir[a];
+            const float tFar = ((dirIsNeg[a] ? node.bmin[a][i] : node.bmax[a][i]) - org[a]) * invDir[a];
+            t0 = tNear > t0 ? tNear : t0;
+            t1 = tFar < t1 ? tFar : t1;
+        }
+        tEntry[i] = t0;
+        if (t0 < t1)
+            mask |= (1 << i);
+    }
+    return mask;
+}
+
+#ifndef __CUDA_ARCH__
+
+inline int intersectChildrenSimd(const WideBVHNode<4>& node, const Vector3f& org, const Vector3f& invDir,
+                                 const int dirIsNeg[3], float tmin, float tmax, float* tEntry)
+{
+#if defined(__SSE__)
+    // _mm_max_ps/_mm_min_ps return the second operand when the first is NaN, which
+    // matches the scalar test for rays lying in a slab plane.
+    __m128 t0 = _mm_set1_ps(tmin);
+    __m128 t1 = _mm_set1_ps(tmax);
+    for (int a = 0; a < 3; a++)
+    {
+        const __m128 o = _mm_set1_ps(org[a]);
+        const __m128 inv = _mm_set1_ps(invDir[a]);
+        const __m128 tNear = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(dirIsNeg[a] ? node.bmax[a] : node.bmin[a]), o), inv);
+        const __m128 tFar = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(dirIsNeg[a] ? node.bmin[a] : node.bmax[a]), o), inv);
+        t0 = _mm_max_ps(tNear, t0);
+        t1 = _mm_min_ps(tFar, t1);
+    }
+    _mm_storeu_ps(tEntry, t0);
+    return _mm_movemask_ps(_mm_cmplt_ps(t0, t1));
+#else
+    return intersectChildrenScalar(node, org, invDir, dirIsNeg, tmin, tmax, tEntry);
+#endif
+}
+
+inline int intersectChildrenSimd(const WideBVHNode<8>& node, const Vector3f& org, const Vector3f& invDir,
+                                 const int dirIsNeg[3], float tmin, float tmax, float* tEntry)
+{
+#if defined(__AVX__)
+    __m256 t0 = _mm256_set1_ps(tmin);
+    __m256 t1 = _mm256_set1_ps(tmax);
+    for (int a = 0; a < 3; a++)
+    {
+        const __m256 o = _mm256_set1_ps(org[a]);
+        const __m256 inv = _mm256_set1_ps(invDir[a]);
+        const __m256 tNear = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(dirIsNeg[a] ? node.bmax[a] : node.bmin[a]), o), inv);
+        const __m256 tFar = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(dirIsNeg[a] ? node.bmin[a] : node.bmax[a]), o), inv);
+        t0 = _mm256_max_ps(tNear, t0);
+        t1 = _mm256_min_ps(tFar, t1);
+    }
+    _mm256_storeu_ps(tEntry, t0);
+    return _mm256_movemask_ps(_mm256_cmp_ps(t0, t1, _CMP_LT_OQ));
+#else
+    return intersectChildrenScalar(node, org, invDir, dirIsNeg, tmin, tmax, tEntry);
+#endif
+}
+
+#endif // __CUDA_ARCH__
+
+template <int N>
+COMMON_FUNC inline int intersectChildren(const WideBVHNode<N>& node, const Vector3f& org, const Vector3f& invDir,
+                                         const int dirIsNeg[3], float tmin, float tmax, float* tEntry)
+{
+#ifdef __CUDA_ARCH__
+    return intersectChildrenScalar(node, org, invDir, dirIsNeg, tmin, tmax, tEntry);
+#else
+    return intersectChildrenSimd(node, org, invDir, dirIsNeg, tmin, tmax, tEntry);
+#endif
+}
+
+template <int N>
+WideBVH<N>::WideBVH(const BVH& bvh)
+{
+    if (bvh.nodeCount() == 0)
+        return;
+
+    m_numPrims = bvh.primitiveCount();
+    m_prims = new Hitable*[m_numPrims];
+    for (int i = 0; i < m_numPrims; i++)
+        m_prims[i] = bvh.primitives()[i];
+    m_records = CreatePrimitives(m_prims, m_numPrims);
+
+    bvh.bounds(0, 0, m_bbox);
+
+    std::vector<WideBVHNode<N>> wideNodes;
+    wideNodes.reserve(bvh.nodeCount() / 2 + 1);
+    collapse(bvh.nodes(), 0, wideNodes);
+
+    m_numNodes = (int)wideNodes.size();
+    m_nodes = new WideBVHNode<N>[m_numNodes];
+    for (int i = 0; i < m_numNodes; i++)
+        m_nodes[i] = wideNodes[i];
+}
+
+template <int N>
+int WideBVH<N>::collapse(const LinearBVHNode* binaryNodes, uint32_t index, std::vector<WideBVHNode<N>>& wideNodes)
+{
+    const int wideIndex = (int)wideNodes.size();
+    wideNodes.push_back(emptyWideNode<N>());
+
+    // Start with the two children (or the node itself if it is a leaf) and keep
+    // opening the interior child with the largest surface area until N slots are used.
+    uint32_t slots[N];
+    int numSlots = 0;
+    if (binaryNodes[index].numPrims > 0)
+    {
+        slots[numSlots++] = index;
+    }
+    else
+    {
+        slots[numSlots++] = index + 1;
+        slots[numSlots++] = binaryNodes[index].secondChildOffset;
+    }
+
+    while (numSlots < N)
+    {
+        int best = -1;
+        float bestArea = -1;
+        for (int s = 0; s < numSlots; s++)
+        {
+            const LinearBVHNode& node = binaryNodes[slots[s]];
+            if (node.numPrims == 0 && node.bounds.surfaceArea() > bestArea)
+            {
+                bestArea = node.bounds.surfaceArea();
+                best = s;
+            }
+        }
+        if (best < 0)
+            break;
+
+        const uint32_t expand = slots[best];
+        slots[best] = expand + 1;
+        slots[numSlots++] = binaryNodes[expand].secondChildOffset;
+    }
+
+    for (int s = 0; s < numSlots; s++)
+    {
+        const LinearBVHNode& node = binaryNodes[slots[s]];
+        int32_t child;
+        uint16_t numPrims;
+        if (node.numPrims > 0)
+        {
+            child = static_cast<int32_t>(node.primitivesOffset);
+            numPrims = node.numPrims;
+        }
+        else
+        {
+            child = collapse(binaryNodes, slots[s], wideNodes);
+            numPrims = 0;
+        }
+
+        // The recursion above may have reallocated the node array.
+        WideBVHNode<N>& wideNode = wideNodes[wideIndex];
+        for (int a = 0; a < 3; a++)
+        {
+            wideNode.bmin[a][s] = node.bounds.min()[a];
+            wideNode.bmax[a][s] = node.bounds.max()[a];
+        }
+        wideNode.child[s] = child;
+        wideNode.numPrims[s] = numPrims;
+    }
+
+    return wideIndex;
+}
+
+template <int N>
+bool WideBVH<N>::hit(const Rayf& r, float tmin, float tmax, HitRecord& rec, RNG& rng) const
+{
+    if (m_nodes == nullptr)
+        return false;
+
+    struct StackEntry
+    {
+        int32_t child;
+        uint16_t numPrims;
+        float t;        // entry distance of the child box
+    };
+
+    const Vector3f invDir(1 / r.direction().x(), 1 / r.direction().y(), 1 / r.direction().z());
+    const int dirIsNeg[3] = { invDir.x() < 0, invDir.y() < 0, invDir.z() < 0 };
+
+    StackEntry stack[BVH_MAX_DEPTH * N];
+    int stackSize = 0;
+    stack[stackSize++] = { 0, 0, tmin };
+
+    bool hitAnything = false;
+    while (stackSize > 0)
+    {
+        const StackEntry entry = stack[--stackSize];
+
+        // The closest hit may have moved in front of this child since it was pushed.
+        if (entry.t >= tmax)
+            continue;
+
+        if (entry.numPrims > 0)
+        {
+            for (int i = 0; i < entry.numPrims; i++)
+            {
+                if (hitPrimitive(m_records[entry.child + i], r, tmin, tmax, rec, rng))
+                {
+                    hitAnything = true;
+                    tmax = rec.t;
+                }
+            }
+            continue;
+        }
+
+        const WideBVHNode<N>& node = m_nodes[entry.child];
+        float tEntry[N];
+        const int mask = intersectChildren(node, r.origin(), invDir, dirIsNeg, tmin, tmax, tEntry);
+        if (mask == 0)
+            continue;
+
+        // Order the hit children front to back, then push them back to front so
+        // the nearest one is visited next.
+        StackEntry hits[N];
+        int numHits = 0;
+        for (int i = 0; i < N; i++)
+        {
+            if ((mask & (1 << i)) == 0)
+                continue;
+
+            StackEntry child = { node.child[i], node.numPrims[i], tEntry[i] };
+            int j = numHits++;
+            while (j > 0 && hits[j-1].t > child.t)
+            {
+                hits[j] = hits[j-1];
+                j--;
+            }
+            hits[j] = child;
+        }
+        for (int i = numHits - 1; i >= 0; i--)
+            stack[stackSize++] = hits[i];
+    }
+    return hitAnything;
+}
+
+template <int N>
+bool WideBVH<N>::bounds(float t0, float t1, AABB<float>& bbox) const
+{
+    if (m_nodes == nullptr)
+        return false;
+
+    bbox = m_bbox;
+    return true;
+}
+
+template <int N>
+float WideBVH<N>::pdfValue(const Vector3f& o, const Vector3f& v, RNG& rng) const
+{
+    float weight = 1 / (float)m_numPrims;
+    float sum = 0;
+    for (int i = 0; i < m_numPrims; i++)
+    {
+        sum += weight * m_prims[i]->pdfValue(o, v, rng);
+    }
+    return sum;
+}
+
+template <int N>
+Vector3f WideBVH<N>::random(const Vector3f& o, RNG& rng) const
+{
+    auto index = Clamp(int(rng.rand() * m_numPrims), 0, m_numPrims - 1);
+    return m_prims[index]->random(o, rng);
+}
+
+template <int N>
+bool WideBVH<N>::serialize(Stream *pStream) const
+{
+    if (pStream == nullptr)
+        return false;
+
+    const int id = typeId();
+    bool ok = pStream->write(&id, sizeof(id));
+    ok &= pStream->write(&m_numPrims, sizeof(m_numPrims));
+    for (int i = 0; i < m_numPrims; i++)
+    {
+        ok &= m_prims[i]->serialize(pStream);
+    }
+
+    ok &= m_bbox.serialize(pStream);
+    ok &= pStream->write(&m_numNodes, sizeof(m_numNodes));
+    if (m_numNodes > 0)
+        ok &= pStream->writeArray(m_nodes, m_numNodes * sizeof(WideBVHNode<N>));
+
+    return ok;
+}
+
+template <int N>
+bool WideBVH<N>::deserialize(Stream *pStream)
+{
+    if (pStream == nullptr)
+        return false;
+
+    bool ok = pStream->read(&m_numPrims, sizeof(m_numPrims));
+    if (ok && (m_numPrims > 0))
+    {
+        m_prims = new Hitable*[m_numPrims];
+        for (int i = 0; i < m_numPrims; i++)
+        {
+            m_prims[i] = Hitable::Create(pStream);
+        }
+        m_records = CreatePrimitives(m_prims, m_numPrims);
+    }
+
+    ok &= m_bbox.deserialize(pStream);
+    ok &= pStream->read(&m_numNodes, sizeof(m_numNodes));
+    if (ok && (m_numNodes > 0))
+    {
+        ok &= pStream->readArray(m_nodes, m_numNodes);
+        m_arraysInStream = pStream->readsInPlace();
+    }
+
+    return ok;
+}
+
+template class WideBVH<4>;
+template class WideBVH<8>;